@@ -148,6 +148,8 @@ struct ppp {
 #endif /* CONFIG_PPP_FILTER */
 	struct net	*ppp_net;	/* the net we belong to */
 	struct ppp_link_stats stats64;	/* 64 bit network stats */
+	struct pcpu_sw_netstats __percpu *pcpu_stats; /* fast path stats */
+	struct channel __rcu *xmit_chan; /* first channel, for fast path */
 };
 
 /*
@@ -175,6 +177,7 @@ struct channel {
 	struct net	*chan_net;	/* the net channel belongs to */
 	struct list_head clist;		/* link in list of channels per unit */
 	rwlock_t	upl;		/* protects `ppp' */
+	struct rcu_head	rcu;		/* freed after ppp.xmit_chan users */
 #ifdef CONFIG_PPP_MULTILINK
 	u8		avail;		/* flag used in multilink stuff */
 	u8		had_frag;	/* >= 1 fragments have been sent */
@@ -196,6 +199,12 @@ struct ppp_config {
  * before you modify them.
  * The lock ordering is: channel.upl -> ppp.wlock -> ppp.rlock ->
  * channel.downl.
+ *
+ * Units that do no compression, filtering or multilink send and
+ * receive data frames without ppp.wlock/ppp.rlock (see ppp_fast_path()).
+ * The transmit side then finds its channel through ppp.xmit_chan, which
+ * is updated with both unit locks held and read under RCU; channels are
+ * freed after a grace period for that reason.
  */
 
 static DEFINE_MUTEX(ppp_mutex);
@@ -372,6 +381,10 @@ static const int npindex_to_ethertype[NUM_NP] = {
 #define ppp_unlock(ppp)		do { ppp_recv_unlock(ppp); \
 				     ppp_xmit_unlock(ppp); } while (0)
 
+/* Any of these flags sends all traffic of a unit through the locked path */
+#define PPP_FAST_PATH_MASK	(SC_MULTILINK | SC_LOOP_TRAFFIC | SC_CCP_OPEN | \
+				 SC_CCP_UP | SC_MUST_COMP | SC_COMP_TCP)
+
 /*
  * /dev/ppp device routines.
  * The /dev/ppp device is used by pppd to control the ppp unit.
@@ -1130,6 +1143,12 @@ static int ppp_dev_configure(struct net *src_net, struct net_device *dev,
 	for_each_possible_cpu(cpu)
 		(*per_cpu_ptr(ppp->xmit_recursion, cpu)) = 0;
 
+	ppp->pcpu_stats = netdev_alloc_pcpu_stats(struct pcpu_sw_netstats);
+	if (!ppp->pcpu_stats) {
+		err = -ENOMEM;
+		goto err2;
+	}
+
 #ifdef CONFIG_PPP_MULTILINK
 	ppp->minseq = -1;
 	skb_queue_head_init(&ppp->mrq);
@@ -1141,11 +1160,13 @@ static int ppp_dev_configure(struct net *src_net, struct net_device *dev,
 
 	err = ppp_unit_register(ppp, conf->unit, conf->ifname_is_set);
 	if (err < 0)
-		goto err2;
+		goto err3;
 
 	conf->file->private_data = &ppp->file;
 
 	return 0;
+err3:
+	free_percpu(ppp->pcpu_stats);
 err2:
 	free_percpu(ppp->xmit_recursion);
 err1:
@@ -1395,21 +1416,54 @@ ppp_net_ioctl(struct net_device *dev, struct ifreq *ifr, int cmd)
 	return err;
 }
 
+/* Add the counters of the lockless fast path to @st */
+static void ppp_add_pcpu_stats(struct ppp *ppp, struct ppp_link_stats *st)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		const struct pcpu_sw_netstats *tstats;
+		u64 rx_packets, rx_bytes, tx_packets, tx_bytes;
+		unsigned int start;
+
+		tstats = per_cpu_ptr(ppp->pcpu_stats, cpu);
+		do {
+			start = u64_stats_fetch_begin_irq(&tstats->syncp);
+			rx_packets = tstats->rx_packets;
+			rx_bytes = tstats->rx_bytes;
+			tx_packets = tstats->tx_packets;
+			tx_bytes = tstats->tx_bytes;
+		} while (u64_stats_fetch_retry_irq(&tstats->syncp, start));
+
+		st->rx_packets += rx_packets;
+		st->rx_bytes += rx_bytes;
+		st->tx_packets += tx_packets;
+		st->tx_bytes += tx_bytes;
+	}
+}
+
 static void
 ppp_get_stats64(struct net_device *dev, struct rtnl_link_stats64 *stats64)
 {
 	struct ppp *ppp = netdev_priv(dev);
+	struct ppp_link_stats st;
 
 	ppp_recv_lock(ppp);
-	stats64->rx_packets = ppp->stats64.rx_packets;
-	stats64->rx_bytes   = ppp->stats64.rx_bytes;
+	st.rx_packets = ppp->stats64.rx_packets;
+	st.rx_bytes   = ppp->stats64.rx_bytes;
 	ppp_recv_unlock(ppp);
 
 	ppp_xmit_lock(ppp);
-	stats64->tx_packets = ppp->stats64.tx_packets;
-	stats64->tx_bytes   = ppp->stats64.tx_bytes;
+	st.tx_packets = ppp->stats64.tx_packets;
+	st.tx_bytes   = ppp->stats64.tx_bytes;
 	ppp_xmit_unlock(ppp);
 
+	ppp_add_pcpu_stats(ppp, &st);
+	stats64->rx_packets = st.rx_packets;
+	stats64->rx_bytes   = st.rx_bytes;
+	stats64->tx_packets = st.tx_packets;
+	stats64->tx_bytes   = st.tx_bytes;
+
 	stats64->rx_errors        = dev->stats.rx_errors;
 	stats64->tx_errors        = dev->stats.tx_errors;
 	stats64->rx_dropped       = dev->stats.rx_dropped;
@@ -1518,6 +1572,66 @@ static void __ppp_xmit_process(struct ppp *ppp, struct sk_buff *skb)
 	ppp_xmit_unlock(ppp);
 }
 
+/*
+ * Check whether frames of this unit may bypass the unit locks.
+ * The state is sampled without locking; a frame racing with a
+ * configuration change is handled as if it was sent before it.
+ */
+static bool ppp_fast_path(struct ppp *ppp)
+{
+	if (READ_ONCE(ppp->flags) & PPP_FAST_PATH_MASK)
+		return false;
+	if (READ_ONCE(ppp->xc_state) || READ_ONCE(ppp->rc_state) ||
+	    READ_ONCE(ppp->closing))
+		return false;
+#ifdef CONFIG_PPP_FILTER
+	if (READ_ONCE(ppp->pass_filter) || READ_ONCE(ppp->active_filter))
+		return false;
+#endif /* CONFIG_PPP_FILTER */
+	return true;
+}
+
+/*
+ * Hand a frame straight to the unit's channel, taking only that
+ * channel's downl.  Returns false, with the skb untouched, if the
+ * frame has to go through the unit transmit queue instead: because
+ * something is queued there already, or the channel can't take it.
+ */
+static bool ppp_xmit_fast(struct ppp *ppp, struct sk_buff *skb)
+{
+	struct pcpu_sw_netstats *tstats;
+	int proto = PPP_PROTO(skb);
+	unsigned int len = skb->len - 2;
+	struct channel *pch;
+	bool sent = false;
+
+	if (!ppp_fast_path(ppp) || proto == PPP_CCP ||
+	    READ_ONCE(ppp->xmit_pending) ||
+	    !skb_queue_empty_lockless(&ppp->file.xq))
+		return false;
+
+	rcu_read_lock();
+	pch = rcu_dereference(ppp->xmit_chan);
+	if (pch) {
+		spin_lock(&pch->downl);
+		if (pch->chan)
+			sent = pch->chan->ops->start_xmit(pch->chan, skb);
+		spin_unlock(&pch->downl);
+	}
+	rcu_read_unlock();
+	if (!sent)
+		return false;
+
+	if (proto < 0x8000)
+		WRITE_ONCE(ppp->last_xmit, jiffies);
+	tstats = this_cpu_ptr(ppp->pcpu_stats);
+	u64_stats_update_begin(&tstats->syncp);
+	tstats->tx_packets++;
+	tstats->tx_bytes += len;
+	u64_stats_update_end(&tstats->syncp);
+	return true;
+}
+
 static void ppp_xmit_process(struct ppp *ppp, struct sk_buff *skb)
 {
 	local_bh_disable();
@@ -1526,7 +1640,8 @@ static void ppp_xmit_process(struct ppp *ppp, struct sk_buff *skb)
 		goto err;
 
 	(*this_cpu_ptr(ppp->xmit_recursion))++;
-	__ppp_xmit_process(ppp, skb);
+	if (!skb || !ppp_xmit_fast(ppp, skb))
+		__ppp_xmit_process(ppp, skb);
 	(*this_cpu_ptr(ppp->xmit_recursion))--;
 
 	local_bh_enable();
@@ -2049,6 +2164,58 @@ struct ppp_mp_skb_parm {
 };
 #define PPP_MP_CB(skb)	((struct ppp_mp_skb_parm *)((skb)->cb))
 
+/*
+ * Give a network protocol frame to the kernel, or drop it if the
+ * interface is down or the protocol isn't passed.
+ */
+static void
+ppp_deliver_frame(struct ppp *ppp, struct sk_buff *skb, int npi)
+{
+	if ((ppp->dev->flags & IFF_UP) == 0 ||
+	    READ_ONCE(ppp->npmode[npi]) != NPMODE_PASS) {
+		kfree_skb(skb);
+	} else {
+		/* chop off protocol */
+		skb_pull_rcsum(skb, 2);
+		skb->dev = ppp->dev;
+		skb->protocol = htons(npindex_to_ethertype[npi]);
+		skb_reset_mac_header(skb);
+		skb_scrub_packet(skb, !net_eq(ppp->ppp_net,
+					      dev_net(ppp->dev)));
+		netif_rx(skb);
+	}
+}
+
+/*
+ * Receive a network protocol frame without taking ppp->rlock, if the
+ * unit state allows it.  Anything else (control frames, compressed
+ * frames, multilink) is left to ppp_do_recv() and false is returned.
+ * The caller holds pch->upl, which keeps the unit around.
+ */
+static bool
+ppp_receive_fast(struct ppp *ppp, struct sk_buff *skb)
+{
+	struct pcpu_sw_netstats *tstats;
+	int npi;
+
+	if (!ppp_fast_path(ppp))
+		return false;
+	npi = proto_to_npindex(PPP_PROTO(skb));
+	if (npi < 0)
+		return false;
+
+	skb_checksum_complete_unset(skb);
+	tstats = this_cpu_ptr(ppp->pcpu_stats);
+	u64_stats_update_begin(&tstats->syncp);
+	tstats->rx_packets++;
+	tstats->rx_bytes += skb->len - 2;
+	u64_stats_update_end(&tstats->syncp);
+
+	WRITE_ONCE(ppp->last_recv, jiffies);
+	ppp_deliver_frame(ppp, skb, npi);
+	return true;
+}
+
 static inline void
 ppp_do_recv(struct ppp *ppp, struct sk_buff *skb, struct channel *pch)
 {
@@ -2130,7 +2297,7 @@ ppp_input(struct ppp_channel *chan, struct sk_buff *skb)
 		       (skb = skb_dequeue(&pch->file.rq)))
 			kfree_skb(skb);
 		wake_up_interruptible(&pch->file.rwait);
-	} else {
+	} else if (!ppp_receive_fast(pch->ppp, skb)) {
 		ppp_do_recv(pch->ppp, skb, pch);
 	}
 
@@ -2314,19 +2481,7 @@ ppp_receive_nonmp_frame(struct ppp *ppp, struct sk_buff *skb)
 #endif /* CONFIG_PPP_FILTER */
 			ppp->last_recv = jiffies;
 
-		if ((ppp->dev->flags & IFF_UP) == 0 ||
-		    ppp->npmode[npi] != NPMODE_PASS) {
-			kfree_skb(skb);
-		} else {
-			/* chop off protocol */
-			skb_pull_rcsum(skb, 2);
-			skb->dev = ppp->dev;
-			skb->protocol = htons(npindex_to_ethertype[npi]);
-			skb_reset_mac_header(skb);
-			skb_scrub_packet(skb, !net_eq(ppp->ppp_net,
-						      dev_net(ppp->dev)));
-			netif_rx(skb);
-		}
+		ppp_deliver_frame(ppp, skb, npi);
 	}
 	return;
 
@@ -3098,14 +3253,17 @@ static void
 ppp_get_stats(struct ppp *ppp, struct ppp_stats *st)
 {
 	struct slcompress *vj = ppp->vj;
+	struct ppp_link_stats link_stats = ppp->stats64;
+
+	ppp_add_pcpu_stats(ppp, &link_stats);
 
 	memset(st, 0, sizeof(*st));
-	st->p.ppp_ipackets = ppp->stats64.rx_packets;
+	st->p.ppp_ipackets = link_stats.rx_packets;
 	st->p.ppp_ierrors = ppp->dev->stats.rx_errors;
-	st->p.ppp_ibytes = ppp->stats64.rx_bytes;
-	st->p.ppp_opackets = ppp->stats64.tx_packets;
+	st->p.ppp_ibytes = link_stats.rx_bytes;
+	st->p.ppp_opackets = link_stats.tx_packets;
 	st->p.ppp_oerrors = ppp->dev->stats.tx_errors;
-	st->p.ppp_obytes = ppp->stats64.tx_bytes;
+	st->p.ppp_obytes = link_stats.tx_bytes;
 	if (!vj)
 		return;
 	st->vj.vjs_packets = vj->sls_o_compressed + vj->sls_o_uncompressed;
@@ -3220,6 +3378,7 @@ static void ppp_destroy_interface(struct ppp *ppp)
 
 	kfree_skb(ppp->xmit_pending);
 	free_percpu(ppp->xmit_recursion);
+	free_percpu(ppp->pcpu_stats);
 
 	free_netdev(ppp->dev);
 }
@@ -3262,6 +3421,18 @@ ppp_find_channel(struct ppp_net *pn, int unit)
 	return NULL;
 }
 
+/*
+ * Publish the channel the fast transmit path sends on, which is
+ * the one ppp_push() uses without multilink.  Both unit locks held.
+ */
+static void
+ppp_update_xmit_chan(struct ppp *ppp)
+{
+	rcu_assign_pointer(ppp->xmit_chan,
+			   list_first_entry_or_null(&ppp->channels,
+						    struct channel, clist));
+}
+
 /*
  * Connect a PPP channel to a PPP interface unit.
  */
@@ -3301,6 +3472,7 @@ ppp_connect_channel(struct channel *pch, int unit)
 		ppp->dev->hard_header_len = hdrlen;
 	list_add_tail(&pch->clist, &ppp->channels);
 	++ppp->n_channels;
+	ppp_update_xmit_chan(ppp);
 	pch->ppp = ppp;
 	refcount_inc(&ppp->file.refcnt);
 	ppp_unlock(ppp);
@@ -3330,6 +3502,7 @@ ppp_disconnect_channel(struct channel *pch)
 		/* remove it from the ppp unit's list */
 		ppp_lock(ppp);
 		list_del(&pch->clist);
+		ppp_update_xmit_chan(ppp);
 		if (--ppp->n_channels == 0)
 			wake_up_interruptible(&ppp->file.rwait);
 		ppp_unlock(ppp);
@@ -3357,7 +3530,7 @@ static void ppp_destroy_channel(struct channel *pch)
 	}
 	skb_queue_purge(&pch->file.xq);
 	skb_queue_purge(&pch->file.rq);
-	kfree(pch);
+	kfree_rcu(pch, rcu);
 }
 
 static void __exit ppp_cleanup(void)
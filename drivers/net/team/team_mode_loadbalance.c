@@ -31,7 +31,7 @@ struct lb_priv;
 
 typedef struct team_port *lb_select_tx_port_func_t(struct team *,
 						   struct lb_priv *,
-						   struct sk_buff *,
+						   struct team_port *,
 						   unsigned char);
 
 #define LB_TX_HASHTABLE_SIZE 256 /* hash is a char */
@@ -56,8 +56,20 @@ struct lb_port_mapping {
 	struct team_option_inst_info *opt_inst_info;
 };
 
+/* Fully resolved hash to tx port table, used by lb_transmit(). It is
+ * rebuilt under team->lock whenever the tx method, the hash to port
+ * mapping or the set of enabled ports changes and swapped in via RCU,
+ * so the transmit path needs a single lookup and no per-packet walk
+ * of the enabled port hashlist.
+ */
+struct lb_port_map {
+	struct rcu_head rcu;
+	struct team_port *ports[LB_TX_HASHTABLE_SIZE];
+};
+
 struct lb_priv_ex {
 	struct team *team;
+	lb_select_tx_port_func_t *select_tx_port_func;
 	struct lb_port_mapping tx_hash_to_port_mapping[LB_TX_HASHTABLE_SIZE];
 	struct sock_fprog_kern *orig_fprog;
 	struct {
@@ -69,7 +81,7 @@ struct lb_priv_ex {
 
 struct lb_priv {
 	struct bpf_prog __rcu *fp;
-	lb_select_tx_port_func_t __rcu *select_tx_port_func;
+	struct lb_port_map __rcu *port_map;
 	struct lb_pcpu_stats __percpu *pcpu_stats;
 	struct lb_priv_ex *ex; /* priv extension */
 };
@@ -119,27 +131,37 @@ static void lb_tx_hash_to_port_mapping_null_port(struct team *team,
 /* Basic tx selection based solely by hash */
 static struct team_port *lb_hash_select_tx_port(struct team *team,
 						struct lb_priv *lb_priv,
-						struct sk_buff *skb,
+						struct team_port *leaving_port,
 						unsigned char hash)
 {
-	int port_index = team_num_to_port_index(team, hash);
+	int en_port_count = team->en_port_count;
+	int port_index;
 
-	return team_get_port_by_index_rcu(team, port_index);
+	if (leaving_port)
+		en_port_count--;
+	if (unlikely(en_port_count <= 0))
+		return NULL;
+	port_index = hash % en_port_count;
+	/* team_port_disable() shifts indexes above the leaving port down */
+	if (leaving_port && port_index >= leaving_port->index)
+		port_index++;
+	return team_get_port_by_index(team, port_index);
 }
 
 /* Hash to port mapping select tx port */
 static struct team_port *lb_htpm_select_tx_port(struct team *team,
 						struct lb_priv *lb_priv,
-						struct sk_buff *skb,
+						struct team_port *leaving_port,
 						unsigned char hash)
 {
 	struct team_port *port;
 
-	port = rcu_dereference_bh(LB_HTPM_PORT_BY_HASH(lb_priv, hash));
+	port = rcu_dereference_protected(LB_HTPM_PORT_BY_HASH(lb_priv, hash),
+					 lockdep_is_held(&team->lock));
 	if (likely(port))
 		return port;
 	/* If no valid port in the table, fall back to simple hash */
-	return lb_hash_select_tx_port(team, lb_priv, skb, hash);
+	return lb_hash_select_tx_port(team, lb_priv, leaving_port, hash);
 }
 
 struct lb_select_tx_port {
@@ -187,6 +209,44 @@ static lb_select_tx_port_func_t *lb_select_tx_port_get_func(const char *name)
 	return NULL;
 }
 
+/* Resolve every hash to its tx port with the current tx method.
+ * @leaving_port, if set, is about to be disabled and must not be used.
+ */
+static void lb_port_map_fill(struct team *team, struct lb_port_map *port_map,
+			     struct team_port *leaving_port)
+{
+	struct lb_priv *lb_priv = get_lb_priv(team);
+	lb_select_tx_port_func_t *func = lb_priv->ex->select_tx_port_func;
+	int i;
+
+	for (i = 0; i < LB_TX_HASHTABLE_SIZE; i++)
+		WRITE_ONCE(port_map->ports[i],
+			   func(team, lb_priv, leaving_port, i));
+}
+
+static void lb_port_map_rebuild(struct team *team,
+				struct team_port *leaving_port)
+{
+	struct lb_priv *lb_priv = get_lb_priv(team);
+	struct lb_port_map *port_map;
+	struct lb_port_map *old_port_map;
+
+	old_port_map = rcu_dereference_protected(lb_priv->port_map,
+						 lockdep_is_held(&team->lock));
+	port_map = kmalloc(sizeof(*port_map), GFP_KERNEL);
+	if (!port_map) {
+		/* Readers may then see a mix of old and new entries, which
+		 * is fine as each of them is a valid port until a grace
+		 * period passes.
+		 */
+		lb_port_map_fill(team, old_port_map, leaving_port);
+		return;
+	}
+	lb_port_map_fill(team, port_map, leaving_port);
+	rcu_assign_pointer(lb_priv->port_map, port_map);
+	kfree_rcu(old_port_map, rcu);
+}
+
 static unsigned int lb_get_skb_hash(struct lb_priv *lb_priv,
 				    struct sk_buff *skb)
 {
@@ -222,14 +282,14 @@ static void lb_update_tx_stats(unsigned int tx_bytes, struct lb_priv *lb_priv,
 static bool lb_transmit(struct team *team, struct sk_buff *skb)
 {
 	struct lb_priv *lb_priv = get_lb_priv(team);
-	lb_select_tx_port_func_t *select_tx_port_func;
+	struct lb_port_map *port_map;
 	struct team_port *port;
 	unsigned char hash;
 	unsigned int tx_bytes = skb->len;
 
 	hash = lb_get_skb_hash(lb_priv, skb);
-	select_tx_port_func = rcu_dereference_bh(lb_priv->select_tx_port_func);
-	port = select_tx_port_func(team, lb_priv, skb, hash);
+	port_map = rcu_dereference_bh(lb_priv->port_map);
+	port = READ_ONCE(port_map->ports[hash]);
 	if (unlikely(!port))
 		goto drop;
 	if (team_dev_queue_xmit(team, port, skb))
@@ -341,8 +401,7 @@ static int lb_tx_method_get(struct team *team, struct team_gsetter_ctx *ctx)
 	lb_select_tx_port_func_t *func;
 	char *name;
 
-	func = rcu_dereference_protected(lb_priv->select_tx_port_func,
-					 lockdep_is_held(&team->lock));
+	func = lb_priv->ex->select_tx_port_func;
 	name = lb_select_tx_port_get_name(func);
 	BUG_ON(!name);
 	ctx->data.str_val = name;
@@ -357,7 +416,8 @@ static int lb_tx_method_set(struct team *team, struct team_gsetter_ctx *ctx)
 	func = lb_select_tx_port_get_func(ctx->data.str_val);
 	if (!func)
 		return -EINVAL;
-	rcu_assign_pointer(lb_priv->select_tx_port_func, func);
+	lb_priv->ex->select_tx_port_func = func;
+	lb_port_map_rebuild(team, NULL);
 	return 0;
 }
 
@@ -395,6 +455,7 @@ static int lb_tx_hash_to_port_mapping_set(struct team *team,
 		    team_port_enabled(port)) {
 			rcu_assign_pointer(LB_HTPM_PORT_BY_HASH(lb_priv, hash),
 					   port);
+			lb_port_map_rebuild(team, NULL);
 			return 0;
 		}
 	}
@@ -604,18 +665,27 @@ static int lb_init(struct team *team)
 {
 	struct lb_priv *lb_priv = get_lb_priv(team);
 	lb_select_tx_port_func_t *func;
+	struct lb_port_map *port_map;
 	int i, err;
 
-	/* set default tx port selector */
-	func = lb_select_tx_port_get_func("hash");
-	BUG_ON(!func);
-	rcu_assign_pointer(lb_priv->select_tx_port_func, func);
-
 	lb_priv->ex = kzalloc(sizeof(*lb_priv->ex), GFP_KERNEL);
 	if (!lb_priv->ex)
 		return -ENOMEM;
 	lb_priv->ex->team = team;
 
+	/* set default tx port selector */
+	func = lb_select_tx_port_get_func("hash");
+	BUG_ON(!func);
+	lb_priv->ex->select_tx_port_func = func;
+
+	port_map = kmalloc(sizeof(*port_map), GFP_KERNEL);
+	if (!port_map) {
+		err = -ENOMEM;
+		goto err_alloc_port_map;
+	}
+	lb_port_map_fill(team, port_map, NULL);
+	RCU_INIT_POINTER(lb_priv->port_map, port_map);
+
 	lb_priv->pcpu_stats = alloc_percpu(struct lb_pcpu_stats);
 	if (!lb_priv->pcpu_stats) {
 		err = -ENOMEM;
@@ -639,6 +709,8 @@ static int lb_init(struct team *team)
 err_options_register:
 	free_percpu(lb_priv->pcpu_stats);
 err_alloc_pcpu_stats:
+	kfree(port_map);
+err_alloc_port_map:
 	kfree(lb_priv->ex);
 	return err;
 }
@@ -646,12 +718,16 @@ static int lb_init(struct team *team)
 static void lb_exit(struct team *team)
 {
 	struct lb_priv *lb_priv = get_lb_priv(team);
+	struct lb_port_map *port_map;
 
 	team_options_unregister(team, lb_options,
 				ARRAY_SIZE(lb_options));
 	lb_bpf_func_free(team);
 	cancel_delayed_work_sync(&lb_priv->ex->stats.refresh_dw);
 	free_percpu(lb_priv->pcpu_stats);
+	port_map = rcu_dereference_protected(lb_priv->port_map,
+					     lockdep_is_held(&team->lock));
+	kfree_rcu(port_map, rcu);
 	kfree(lb_priv->ex);
 }
 
@@ -672,9 +748,15 @@ static void lb_port_leave(struct team *team, struct team_port *port)
 	free_percpu(lb_port_priv->pcpu_stats);
 }
 
+static void lb_port_enabled(struct team *team, struct team_port *port)
+{
+	lb_port_map_rebuild(team, NULL);
+}
+
 static void lb_port_disabled(struct team *team, struct team_port *port)
 {
 	lb_tx_hash_to_port_mapping_null_port(team, port);
+	lb_port_map_rebuild(team, port);
 }
 
 static const struct team_mode_ops lb_mode_ops = {
@@ -682,6 +764,7 @@ static const struct team_mode_ops lb_mode_ops = {
 	.exit			= lb_exit,
 	.port_enter		= lb_port_enter,
 	.port_leave		= lb_port_leave,
+	.port_enabled		= lb_port_enabled,
 	.port_disabled		= lb_port_disabled,
 	.receive		= lb_receive,
 	.transmit		= lb_transmit,
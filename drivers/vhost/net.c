@@ -104,6 +104,17 @@ struct vhost_net_buf {
 	int head;
 };
 
+/* Descriptors reserved for one packet of an RX batch */
+struct vhost_net_rx_desc {
+	/* number of heads, stored in vq->heads */
+	int headcount;
+	/* first iovec in vq->iov and number of iovecs */
+	unsigned int iov;
+	unsigned int in;
+	/* total length including headers */
+	size_t len;
+};
+
 struct vhost_net_virtqueue {
 	struct vhost_virtqueue vq;
 	size_t vhost_hlen;
@@ -126,6 +137,8 @@ struct vhost_net_virtqueue {
 	struct vhost_net_buf rxq;
 	/* Batched XDP buffs */
 	struct xdp_buff *xdp;
+	/* Descriptors reserved for a batch of RX packets */
+	struct vhost_net_rx_desc *rx_descs;
 };
 
 struct vhost_net {
@@ -542,7 +555,7 @@ static void vhost_net_busy_poll(struct vhost_net *net,
 	endtime = busy_clock() + busyloop_timeout;
 
 	while (vhost_can_busy_poll(endtime)) {
-		if (vhost_has_work(&net->dev)) {
+		if (vhost_vq_has_work(poll_rx ? rvq : tvq)) {
 			*busyloop_intr = true;
 			break;
 		}
@@ -1028,7 +1041,10 @@ static int vhost_net_rx_peek_head_len(struct vhost_net *net, struct sock *sk,
 /* This is a multi-buffer version of vhost_get_desc, that works if
  *	vq has read descriptors only.
  * @vq		- the relevant virtqueue
+ * @heads	- returned buffer heads
  * @datalen	- data length we'll be reading
+ * @iov		- io vectors to fill
+ * @iov_size	- number of io vectors available in @iov
  * @iovcount	- returned count of io vectors we fill
  * @log		- vhost log
  * @log_num	- log offset
@@ -1038,6 +1054,8 @@ static int vhost_net_rx_peek_head_len(struct vhost_net *net, struct sock *sk,
 static int get_rx_bufs(struct vhost_virtqueue *vq,
 		       struct vring_used_elem *heads,
 		       int datalen,
+		       struct iovec *iov,
+		       unsigned int iov_size,
 		       unsigned *iovcount,
 		       struct vhost_log *log,
 		       unsigned *log_num,
@@ -1054,12 +1072,11 @@ static int get_rx_bufs(struct vhost_virtqueue *vq,
 	u32 len;
 
 	while (datalen > 0 && headcount < quota) {
-		if (unlikely(seg >= UIO_MAXIOV)) {
+		if (unlikely(seg >= iov_size)) {
 			r = -ENOBUFS;
 			goto err;
 		}
-		r = vhost_get_vq_desc(vq, vq->iov + seg,
-				      ARRAY_SIZE(vq->iov) - seg, &out,
+		r = vhost_get_vq_desc(vq, iov + seg, iov_size - seg, &out,
 				      &in, log, log_num);
 		if (unlikely(r < 0))
 			goto err;
@@ -1080,7 +1097,7 @@ static int get_rx_bufs(struct vhost_virtqueue *vq,
 			log += *log_num;
 		}
 		heads[headcount].id = cpu_to_vhost32(vq, d);
-		len = iov_length(vq->iov + seg, in);
+		len = iov_length(iov + seg, in);
 		heads[headcount].len = cpu_to_vhost32(vq, len);
 		datalen -= len;
 		++headcount;
@@ -1102,6 +1119,143 @@ static int get_rx_bufs(struct vhost_virtqueue *vq,
 	return r;
 }
 
+/* Fill in the parts of the virtio net header that don't come from the
+ * socket: the whole header if VHOST_NET_F_VIRTIO_NET_HDR, num_buffers
+ * if VIRTIO_NET_F_MRG_RXBUF.
+ */
+static int vhost_net_rx_fixup(struct vhost_virtqueue *vq,
+			      struct iov_iter *fixup, size_t vhost_hlen,
+			      int mergeable, s16 headcount)
+{
+	struct virtio_net_hdr hdr = {
+		.flags = 0,
+		.gso_type = VIRTIO_NET_HDR_GSO_NONE
+	};
+	__virtio16 num_buffers;
+
+	if (unlikely(vhost_hlen)) {
+		if (copy_to_iter(&hdr, sizeof(hdr),
+				 fixup) != sizeof(hdr)) {
+			vq_err(vq, "Unable to write vnet_hdr "
+			       "at addr %p\n", vq->iov->iov_base);
+			return -EFAULT;
+		}
+	} else {
+		/* Header came from socket; we'll need to patch
+		 * ->num_buffers over if VIRTIO_NET_F_MRG_RXBUF
+		 */
+		iov_iter_advance(fixup, sizeof(hdr));
+	}
+	/* TODO: Should check and handle checksum. */
+
+	num_buffers = cpu_to_vhost16(vq, headcount);
+	if (likely(mergeable) &&
+	    copy_to_iter(&num_buffers, sizeof num_buffers,
+			 fixup) != sizeof num_buffers) {
+		vq_err(vq, "Failed num_buffers write");
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/* Receive the packets batched from the rx ring in two passes: first
+ * reserve descriptors for as many of them as the guest has buffers for,
+ * then copy them. Used heads are accumulated in done_idx as usual, so
+ * they are published and signalled once per batch.
+ *
+ * Returns the number of packets consumed, 0 if the packet at the head
+ * of the batch has to go through the one-by-one path of handle_rx()
+ * (no buffers, overrun, errors), or a negative error if handle_rx()
+ * should stop until the next kick.
+ */
+static int vhost_net_rx_batch(struct vhost_net *net, struct socket *sock,
+			      int mergeable, size_t *total_len)
+{
+	struct vhost_net_virtqueue *nvq = &net->vqs[VHOST_NET_VQ_RX];
+	struct vhost_virtqueue *vq = &nvq->vq;
+	struct vhost_net_buf *rxq = &nvq->rxq;
+	struct vring_used_elem *heads = vq->heads + nvq->done_idx;
+	struct msghdr msg = {
+		.msg_flags = MSG_DONTWAIT,
+	};
+	struct vhost_net_rx_desc *desc;
+	struct iov_iter fixup;
+	unsigned int seg = 0;
+	int nheads = 0;
+	int i, j, n, headcount, err;
+	size_t sock_len;
+
+	for (n = 0; n < vhost_net_buf_get_size(rxq); n++) {
+		/* heads already holds the done_idx used heads of earlier
+		 * packets, keep the batch within UIO_MAXIOV of them.
+		 */
+		int quota = likely(mergeable) ?
+			    UIO_MAXIOV - nvq->done_idx - nheads : 1;
+		size_t len;
+
+		if (quota <= 0 || seg >= UIO_MAXIOV)
+			break;
+
+		len = vhost_net_buf_peek_len(rxq->queue[rxq->head + n]) +
+		      nvq->sock_hlen + nvq->vhost_hlen;
+		desc = &nvq->rx_descs[n];
+		headcount = get_rx_bufs(vq, heads + nheads, len,
+					vq->iov + seg, UIO_MAXIOV - seg,
+					&desc->in, NULL, NULL, quota);
+		/* Descriptors were given back on failure */
+		if (headcount <= 0 || headcount > UIO_MAXIOV)
+			break;
+
+		desc->headcount = headcount;
+		desc->iov = seg;
+		desc->len = len;
+		seg += desc->in;
+		nheads += headcount;
+	}
+
+	for (i = 0; i < n; i++) {
+		desc = &nvq->rx_descs[i];
+		sock_len = desc->len - nvq->vhost_hlen;
+
+		msg.msg_control = vhost_net_buf_consume(rxq);
+		iov_iter_init(&msg.msg_iter, READ, vq->iov + desc->iov,
+			      desc->in, desc->len);
+		fixup = msg.msg_iter;
+		if (unlikely(nvq->vhost_hlen))
+			iov_iter_advance(&msg.msg_iter, nvq->vhost_hlen);
+		err = sock->ops->recvmsg(sock, &msg, sock_len,
+					 MSG_DONTWAIT | MSG_TRUNC);
+		if (unlikely(err != sock_len)) {
+			pr_debug("Discarded rx packet: "
+				 " len %d, expected %zd\n", err, sock_len);
+			err = 0;
+			goto discard;
+		}
+		err = vhost_net_rx_fixup(vq, &fixup, nvq->vhost_hlen,
+					 mergeable, desc->headcount);
+		if (unlikely(err))
+			goto discard;
+
+		nvq->done_idx += desc->headcount;
+		*total_len += desc->len;
+	}
+
+	if (nvq->done_idx > VHOST_NET_BATCH)
+		vhost_net_signal_used(nvq);
+	return n;
+
+discard:
+	/* Descriptors are reserved in order, so give back the ones of
+	 * this packet and of all the packets after it.
+	 */
+	for (headcount = 0, j = i; j < n; j++)
+		headcount += nvq->rx_descs[j].headcount;
+	vhost_discard_vq_desc(vq, headcount);
+	if (nvq->done_idx > VHOST_NET_BATCH)
+		vhost_net_signal_used(nvq);
+	return err ? err : i + 1;
+}
+
 /* Expects to be always run from workqueue - which acts as
  * read-size critical section for our kind of RCU. */
 static void handle_rx(struct vhost_net *net)
@@ -1117,10 +1271,6 @@ static void handle_rx(struct vhost_net *net)
 		.msg_controllen = 0,
 		.msg_flags = MSG_DONTWAIT,
 	};
-	struct virtio_net_hdr hdr = {
-		.flags = 0,
-		.gso_type = VIRTIO_NET_HDR_GSO_NONE
-	};
 	size_t total_len = 0;
 	int err, mergeable;
 	s16 headcount;
@@ -1129,7 +1279,6 @@ static void handle_rx(struct vhost_net *net)
 	bool busyloop_intr = false;
 	struct socket *sock;
 	struct iov_iter fixup;
-	__virtio16 num_buffers;
 	int recv_pkts = 0;
 
 	mutex_lock_nested(&vq->mutex, VHOST_NET_VQ_RX);
@@ -1155,10 +1304,23 @@ static void handle_rx(struct vhost_net *net)
 						      &busyloop_intr);
 		if (!sock_len)
 			break;
+		if (nvq->rx_ring && !vq_log) {
+			err = vhost_net_rx_batch(net, sock, mergeable,
+						 &total_len);
+			if (unlikely(err < 0))
+				goto out;
+			if (err > 0) {
+				busyloop_intr = false;
+				/* the loop condition accounts for one */
+				recv_pkts += err - 1;
+				continue;
+			}
+		}
 		sock_len += sock_hlen;
 		vhost_len = sock_len + vhost_hlen;
 		headcount = get_rx_bufs(vq, vq->heads + nvq->done_idx,
-					vhost_len, &in, vq_log, &log,
+					vhost_len, vq->iov, ARRAY_SIZE(vq->iov),
+					&in, vq_log, &log,
 					likely(mergeable) ? UIO_MAXIOV : 1);
 		/* On error, stop handling until the next kick. */
 		if (unlikely(headcount < 0))
@@ -1208,27 +1370,10 @@ static void handle_rx(struct vhost_net *net)
 			vhost_discard_vq_desc(vq, headcount);
 			continue;
 		}
-		/* Supply virtio_net_hdr if VHOST_NET_F_VIRTIO_NET_HDR */
-		if (unlikely(vhost_hlen)) {
-			if (copy_to_iter(&hdr, sizeof(hdr),
-					 &fixup) != sizeof(hdr)) {
-				vq_err(vq, "Unable to write vnet_hdr "
-				       "at addr %p\n", vq->iov->iov_base);
-				goto out;
-			}
-		} else {
-			/* Header came from socket; we'll need to patch
-			 * ->num_buffers over if VIRTIO_NET_F_MRG_RXBUF
-			 */
-			iov_iter_advance(&fixup, sizeof(hdr));
-		}
-		/* TODO: Should check and handle checksum. */
-
-		num_buffers = cpu_to_vhost16(vq, headcount);
-		if (likely(mergeable) &&
-		    copy_to_iter(&num_buffers, sizeof num_buffers,
-				 &fixup) != sizeof num_buffers) {
-			vq_err(vq, "Failed num_buffers write");
+		/* Supply virtio_net_hdr if VHOST_NET_F_VIRTIO_NET_HDR,
+		 * patch num_buffers if VIRTIO_NET_F_MRG_RXBUF */
+		if (unlikely(vhost_net_rx_fixup(vq, &fixup, vhost_hlen,
+						mergeable, headcount))) {
 			vhost_discard_vq_desc(vq, headcount);
 			goto out;
 		}
@@ -1289,6 +1434,7 @@ static int vhost_net_open(struct inode *inode, struct file *f)
 	struct vhost_virtqueue **vqs;
 	void **queue;
 	struct xdp_buff *xdp;
+	struct vhost_net_rx_desc *rx_descs;
 	int i;
 
 	n = kvmalloc(sizeof *n, GFP_KERNEL | __GFP_RETRY_MAYFAIL);
@@ -1318,6 +1464,17 @@ static int vhost_net_open(struct inode *inode, struct file *f)
 	}
 	n->vqs[VHOST_NET_VQ_TX].xdp = xdp;
 
+	rx_descs = kmalloc_array(VHOST_NET_BATCH, sizeof(*rx_descs),
+				 GFP_KERNEL);
+	if (!rx_descs) {
+		kfree(vqs);
+		kvfree(n);
+		kfree(queue);
+		kfree(xdp);
+		return -ENOMEM;
+	}
+	n->vqs[VHOST_NET_VQ_RX].rx_descs = rx_descs;
+
 	dev = &n->dev;
 	vqs[VHOST_NET_VQ_TX] = &n->vqs[VHOST_NET_VQ_TX].vq;
 	vqs[VHOST_NET_VQ_RX] = &n->vqs[VHOST_NET_VQ_RX].vq;
@@ -1339,8 +1496,10 @@ static int vhost_net_open(struct inode *inode, struct file *f)
 		       VHOST_NET_PKT_WEIGHT, VHOST_NET_WEIGHT, true,
 		       NULL);
 
-	vhost_poll_init(n->poll + VHOST_NET_VQ_TX, handle_tx_net, EPOLLOUT, dev);
-	vhost_poll_init(n->poll + VHOST_NET_VQ_RX, handle_rx_net, EPOLLIN, dev);
+	vhost_poll_init(n->poll + VHOST_NET_VQ_TX, handle_tx_net, EPOLLOUT, dev,
+			vqs[VHOST_NET_VQ_TX]);
+	vhost_poll_init(n->poll + VHOST_NET_VQ_RX, handle_rx_net, EPOLLIN, dev,
+			vqs[VHOST_NET_VQ_RX]);
 
 	f->private_data = n;
 	n->page_frag.page = NULL;
@@ -1418,6 +1577,7 @@ static int vhost_net_release(struct inode *inode, struct file *f)
 	vhost_net_flush(n);
 	kfree(n->vqs[VHOST_NET_VQ_RX].rxq.queue);
 	kfree(n->vqs[VHOST_NET_VQ_TX].xdp);
+	kfree(n->vqs[VHOST_NET_VQ_RX].rx_descs);
 	kfree(n->dev.vqs);
 	if (n->page_frag.page)
 		__page_frag_cache_drain(n->page_frag.page, n->refcnt_bias);
@@ -68,6 +68,7 @@
 struct vring_desc_state_split {
 	void *data;			/* Data for callback. */
 	struct vring_desc *indir_desc;	/* Indirect descriptor, if any. */
+	u32 total_len;			/* Device-writable buffer length. */
 };
 
 struct vring_desc_state_packed {
@@ -76,6 +77,7 @@ struct vring_desc_state_packed {
 	u16 num;			/* Descriptor list length. */
 	u16 next;			/* The next desc state in a list. */
 	u16 last;			/* The last desc state in a list. */
+	u32 total_len;			/* Device-writable buffer length. */
 };
 
 struct vring_desc_extra_packed {
@@ -105,6 +107,9 @@ struct vring_virtqueue {
 	/* Host publishes avail event idx */
 	bool event;
 
+	/* Host uses buffers in the order they were made available */
+	bool in_order;
+
 	/* Head of free buffer list. */
 	unsigned int free_head;
 	/* Number we've added since last sync. */
@@ -128,6 +133,14 @@ struct vring_virtqueue {
 			 */
 			u16 avail_idx_shadow;
 
+			/*
+			 * In order: the last used entry read, naming the last
+			 * buffer of its batch, or UINT_MAX as id if none is
+			 * pending.
+			 */
+			u32 batch_last_id;
+			u32 batch_last_len;
+
 			/* Per-descriptor state. */
 			struct vring_desc_state_split *desc_state;
 
@@ -155,6 +168,15 @@ struct vring_virtqueue {
 			/* Avail used flags. */
 			u16 avail_used_flags;
 
+			/*
+			 * Descriptors reclaimed so far from an in-order
+			 * batch whose used element has not been consumed.
+			 */
+			u16 batch_skipped;
+
+			/* In order, id of the next buffer to be used. */
+			u16 next_inorder_id;
+
 			/* Index of the next avail descriptor. */
 			u16 next_avail_idx;
 
@@ -425,6 +447,7 @@ static inline int virtqueue_add_split(struct virtqueue *_vq,
 	struct scatterlist *sg;
 	struct vring_desc *desc;
 	unsigned int i, n, avail, descs_used, prev, err_idx;
+	u32 total_len = 0;
 	int head;
 	bool indirect;
 
@@ -500,6 +523,7 @@ static inline int virtqueue_add_split(struct virtqueue *_vq,
 			desc[i].flags = cpu_to_virtio16(_vq->vdev, VRING_DESC_F_NEXT | VRING_DESC_F_WRITE);
 			desc[i].addr = cpu_to_virtio64(_vq->vdev, addr);
 			desc[i].len = cpu_to_virtio32(_vq->vdev, sg->length);
+			total_len += sg->length;
 			prev = i;
 			i = virtio16_to_cpu(_vq->vdev, desc[i].next);
 		}
@@ -536,6 +560,7 @@ static inline int virtqueue_add_split(struct virtqueue *_vq,
 
 	/* Store token and indirect buffer state. */
 	vq->split.desc_state[head].data = data;
+	vq->split.desc_state[head].total_len = total_len;
 	if (indirect)
 		vq->split.desc_state[head].indir_desc = desc;
 	else
@@ -636,9 +661,16 @@ static void detach_buf_split(struct vring_virtqueue *vq, unsigned int head,
 	}
 
 	vring_unmap_one_split(vq, &vq->split.vring.desc[i]);
-	vq->split.vring.desc[i].next = cpu_to_virtio16(vq->vq.vdev,
-						vq->free_head);
-	vq->free_head = head;
+
+	/*
+	 * In order, buffers come back in the order they were added, so
+	 * the free list stays the circular sequence set up at creation.
+	 */
+	if (!vq->in_order) {
+		vq->split.vring.desc[i].next = cpu_to_virtio16(vq->vq.vdev,
+							vq->free_head);
+		vq->free_head = head;
+	}
 
 	/* Plus final descriptor */
 	vq->vq.num_free++;
@@ -700,11 +732,39 @@ static void *virtqueue_get_buf_ctx_split(struct virtqueue *_vq,
 	/* Only get used array entries after they have been exposed by host. */
 	virtio_rmb(vq->weak_barriers);
 
-	last_used = (vq->last_used_idx & (vq->split.vring.num - 1));
-	i = virtio32_to_cpu(_vq->vdev,
-			vq->split.vring.used->ring[last_used].id);
-	*len = virtio32_to_cpu(_vq->vdev,
-			vq->split.vring.used->ring[last_used].len);
+	if (vq->in_order) {
+		/*
+		 * The device may use a batch of buffers with a single used
+		 * entry at the batch's first used index, naming its last
+		 * buffer. Read the entry at last_used_idx when no batch is
+		 * pending and hand back the buffers up to the one it names
+		 * in ring order. Buffers before it were fully written; a
+		 * device that writes every entry gives batches of one.
+		 */
+		if (vq->split.batch_last_id == UINT_MAX) {
+			last_used = vq->last_used_idx &
+				    (vq->split.vring.num - 1);
+			vq->split.batch_last_id = virtio32_to_cpu(_vq->vdev,
+				vq->split.vring.used->ring[last_used].id);
+			vq->split.batch_last_len = virtio32_to_cpu(_vq->vdev,
+				vq->split.vring.used->ring[last_used].len);
+		}
+
+		i = (vq->free_head + vq->vq.num_free) &
+		    (vq->split.vring.num - 1);
+		if (i == vq->split.batch_last_id) {
+			vq->split.batch_last_id = UINT_MAX;
+			*len = vq->split.batch_last_len;
+		} else {
+			*len = vq->split.desc_state[i].total_len;
+		}
+	} else {
+		last_used = (vq->last_used_idx & (vq->split.vring.num - 1));
+		i = virtio32_to_cpu(_vq->vdev,
+				vq->split.vring.used->ring[last_used].id);
+		*len = virtio32_to_cpu(_vq->vdev,
+				vq->split.vring.used->ring[last_used].len);
+	}
 
 	if (unlikely(i >= vq->split.vring.num)) {
 		BAD_RING(vq, "id %u out of range\n", i);
@@ -987,6 +1047,7 @@ static int virtqueue_add_indirect_packed(struct vring_virtqueue *vq,
 	struct vring_packed_desc *desc;
 	struct scatterlist *sg;
 	unsigned int i, n, err_idx;
+	u32 total_len = 0;
 	u16 head, id;
 	dma_addr_t addr;
 
@@ -1015,6 +1076,8 @@ static int virtqueue_add_indirect_packed(struct vring_virtqueue *vq,
 						0 : VRING_DESC_F_WRITE);
 			desc[i].addr = cpu_to_le64(addr);
 			desc[i].len = cpu_to_le32(sg->length);
+			if (n >= out_sgs)
+				total_len += sg->length;
 			i++;
 		}
 	}
@@ -1068,6 +1131,7 @@ static int virtqueue_add_indirect_packed(struct vring_virtqueue *vq,
 	vq->packed.desc_state[id].data = data;
 	vq->packed.desc_state[id].indir_desc = desc;
 	vq->packed.desc_state[id].last = id;
+	vq->packed.desc_state[id].total_len = total_len;
 
 	vq->num_added += 1;
 
@@ -1101,6 +1165,7 @@ static inline int virtqueue_add_packed(struct virtqueue *_vq,
 	struct vring_packed_desc *desc;
 	struct scatterlist *sg;
 	unsigned int i, n, c, descs_used, err_idx;
+	u32 total_len = 0;
 	__le16 head_flags, flags;
 	u16 head, id, prev, curr, avail_used_flags;
 
@@ -1161,6 +1226,8 @@ static inline int virtqueue_add_packed(struct virtqueue *_vq,
 			desc[i].addr = cpu_to_le64(addr);
 			desc[i].len = cpu_to_le32(sg->length);
 			desc[i].id = cpu_to_le16(id);
+			if (n >= out_sgs)
+				total_len += sg->length;
 
 			if (unlikely(vq->use_dma_api)) {
 				vq->packed.desc_extra[curr].addr = addr;
@@ -1195,6 +1262,7 @@ static inline int virtqueue_add_packed(struct virtqueue *_vq,
 	vq->packed.desc_state[id].data = data;
 	vq->packed.desc_state[id].indir_desc = ctx;
 	vq->packed.desc_state[id].last = prev;
+	vq->packed.desc_state[id].total_len = total_len;
 
 	/*
 	 * A driver MUST NOT make the first descriptor in the list
@@ -1290,8 +1358,18 @@ static void detach_buf_packed(struct vring_virtqueue *vq,
 	/* Clear data ptr. */
 	state->data = NULL;
 
-	vq->packed.desc_state[state->last].next = vq->free_head;
-	vq->free_head = id;
+	/*
+	 * In order, ids come back in the order they were handed out, so
+	 * the free list stays the circular sequence set up at creation,
+	 * and the next buffer to come back starts after this one's ids.
+	 */
+	if (!vq->in_order) {
+		vq->packed.desc_state[state->last].next = vq->free_head;
+		vq->free_head = id;
+	} else {
+		vq->packed.next_inorder_id =
+			vq->packed.desc_state[state->last].next;
+	}
 	vq->vq.num_free += state->num;
 
 	if (unlikely(vq->use_dma_api)) {
@@ -1348,7 +1426,7 @@ static void *virtqueue_get_buf_ctx_packed(struct virtqueue *_vq,
 					  void **ctx)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
-	u16 last_used, id;
+	u16 last_used, id, head;
 	void *ret;
 
 	START_USE(vq);
@@ -1380,11 +1458,46 @@ static void *virtqueue_get_buf_ctx_packed(struct virtqueue *_vq,
 		return NULL;
 	}
 
+	if (vq->in_order) {
+		/*
+		 * The device may use a batch of buffers with a single used
+		 * element naming the last one, and then skips the ring
+		 * forward past the whole batch. Hand back the older buffers
+		 * first, counting their descriptors so we know where the
+		 * next used element will be written.
+		 */
+		head = vq->packed.next_inorder_id;
+		if (head != id) {
+			if (unlikely(!vq->packed.desc_state[head].data)) {
+				BAD_RING(vq, "id %u is not a head!\n", head);
+				return NULL;
+			}
+			*len = vq->packed.desc_state[head].total_len;
+			ret = vq->packed.desc_state[head].data;
+			vq->packed.batch_skipped +=
+				vq->packed.desc_state[head].num;
+			detach_buf_packed(vq, head, ctx);
+			/*
+			 * The used element of the batch is in the first
+			 * descriptor of its first buffer. Keep the batch's
+			 * descriptors off the free count until it is all
+			 * reclaimed, so that adding a buffer can't overwrite
+			 * the element before we are done with it.
+			 */
+			vq->vq.num_free -= vq->packed.desc_state[head].num;
+			END_USE(vq);
+			return ret;
+		}
+	}
+
 	/* detach_buf_packed clears data, so grab it now. */
 	ret = vq->packed.desc_state[id].data;
 	detach_buf_packed(vq, id, ctx);
 
-	vq->last_used_idx += vq->packed.desc_state[id].num;
+	vq->last_used_idx += vq->packed.desc_state[id].num +
+			     vq->packed.batch_skipped;
+	vq->vq.num_free += vq->packed.batch_skipped;
+	vq->packed.batch_skipped = 0;
 	if (unlikely(vq->last_used_idx >= vq->packed.vring.num)) {
 		vq->last_used_idx -= vq->packed.vring.num;
 		vq->packed.used_wrap_counter ^= 1;
@@ -1616,6 +1729,7 @@ static struct virtqueue *vring_create_virtqueue_packed(
 	vq->indirect = virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC) &&
 		!context;
 	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
+	vq->in_order = virtio_has_feature(vdev, VIRTIO_F_IN_ORDER);
 
 	if (virtio_has_feature(vdev, VIRTIO_F_ORDER_PLATFORM))
 		vq->weak_barriers = false;
@@ -1637,6 +1751,8 @@ static struct virtqueue *vring_create_virtqueue_packed(
 	vq->packed.used_wrap_counter = 1;
 	vq->packed.event_flags_shadow = 0;
 	vq->packed.avail_used_flags = 1 << VRING_PACKED_DESC_F_AVAIL;
+	vq->packed.batch_skipped = 0;
+	vq->packed.next_inorder_id = 0;
 
 	vq->packed.desc_state = kmalloc_array(num,
 			sizeof(struct vring_desc_state_packed),
@@ -1651,6 +1767,9 @@ static struct virtqueue *vring_create_virtqueue_packed(
 	vq->free_head = 0;
 	for (i = 0; i < num-1; i++)
 		vq->packed.desc_state[i].next = i + 1;
+	/* In order, ids are handed out in ring order, wrapping. */
+	if (vq->in_order)
+		vq->packed.desc_state[i].next = 0;
 
 	vq->packed.desc_extra = kmalloc_array(num,
 			sizeof(struct vring_desc_extra_packed),
@@ -2095,6 +2214,7 @@ struct virtqueue *__vring_new_virtqueue(unsigned int index,
 	vq->indirect = virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC) &&
 		!context;
 	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
+	vq->in_order = virtio_has_feature(vdev, VIRTIO_F_IN_ORDER);
 
 	if (virtio_has_feature(vdev, VIRTIO_F_ORDER_PLATFORM))
 		vq->weak_barriers = false;
@@ -2105,6 +2225,7 @@ struct virtqueue *__vring_new_virtqueue(unsigned int index,
 	vq->split.vring = vring;
 	vq->split.avail_flags_shadow = 0;
 	vq->split.avail_idx_shadow = 0;
+	vq->split.batch_last_id = UINT_MAX;
 
 	/* No callback?  Tell other side not to bother us. */
 	if (!callback) {
@@ -2125,6 +2246,9 @@ struct virtqueue *__vring_new_virtqueue(unsigned int index,
 	vq->free_head = 0;
 	for (i = 0; i < vring.num-1; i++)
 		vq->split.vring.desc[i].next = cpu_to_virtio16(vdev, i + 1);
+	/* In order, descriptors are handed out in ring order, wrapping. */
+	if (vq->in_order)
+		vq->split.vring.desc[i].next = cpu_to_virtio16(vdev, 0);
 	memset(vq->split.desc_state, 0, vring.num *
 			sizeof(struct vring_desc_state_split));
 
@@ -2238,6 +2362,8 @@ void vring_transport_features(struct virtio_device *vdev)
 			break;
 		case VIRTIO_F_RING_PACKED:
 			break;
+		case VIRTIO_F_IN_ORDER:
+			break;
 		case VIRTIO_F_ORDER_PLATFORM:
 			break;
 		default:
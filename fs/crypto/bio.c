@@ -24,13 +24,231 @@
 #include <linux/module.h>
 #include <linux/bio.h>
 #include <linux/namei.h>
+#include <linux/scatterlist.h>
+#include <crypto/skcipher.h>
 #include "fscrypt_private.h"
 
+/* Maximum number of data units of a bio being decrypted at once */
+#define FSCRYPT_BIO_MAX_INFLIGHT	16
+
+struct fscrypt_bio_ctx;
+
+/* One slot of a bio decryption, reused for the bio's data units in turn */
+struct fscrypt_bio_unit {
+	struct fscrypt_bio_ctx *ctx;
+	struct page *page;
+	unsigned int offs;
+	u64 lblk_num;
+	union fscrypt_iv iv;
+	struct scatterlist sg;
+	struct skcipher_request *req;
+};
+
+/*
+ * State of the decryption of a bio: the position of the next data unit to
+ * decrypt, and the slots (struct fscrypt_bio_unit, each followed by its
+ * skcipher request) that the data units are decrypted in.  The slots are
+ * CRYPTO_MINALIGN aligned, as the request contexts must be.
+ */
+struct fscrypt_bio_ctx {
+	struct bio *bio;
+	const struct inode *inode;
+	struct completion wait;
+	atomic_t inflight;
+	spinlock_t lock;
+	struct bvec_iter_all iter;
+	unsigned int pos;
+	unsigned int nr_units;
+	unsigned int unit_size;
+	u8 units[] CRYPTO_MINALIGN_ATTR;
+};
+
+static inline struct fscrypt_bio_unit *
+fscrypt_bio_unit(struct fscrypt_bio_ctx *ctx, unsigned int i)
+{
+	return (struct fscrypt_bio_unit *)(ctx->units + i * ctx->unit_size);
+}
+
+static struct fscrypt_bio_ctx *fscrypt_alloc_bio_ctx(struct bio *bio,
+						     gfp_t gfp_flags)
+{
+	const struct inode *inode = bio_first_page_all(bio)->mapping->host;
+	struct crypto_skcipher *tfm = inode->i_crypt_info->ci_enc_key.tfm;
+	const unsigned int req_offs = ALIGN(sizeof(struct fscrypt_bio_unit),
+					    CRYPTO_MINALIGN);
+	struct fscrypt_bio_ctx *ctx;
+	struct bio_vec *bv;
+	struct bvec_iter_all iter_all;
+	unsigned int nr_units = 0;
+	unsigned int unit_size;
+	unsigned int i;
+
+	bio_for_each_segment_all(bv, bio, iter_all) {
+		nr_units += bv->bv_len >> inode->i_blkbits;
+		if (nr_units >= FSCRYPT_BIO_MAX_INFLIGHT)
+			break;
+	}
+	nr_units = clamp_t(unsigned int, nr_units, 1,
+			   FSCRYPT_BIO_MAX_INFLIGHT);
+
+	unit_size = ALIGN(req_offs + sizeof(struct skcipher_request) +
+			  crypto_skcipher_reqsize(tfm), CRYPTO_MINALIGN);
+	ctx = kzalloc(struct_size(ctx, units, nr_units * unit_size),
+		      gfp_flags);
+	if (!ctx)
+		return NULL;
+
+	ctx->bio = bio;
+	ctx->inode = inode;
+	init_completion(&ctx->wait);
+	spin_lock_init(&ctx->lock);
+	bvec_init_iter_all(&ctx->iter);
+	ctx->nr_units = nr_units;
+	ctx->unit_size = unit_size;
+	for (i = 0; i < nr_units; i++) {
+		struct fscrypt_bio_unit *unit = fscrypt_bio_unit(ctx, i);
+
+		unit->ctx = ctx;
+		unit->req = (struct skcipher_request *)((u8 *)unit + req_offs);
+		skcipher_request_set_tfm(unit->req, tfm);
+		sg_init_table(&unit->sg, 1);
+	}
+	return ctx;
+}
+
+/* Take the next data unit of the bio for @unit; false if there are none */
+static bool fscrypt_bio_next_unit(struct fscrypt_bio_ctx *ctx,
+				  struct fscrypt_bio_unit *unit)
+{
+	const unsigned int blockbits = ctx->inode->i_blkbits;
+	const unsigned int blocksize = 1 << blockbits;
+	struct bio_vec *bv = &ctx->iter.bv;
+	unsigned long flags;
+	bool found = false;
+
+	spin_lock_irqsave(&ctx->lock, flags);
+	while (ctx->pos >= bv->bv_len) {
+		if (!bio_next_segment(ctx->bio, &ctx->iter))
+			goto out;
+		ctx->pos = 0;
+		if (WARN_ON_ONCE(!IS_ALIGNED(bv->bv_len | bv->bv_offset,
+					     blocksize))) {
+			SetPageError(bv->bv_page);
+			ctx->pos = bv->bv_len;
+		}
+	}
+	unit->page = bv->bv_page;
+	unit->offs = bv->bv_offset + ctx->pos;
+	ctx->pos += blocksize;
+	found = true;
+out:
+	spin_unlock_irqrestore(&ctx->lock, flags);
+	return found;
+}
+
+/*
+ * Decrypt data units of the bio in @unit until it runs out of them or a
+ * request goes asynchronous.  @res is the result of the unit's last request.
+ */
+static void fscrypt_bio_unit_run(struct fscrypt_bio_unit *unit, int res)
+{
+	struct fscrypt_bio_ctx *ctx = unit->ctx;
+	const struct inode *inode = ctx->inode;
+	const unsigned int blockbits = inode->i_blkbits;
+
+	for (;;) {
+		if (res) {
+			fscrypt_err(inode, "Decryption failed for block %llu: %d",
+				    unit->lblk_num, res);
+			SetPageError(unit->page);
+		}
+
+		if (!fscrypt_bio_next_unit(ctx, unit))
+			break;
+
+		unit->lblk_num = ((u64)unit->page->index <<
+				  (PAGE_SHIFT - blockbits)) +
+				 (unit->offs >> blockbits);
+		fscrypt_generate_iv(&unit->iv, unit->lblk_num,
+				    inode->i_crypt_info);
+		sg_set_page(&unit->sg, unit->page, 1 << blockbits, unit->offs);
+		skcipher_request_set_crypt(unit->req, &unit->sg, &unit->sg,
+					   1 << blockbits, &unit->iv);
+		res = crypto_skcipher_decrypt(unit->req);
+		if (res == -EINPROGRESS || res == -EBUSY)
+			return;
+	}
+
+	if (atomic_dec_and_test(&ctx->inflight))
+		complete(&ctx->wait);
+}
+
+static void fscrypt_bio_unit_done(struct crypto_async_request *areq, int res)
+{
+	struct fscrypt_bio_unit *unit = areq->data;
+
+	/* The request was moved off the backlog; it completes later */
+	if (res == -EINPROGRESS)
+		return;
+
+	/* Completion callbacks may run in atomic context */
+	skcipher_request_set_callback(unit->req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+				      fscrypt_bio_unit_done, unit);
+	fscrypt_bio_unit_run(unit, res);
+}
+
+/*
+ * Start decrypting the bio in all slots of @ctx.  The requests may sleep while
+ * they are issued from the waiting task, as with fscrypt_crypt_block(); a
+ * slot whose request completed asynchronously issues its next data units from
+ * the completion callback, without CRYPTO_TFM_REQ_MAY_SLEEP.
+ */
+static void fscrypt_bio_ctx_start(struct fscrypt_bio_ctx *ctx)
+{
+	const unsigned int nr_units = ctx->nr_units;
+	unsigned int i;
+
+	atomic_set(&ctx->inflight, nr_units);
+	for (i = 0; i < nr_units; i++) {
+		struct fscrypt_bio_unit *unit = fscrypt_bio_unit(ctx, i);
+
+		skcipher_request_set_callback(unit->req,
+					      CRYPTO_TFM_REQ_MAY_BACKLOG |
+					      CRYPTO_TFM_REQ_MAY_SLEEP,
+					      fscrypt_bio_unit_done, unit);
+	}
+	/* @ctx may be freed as soon as the last slot is started */
+	for (i = 0; i < nr_units; i++)
+		fscrypt_bio_unit_run(fscrypt_bio_unit(ctx, i), 0);
+}
+
+/**
+ * fscrypt_decrypt_bio() - decrypt the pages of a 'read' bio in place
+ * @bio: the bio that has just completed
+ *
+ * Decrypt the pagecache pages of a bio read from an encrypted file.  The data
+ * units of the bio are submitted to the crypto API as separate requests, up to
+ * FSCRYPT_BIO_MAX_INFLIGHT at a time, so that asynchronous implementations can
+ * work on several of them at once.  Pages that fail decryption are set to the
+ * Error state.
+ *
+ * This is for use by the filesystem's ->readpages() method, from a context
+ * that may sleep.
+ */
 void fscrypt_decrypt_bio(struct bio *bio)
 {
+	struct fscrypt_bio_ctx *ctx;
 	struct bio_vec *bv;
 	struct bvec_iter_all iter_all;
 
+	ctx = fscrypt_alloc_bio_ctx(bio, GFP_NOFS);
+	if (ctx) {
+		fscrypt_bio_ctx_start(ctx);
+		wait_for_completion(&ctx->wait);
+		kfree(ctx);
+		return;
+	}
+
 	bio_for_each_segment_all(bv, bio, iter_all) {
 		struct page *page = bv->bv_page;
 		int ret = fscrypt_decrypt_pagecache_blocks(page, bv->bv_len,
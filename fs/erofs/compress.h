@@ -56,5 +56,11 @@ static inline bool z_erofs_put_stagingpage(struct list_head *pagepool,
 int z_erofs_decompress(struct z_erofs_decompress_req *rq,
 		       struct list_head *pagepool);
 
+#ifdef CONFIG_EROFS_FS_ZIP_LZMA
+void z_erofs_lzma_exit(void);
+#else
+static inline void z_erofs_lzma_exit(void) {}
+#endif
+
 #endif
 
@@ -109,10 +109,82 @@ static int erofs_map_blocks_flatmode(struct inode *inode,
 	return err;
 }
 
+/*
+ * Map an offset of a chunk-based inode.  As for flatmode, m_pa and m_plen
+ * describe the extent from m_la itself up to the end of its chunk.
+ */
+static int erofs_map_blocks_chunkmode(struct inode *inode,
+				      struct erofs_map_blocks *map,
+				      int flags)
+{
+	struct super_block *sb = inode->i_sb;
+	struct erofs_inode *vi = EROFS_I(inode);
+	struct erofs_inode_chunk_index *idx;
+	u64 chunknr, chunkoff, chunkend;
+	unsigned int unit, device_id;
+	struct page *page;
+	erofs_off_t pos;
+	void *kaddr;
+	u32 blkaddr;
+
+	if (map->m_la >= inode->i_size) {
+		/* leave out-of-bound access unmapped */
+		map->m_flags = 0;
+		map->m_plen = 0;
+		goto out;
+	}
+
+	if (vi->chunkformat & EROFS_CHUNK_FORMAT_INDEXES)
+		unit = sizeof(*idx);			/* chunk index */
+	else
+		unit = EROFS_BLOCK_MAP_ENTRY_SIZE;	/* block map */
+
+	chunknr = map->m_la >> vi->chunkbits;
+	chunkoff = map->m_la - (chunknr << vi->chunkbits);
+	pos = ALIGN(iloc(EROFS_SB(sb), vi->nid) + vi->inode_isize +
+		    vi->xattr_isize, unit) + unit * chunknr;
+
+	page = erofs_get_meta_page(sb, erofs_blknr(pos));
+	if (IS_ERR(page))
+		return PTR_ERR(page);
+
+	chunkend = min_t(u64, (chunknr + 1) << vi->chunkbits,
+			 roundup(inode->i_size, EROFS_BLKSIZ));
+	map->m_plen = chunkend - map->m_la;
+
+	kaddr = kmap_atomic(page);
+	if (vi->chunkformat & EROFS_CHUNK_FORMAT_INDEXES) {
+		idx = kaddr + erofs_blkoff(pos);
+		blkaddr = le32_to_cpu(idx->blkaddr);
+		device_id = le16_to_cpu(idx->device_id);
+	} else {
+		blkaddr = le32_to_cpu(*(__le32 *)(kaddr + erofs_blkoff(pos)));
+		device_id = 0;
+	}
+	kunmap_atomic(kaddr);
+
+	if (blkaddr == EROFS_NULL_ADDR) {
+		/* a hole, read as zeroes */
+		map->m_flags = 0;
+	} else {
+		map->m_deviceid = device_id & EROFS_SB(sb)->device_id_mask;
+		map->m_pa = blknr_to_addr(blkaddr) + chunkoff;
+		map->m_flags = EROFS_MAP_MAPPED;
+	}
+
+	unlock_page(page);
+	put_page(page);
+out:
+	map->m_llen = map->m_plen;
+	return 0;
+}
+
 int erofs_map_blocks(struct inode *inode,
 		     struct erofs_map_blocks *map, int flags)
 {
-	if (erofs_inode_is_data_compressed(EROFS_I(inode)->datalayout)) {
+	struct erofs_inode *vi = EROFS_I(inode);
+
+	if (erofs_inode_is_data_compressed(vi->datalayout)) {
 		int err = z_erofs_map_blocks_iter(inode, map, flags);
 
 		if (map->mpage) {
@@ -121,9 +193,51 @@ int erofs_map_blocks(struct inode *inode,
 		}
 		return err;
 	}
+	if (vi->datalayout == EROFS_INODE_CHUNK_BASED)
+		return erofs_map_blocks_chunkmode(inode, map, flags);
 	return erofs_map_blocks_flatmode(inode, map, flags);
 }
 
+/*
+ * Find the block device which a physical address returned by
+ * erofs_map_blocks() lives on.  Chunk indexes name their device explicitly;
+ * other addresses are in the flat address space of the primary device, which
+ * may have ranges of the extra devices mapped into it.
+ */
+int erofs_map_dev(struct super_block *sb, struct erofs_map_dev *map)
+{
+	struct erofs_dev_context *devs = EROFS_SB(sb)->devs;
+	struct erofs_device_info *dif;
+	int id;
+
+	/* primary device by default */
+	map->m_bdev = sb->s_bdev;
+
+	if (map->m_deviceid) {
+		dif = idr_find(&devs->tree, map->m_deviceid - 1);
+		if (!dif)
+			return -ENODEV;
+		map->m_bdev = dif->bdev;
+	} else if (devs->extra_devices) {
+		idr_for_each_entry(&devs->tree, dif, id) {
+			erofs_off_t startoff, length;
+
+			if (!dif->mapped_blkaddr)
+				continue;
+			startoff = blknr_to_addr(dif->mapped_blkaddr);
+			length = blknr_to_addr(dif->blocks);
+
+			if (map->m_pa >= startoff &&
+			    map->m_pa < startoff + length) {
+				map->m_pa -= startoff;
+				map->m_bdev = dif->bdev;
+				break;
+			}
+		}
+	}
+	return 0;
+}
+
 static inline struct bio *erofs_read_raw_page(struct bio *bio,
 					      struct address_space *mapping,
 					      struct page *page,
@@ -156,6 +270,7 @@ static inline struct bio *erofs_read_raw_page(struct bio *bio,
 		struct erofs_map_blocks map = {
 			.m_la = blknr_to_addr(current_block),
 		};
+		struct erofs_map_dev mdev;
 		erofs_blk_t blknr;
 		unsigned int blkoff;
 
@@ -212,6 +327,15 @@ static inline struct bio *erofs_read_raw_page(struct bio *bio,
 		/* pa must be block-aligned for raw reading */
 		DBG_BUGON(erofs_blkoff(map.m_pa));
 
+		mdev = (struct erofs_map_dev) {
+			.m_deviceid = map.m_deviceid,
+			.m_pa = map.m_pa,
+		};
+		err = erofs_map_dev(sb, &mdev);
+		if (err)
+			goto err_out;
+		blknr = erofs_blknr(mdev.m_pa);
+
 		/* max # of continuous pages */
 		if (nblocks > DIV_ROUND_UP(map.m_plen, PAGE_SIZE))
 			nblocks = DIV_ROUND_UP(map.m_plen, PAGE_SIZE);
@@ -221,7 +345,7 @@ static inline struct bio *erofs_read_raw_page(struct bio *bio,
 		bio = bio_alloc(GFP_NOIO, nblocks);
 
 		bio->bi_end_io = erofs_readendio;
-		bio_set_dev(bio, sb->s_bdev);
+		bio_set_dev(bio, mdev.m_bdev);
 		bio->bi_iter.bi_sector = (sector_t)blknr <<
 			LOG_SECTORS_PER_BLOCK;
 		bio->bi_opf = REQ_OP_READ | (ra ? REQ_RAHEAD : 0);
@@ -326,7 +450,9 @@ static sector_t erofs_bmap(struct address_space *mapping, sector_t block)
 			return 0;
 	}
 
-	if (!erofs_map_blocks(inode, &map, EROFS_GET_BLOCKS_RAW))
+	/* only blocks on the primary device make sense to the caller */
+	if (!erofs_map_blocks(inode, &map, EROFS_GET_BLOCKS_RAW) &&
+	    !map.m_deviceid)
 		return erofs_blknr(map.m_pa);
 
 	return 0;
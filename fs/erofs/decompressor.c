@@ -7,6 +7,7 @@
 #include "compress.h"
 #include <linux/module.h>
 #include <linux/lz4.h>
+#include <linux/xz.h>
 
 #ifndef LZ4_DISTANCE_MAX	/* history window size */
 #define LZ4_DISTANCE_MAX 65535	/* set to maximum value by default */
@@ -188,6 +189,188 @@ static int z_erofs_lz4_decompress(struct z_erofs_decompress_req *rq, u8 *out)
 	return ret;
 }
 
+int z_erofs_load_lz4_config(struct super_block *sb,
+			    struct z_erofs_lz4_cfgs *lz4, int size)
+{
+	if (size < sizeof(struct z_erofs_lz4_cfgs)) {
+		erofs_err(sb, "invalid lz4 cfgs, size=%u", size);
+		return -EINVAL;
+	}
+
+	/* pclusters of more than one block are not supported yet */
+	if (le16_to_cpu(lz4->max_pclusterblks) > 1) {
+		erofs_err(sb, "unsupported lz4 max_pclusterblks %u, please upgrade kernel",
+			  le16_to_cpu(lz4->max_pclusterblks));
+		return -EOPNOTSUPP;
+	}
+
+	/*
+	 * max_distance can't exceed LZ4_DISTANCE_MAX, which bounced pages
+	 * are already sized for, so nothing needs to be kept here.
+	 */
+	return 0;
+}
+
+#ifdef CONFIG_EROFS_FS_ZIP_LZMA
+/*
+ * LZMA pclusters are decompressed in single-call mode straight into the
+ * contiguous output buffer, so the decoders need no dictionary of their
+ * own and one per CPU is enough.  They are only allocated once the first
+ * image using LZMA is mounted.
+ */
+static DEFINE_PER_CPU(struct xz_dec_microlzma *, z_erofs_lzma_decs);
+static DEFINE_MUTEX(z_erofs_lzma_mutex);
+static bool z_erofs_lzma_ready;
+
+void z_erofs_lzma_exit(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		xz_dec_microlzma_end(per_cpu(z_erofs_lzma_decs, cpu));
+		per_cpu(z_erofs_lzma_decs, cpu) = NULL;
+	}
+	z_erofs_lzma_ready = false;
+}
+
+static int z_erofs_lzma_init(void)
+{
+	struct xz_dec_microlzma *dec;
+	unsigned int cpu;
+	int err = 0;
+
+	mutex_lock(&z_erofs_lzma_mutex);
+	if (z_erofs_lzma_ready)
+		goto out;
+
+	for_each_possible_cpu(cpu) {
+		dec = xz_dec_microlzma_alloc(XZ_SINGLE,
+					     Z_EROFS_LZMA_MAX_DICT_SIZE);
+		if (!dec) {
+			z_erofs_lzma_exit();
+			err = -ENOMEM;
+			goto out;
+		}
+		per_cpu(z_erofs_lzma_decs, cpu) = dec;
+	}
+	z_erofs_lzma_ready = true;
+out:
+	mutex_unlock(&z_erofs_lzma_mutex);
+	return err;
+}
+
+int z_erofs_load_lzma_config(struct super_block *sb,
+			     struct z_erofs_lzma_cfgs *lzma, int size)
+{
+	unsigned int dict_size;
+
+	if (!lzma || size < sizeof(struct z_erofs_lzma_cfgs)) {
+		erofs_err(sb, "invalid lzma cfgs, size=%u", size);
+		return -EINVAL;
+	}
+	if (lzma->format) {
+		erofs_err(sb, "unidentified lzma format %x, please check kernel version",
+			  le16_to_cpu(lzma->format));
+		return -EINVAL;
+	}
+	dict_size = le32_to_cpu(lzma->dict_size);
+	if (dict_size > Z_EROFS_LZMA_MAX_DICT_SIZE || dict_size < 4096) {
+		erofs_err(sb, "unsupported lzma dictionary size %u",
+			  dict_size);
+		return -EINVAL;
+	}
+	return z_erofs_lzma_init();
+}
+
+/*
+ * unlike LZ4, LZMA matches may reach back to the start of the pcluster,
+ * so sparsed pages can't share bounced pages.
+ */
+static int z_erofs_lzma_prepare_destpages(struct z_erofs_decompress_req *rq,
+					  struct list_head *pagepool)
+{
+	const unsigned int nr =
+		PAGE_ALIGN(rq->pageofs_out + rq->outputsize) >> PAGE_SHIFT;
+	unsigned int i;
+
+	for (i = 0; i < nr; ++i) {
+		struct page *victim;
+
+		if (rq->out[i])
+			continue;
+
+		victim = erofs_allocpage(pagepool, GFP_KERNEL);
+		if (!victim)
+			return -ENOMEM;
+		victim->mapping = Z_EROFS_MAPPING_STAGING;
+		rq->out[i] = victim;
+	}
+	return 0;
+}
+
+static int z_erofs_lzma_decompress(struct z_erofs_decompress_req *rq, u8 *out)
+{
+	struct xz_dec_microlzma *dec;
+	unsigned int inputmargin, inlen;
+	struct xz_buf buf;
+	enum xz_ret xz_err;
+	bool copied = false;
+	u8 *src;
+	int ret = 0;
+
+	if (rq->inputsize > PAGE_SIZE)
+		return -EOPNOTSUPP;
+
+	src = kmap_atomic(*rq->in);
+
+	/* MicroLZMA never starts with 0x00, so skip the leading padding */
+	inputmargin = 0;
+	while (!src[inputmargin & ~PAGE_MASK])
+		if (!(++inputmargin & ~PAGE_MASK))
+			break;
+
+	if (inputmargin >= rq->inputsize) {
+		kunmap_atomic(src);
+		return -EIO;
+	}
+
+	/* no safe in-place margin is known for LZMA, always copy */
+	inlen = rq->inputsize - inputmargin;
+	if (rq->inplace_io) {
+		src = generic_copy_inplace_data(rq, src, inputmargin);
+		inputmargin = 0;
+		copied = true;
+	}
+
+	buf.in = src + inputmargin;
+	buf.in_pos = 0;
+	buf.in_size = inlen;
+	buf.out = out;
+	buf.out_pos = 0;
+	buf.out_size = rq->outputsize;
+
+	dec = get_cpu_var(z_erofs_lzma_decs);
+	xz_dec_microlzma_reset(dec, inlen, rq->outputsize,
+			       !rq->partial_decoding);
+	xz_err = xz_dec_microlzma_run(dec, &buf);
+	put_cpu_var(z_erofs_lzma_decs);
+
+	if (xz_err != XZ_STREAM_END) {
+		erofs_err(rq->sb, "failed to decompress %d in[%u, %u] out[%u]",
+			  xz_err, inlen, inputmargin,
+			  rq->outputsize);
+		memset(out + buf.out_pos, 0, rq->outputsize - buf.out_pos);
+		ret = -EIO;
+	}
+
+	if (copied)
+		erofs_put_pcpubuf(src);
+	else
+		kunmap_atomic(src);
+	return ret;
+}
+#endif
+
 static struct z_erofs_decompressor decompressors[] = {
 	[Z_EROFS_COMPRESSION_SHIFTED] = {
 		.name = "shifted"
@@ -197,6 +380,13 @@ static struct z_erofs_decompressor decompressors[] = {
 		.decompress = z_erofs_lz4_decompress,
 		.name = "lz4"
 	},
+#ifdef CONFIG_EROFS_FS_ZIP_LZMA
+	[Z_EROFS_COMPRESSION_LZMA] = {
+		.prepare_destpages = z_erofs_lzma_prepare_destpages,
+		.decompress = z_erofs_lzma_decompress,
+		.name = "lzma"
+	},
+#endif
 };
 
 static void copy_from_pcpubuf(struct page **out, const char *dst,
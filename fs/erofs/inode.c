@@ -96,7 +96,12 @@ static struct page *erofs_read_inode(struct inode *inode,
 		case S_IFREG:
 		case S_IFDIR:
 		case S_IFLNK:
-			vi->raw_blkaddr = le32_to_cpu(die->i_u.raw_blkaddr);
+			if (vi->datalayout == EROFS_INODE_CHUNK_BASED)
+				vi->chunkformat =
+					le16_to_cpu(die->i_u.c.format);
+			else
+				vi->raw_blkaddr =
+					le32_to_cpu(die->i_u.raw_blkaddr);
 			break;
 		case S_IFCHR:
 		case S_IFBLK:
@@ -125,6 +130,7 @@ static struct page *erofs_read_inode(struct inode *inode,
 			nblks = le32_to_cpu(die->i_u.compressed_blocks);
 
 		kfree(copied);
+		copied = NULL;
 		break;
 	case EROFS_INODE_LAYOUT_COMPACT:
 		vi->inode_isize = sizeof(struct erofs_inode_compact);
@@ -136,7 +142,12 @@ static struct page *erofs_read_inode(struct inode *inode,
 		case S_IFREG:
 		case S_IFDIR:
 		case S_IFLNK:
-			vi->raw_blkaddr = le32_to_cpu(dic->i_u.raw_blkaddr);
+			if (vi->datalayout == EROFS_INODE_CHUNK_BASED)
+				vi->chunkformat =
+					le16_to_cpu(dic->i_u.c.format);
+			else
+				vi->raw_blkaddr =
+					le32_to_cpu(dic->i_u.raw_blkaddr);
 			break;
 		case S_IFCHR:
 		case S_IFBLK:
@@ -170,6 +181,18 @@ static struct page *erofs_read_inode(struct inode *inode,
 		goto err_out;
 	}
 
+	if (vi->datalayout == EROFS_INODE_CHUNK_BASED) {
+		if (vi->chunkformat & ~EROFS_CHUNK_FORMAT_ALL) {
+			erofs_err(inode->i_sb,
+				  "unsupported chunk format %x of nid %llu",
+				  vi->chunkformat, vi->nid);
+			err = -EOPNOTSUPP;
+			goto err_out;
+		}
+		vi->chunkbits = LOG_BLOCK_SIZE +
+			(vi->chunkformat & EROFS_CHUNK_FORMAT_BLKBITS_MASK);
+	}
+
 	inode->i_mtime.tv_sec = inode->i_ctime.tv_sec;
 	inode->i_atime.tv_sec = inode->i_ctime.tv_sec;
 	inode->i_mtime.tv_nsec = inode->i_ctime.tv_nsec;
@@ -16,6 +16,7 @@
 #include <linux/magic.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/idr.h>
 #include "erofs_fs.h"
 
 /* redefine pr_fmt "erofs: " */
@@ -46,6 +47,20 @@ typedef u64 erofs_off_t;
 /* data type for filesystem-wide blocks number */
 typedef u32 erofs_blk_t;
 
+struct erofs_device_info {
+	char *path;
+	struct block_device *bdev;
+
+	u32 blocks;
+	u32 mapped_blkaddr;
+};
+
+/* extra devices, in the order of their device ids starting from 1 */
+struct erofs_dev_context {
+	struct idr tree;
+	unsigned int extra_devices;
+};
+
 struct erofs_fs_context {
 #ifdef CONFIG_EROFS_FS_ZIP
 	/* current strategy of how to use managed cache */
@@ -53,8 +68,14 @@ struct erofs_fs_context {
 
 	/* threshold for decompression synchronously */
 	unsigned int max_sync_decompress_pages;
+
+	/* which threads decompress asynchronously */
+	unsigned char decompress_worker;
 #endif
 	unsigned int mount_opt;
+
+	/* given by "device=", handed over to erofs_sb_info on mounting */
+	struct erofs_dev_context *devs;
 };
 
 struct erofs_sb_info {
@@ -70,7 +91,13 @@ struct erofs_sb_info {
 
 	/* pseudo inode to manage cached pages */
 	struct inode *managed_cache;
+
+	/* bitmap of compression algorithms the image may use */
+	u16 available_compr_algs;
 #endif	/* CONFIG_EROFS_FS_ZIP */
+	struct erofs_dev_context *devs;
+	u16 device_id_mask;	/* valid bits of device ids in chunk indexes */
+
 	u32 blocks;
 	u32 meta_blkaddr;
 #ifdef CONFIG_EROFS_FS_XATTR
@@ -113,6 +140,11 @@ enum {
 	EROFS_ZIP_CACHE_READAROUND
 };
 
+enum {
+	EROFS_ZIP_WORKER_WORKQUEUE,
+	EROFS_ZIP_WORKER_PERCPU,
+};
+
 #ifdef CONFIG_EROFS_FS_ZIP
 #define EROFS_LOCKED_MAGIC     (INT_MIN | 0xE0F510CCL)
 
@@ -239,6 +271,10 @@ struct erofs_inode {
 
 	union {
 		erofs_blk_t raw_blkaddr;
+		struct {
+			unsigned short	chunkformat;
+			unsigned char	chunkbits;
+		};
 #ifdef CONFIG_EROFS_FS_ZIP
 		struct {
 			unsigned short z_advise;
@@ -329,6 +365,7 @@ struct erofs_map_blocks {
 	erofs_off_t m_pa, m_la;
 	u64 m_plen, m_llen;
 
+	unsigned short m_deviceid;
 	unsigned int m_flags;
 
 	struct page *mpage;
@@ -358,6 +395,16 @@ struct page *erofs_get_meta_page(struct super_block *sb, erofs_blk_t blkaddr);
 
 int erofs_map_blocks(struct inode *, struct erofs_map_blocks *, int);
 
+/* device which a physical address of erofs_map_blocks() belongs to */
+struct erofs_map_dev {
+	struct block_device *m_bdev;
+
+	erofs_off_t m_pa;
+	unsigned int m_deviceid;
+};
+
+int erofs_map_dev(struct super_block *sb, struct erofs_map_dev *dev);
+
 /* inode.c */
 static inline unsigned long erofs_inode_hash(erofs_nid_t nid)
 {
@@ -416,6 +463,20 @@ int __init erofs_init_shrinker(void);
 void erofs_exit_shrinker(void);
 int __init z_erofs_init_zip_subsystem(void);
 void z_erofs_exit_zip_subsystem(void);
+int z_erofs_load_lz4_config(struct super_block *sb,
+			    struct z_erofs_lz4_cfgs *lz4, int size);
+#ifdef CONFIG_EROFS_FS_ZIP_LZMA
+int z_erofs_load_lzma_config(struct super_block *sb,
+			     struct z_erofs_lzma_cfgs *lzma, int size);
+#else
+static inline int z_erofs_load_lzma_config(struct super_block *sb,
+					   struct z_erofs_lzma_cfgs *lzma,
+					   int size)
+{
+	erofs_err(sb, "lzma algorithm isn't enabled");
+	return -EINVAL;
+}
+#endif	/* !CONFIG_EROFS_FS_ZIP_LZMA */
 int erofs_try_to_free_all_cached_pages(struct erofs_sb_info *sbi,
 				       struct erofs_workgroup *egrp);
 int erofs_try_to_free_cached_page(struct address_space *mapping,
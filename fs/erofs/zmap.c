@@ -69,6 +69,14 @@ static int z_erofs_fill_inode_lazy(struct inode *inode)
 	vi->z_algorithmtype[0] = h->h_algorithmtype & 15;
 	vi->z_algorithmtype[1] = h->h_algorithmtype >> 4;
 
+	/* e.g. big pclusters, which would be decompressed as garbage */
+	if (vi->z_advise & ~Z_EROFS_ALL_ADVISE) {
+		erofs_err(sb, "unknown advise %x for nid %llu, please upgrade kernel",
+			  vi->z_advise, vi->nid);
+		err = -EOPNOTSUPP;
+		goto unmap_done;
+	}
+
 	if (vi->z_algorithmtype[0] >= Z_EROFS_COMPRESSION_MAX) {
 		erofs_err(sb, "unknown compression format %u for nid %llu, please upgrade kernel",
 			  vi->z_algorithmtype[0], vi->nid);
@@ -76,6 +84,14 @@ static int z_erofs_fill_inode_lazy(struct inode *inode)
 		goto unmap_done;
 	}
 
+	if (!(EROFS_SB(sb)->available_compr_algs &
+	      (1 << vi->z_algorithmtype[0]))) {
+		erofs_err(sb, "compression format %u of nid %llu isn't available in the superblock",
+			  vi->z_algorithmtype[0], vi->nid);
+		err = -EFSCORRUPTED;
+		goto unmap_done;
+	}
+
 	vi->z_logical_clusterbits = LOG_BLOCK_SIZE + (h->h_clusterbits & 7);
 	vi->z_physical_clusterbits[0] = vi->z_logical_clusterbits +
 					((h->h_clusterbits >> 3) & 3);
@@ -10,22 +10,6 @@
 #include "exfat_raw.h"
 #include "exfat_fs.h"
 
-static const unsigned char free_bit[] = {
-	0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0, 4, 0, 1, 0, 2,/*  0 ~  19*/
-	0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0, 5, 0, 1, 0, 2, 0, 1, 0, 3,/* 20 ~  39*/
-	0, 1, 0, 2, 0, 1, 0, 4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2,/* 40 ~  59*/
-	0, 1, 0, 6, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0, 4,/* 60 ~  79*/
-	0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0, 5, 0, 1, 0, 2,/* 80 ~  99*/
-	0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0, 4, 0, 1, 0, 2, 0, 1, 0, 3,/*100 ~ 119*/
-	0, 1, 0, 2, 0, 1, 0, 7, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2,/*120 ~ 139*/
-	0, 1, 0, 4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0, 5,/*140 ~ 159*/
-	0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0, 4, 0, 1, 0, 2,/*160 ~ 179*/
-	0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0, 6, 0, 1, 0, 2, 0, 1, 0, 3,/*180 ~ 199*/
-	0, 1, 0, 2, 0, 1, 0, 4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2,/*200 ~ 219*/
-	0, 1, 0, 5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0, 4,/*220 ~ 239*/
-	0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0                /*240 ~ 254*/
-};
-
 static const unsigned char used_bit[] = {
 	0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 1, 2, 2, 3,/*  0 ~  19*/
 	2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 1, 2, 2, 3, 2, 3, 3, 4,/* 20 ~  39*/
@@ -141,6 +125,227 @@ void exfat_free_bitmap(struct exfat_sb_info *sbi)
 	kfree(sbi->vol_amap);
 }
 
+/*
+ * Return the first cluster in [clu, end) whose bit in the allocation bitmap
+ * is @used, or @end if there is none.  The bitmap is scanned a word at a
+ * time.
+ */
+static unsigned int exfat_find_next_bitmap(struct super_block *sb,
+		unsigned int clu, unsigned int end, bool used)
+{
+	struct exfat_sb_info *sbi = EXFAT_SB(sb);
+	unsigned int ent_idx = CLUSTER_TO_BITMAP_ENT(clu);
+	unsigned int ent_end = CLUSTER_TO_BITMAP_ENT(end);
+	unsigned long bits = BITS_PER_SECTOR(sb);
+
+	while (ent_idx < ent_end) {
+		int i = BITMAP_OFFSET_SECTOR_INDEX(sb, ent_idx);
+		unsigned long b = BITMAP_OFFSET_BIT_IN_SECTOR(sb, ent_idx);
+		void *map = sbi->vol_amap[i]->b_data;
+		unsigned long next;
+
+		if (used)
+			next = find_next_bit_le(map, bits, b);
+		else
+			next = find_next_zero_bit_le(map, bits, b);
+
+		ent_idx += next - b;
+		if (next < bits)
+			break;
+	}
+
+	return BITMAP_ENT_TO_CLUSTER(min(ent_idx, ent_end));
+}
+
+/*
+ * If the value of "clu" is 0, it means cluster 2 which is the first cluster of
+ * the cluster heap.
+ */
+unsigned int exfat_find_free_bitmap(struct super_block *sb, unsigned int clu)
+{
+	struct exfat_sb_info *sbi = EXFAT_SB(sb);
+	unsigned int clu_free;
+
+	WARN_ON(clu < EXFAT_FIRST_CLUSTER);
+	clu_free = exfat_find_next_bitmap(sb, clu, sbi->num_clusters, false);
+	if (clu_free < sbi->num_clusters)
+		return clu_free;
+
+	/* wrap around to the start of the cluster heap */
+	clu_free = exfat_find_next_bitmap(sb, EXFAT_FIRST_CLUSTER, clu, false);
+	if (clu_free < clu)
+		return clu_free;
+
+	return EXFAT_EOF_CLUSTER;
+}
+
+/*
+ *  Free Extent Cache
+ *
+ *  A few of the largest runs of free clusters are kept in sbi->free_ext, so
+ *  that a new or relocated chain can be placed without rescanning the
+ *  bitmap.  Every cached cluster is free in the bitmap, but not every free
+ *  cluster is cached: runs split or dropped here are found again when the
+ *  cache runs empty and is rebuilt.  Protected by sbi->s_lock, except while
+ *  mounting.
+ */
+static struct exfat_free_extent *exfat_free_extent_min(
+		struct exfat_sb_info *sbi)
+{
+	struct exfat_free_extent *fe, *min_fe = &sbi->free_ext[0];
+
+	for (fe = sbi->free_ext; fe < sbi->free_ext + EXFAT_FREE_EXTENTS; fe++)
+		if (fe->len < min_fe->len)
+			min_fe = fe;
+	return min_fe;
+}
+
+static struct exfat_free_extent *exfat_free_extent_max(
+		struct exfat_sb_info *sbi)
+{
+	struct exfat_free_extent *fe, *max_fe = &sbi->free_ext[0];
+
+	for (fe = sbi->free_ext; fe < sbi->free_ext + EXFAT_FREE_EXTENTS; fe++)
+		if (fe->len > max_fe->len)
+			max_fe = fe;
+	return max_fe;
+}
+
+/* Cache a free run, replacing the smallest cached one if it is larger */
+static void exfat_free_extent_add(struct exfat_sb_info *sbi,
+		unsigned int start, unsigned int len)
+{
+	struct exfat_free_extent *fe = exfat_free_extent_min(sbi);
+
+	if (fe->len < len) {
+		fe->start = start;
+		fe->len = len;
+	}
+}
+
+/* Drop the clusters in [start, start + len) from the cache */
+static void exfat_free_extent_del(struct exfat_sb_info *sbi,
+		unsigned int start, unsigned int len)
+{
+	struct exfat_free_extent *fe;
+	unsigned int end = start + len;
+
+	for (fe = sbi->free_ext; fe < sbi->free_ext + EXFAT_FREE_EXTENTS; fe++) {
+		unsigned int fe_end = fe->start + fe->len;
+
+		if (!fe->len || end <= fe->start || start >= fe_end)
+			continue;
+
+		if (start <= fe->start) {
+			fe->len = fe_end > end ? fe_end - end : 0;
+			fe->start = end;
+		} else if (end >= fe_end) {
+			fe->len = start - fe->start;
+		} else {
+			/* split, keeping the tail only if there is room */
+			fe->len = start - fe->start;
+			exfat_free_extent_add(sbi, end, fe_end - end);
+		}
+	}
+}
+
+/* A cluster has been freed, grow the cached run next to it if any */
+static void exfat_free_extent_put(struct exfat_sb_info *sbi, unsigned int clu)
+{
+	struct exfat_free_extent *fe;
+
+	for (fe = sbi->free_ext; fe < sbi->free_ext + EXFAT_FREE_EXTENTS; fe++) {
+		if (!fe->len)
+			continue;
+		if (fe->start + fe->len == clu) {
+			fe->len++;
+			return;
+		}
+		if (fe->start == clu + 1) {
+			fe->start--;
+			fe->len++;
+			return;
+		}
+	}
+
+	exfat_free_extent_add(sbi, clu, 1);
+}
+
+void exfat_build_free_extents(struct super_block *sb)
+{
+	struct exfat_sb_info *sbi = EXFAT_SB(sb);
+	unsigned int start, end = EXFAT_FIRST_CLUSTER;
+
+	memset(sbi->free_ext, 0, sizeof(sbi->free_ext));
+	while (end < sbi->num_clusters) {
+		start = exfat_find_next_bitmap(sb, end, sbi->num_clusters,
+				false);
+		if (start >= sbi->num_clusters)
+			break;
+
+		end = exfat_find_next_bitmap(sb, start, sbi->num_clusters,
+				true);
+		exfat_free_extent_add(sbi, start, end - start);
+	}
+}
+
+/*
+ * Find a run of up to @len free clusters and return its first cluster and,
+ * in @ret_len, its length.
+ *
+ * If @extend is set, the run is for a chain whose next cluster would be
+ * @hint.  It then starts at @hint when that cluster is free, so the chain
+ * keeps growing in place, and in that case only the clusters following the
+ * run, up to EXFAT_PREALLOC_SIZE, are dropped from the cache as well.  A
+ * chain that is written sequentially thus has room to stay contiguous, while
+ * new chains are placed elsewhere.  Those clusters are not marked in the
+ * bitmap and can still be used when space runs short.  A chain that has to
+ * jump elsewhere only takes the run it gets, so that jumps on a fragmented
+ * volume don't use up the cache.
+ *
+ * Otherwise the run is taken from the largest cached free extent, and
+ * @hint is only where the bitmap is searched from if there is none.
+ */
+unsigned int exfat_find_free_extent(struct super_block *sb, unsigned int hint,
+		unsigned int len, unsigned int *ret_len, bool extend)
+{
+	struct exfat_sb_info *sbi = EXFAT_SB(sb);
+	struct exfat_free_extent *fe;
+	unsigned int clu, end;
+
+	WARN_ON(hint < EXFAT_FIRST_CLUSTER);
+	if (extend &&
+	    exfat_find_next_bitmap(sb, hint, hint + 1, false) == hint) {
+		clu = hint;
+	} else {
+		fe = exfat_free_extent_max(sbi);
+		if (!fe->len) {
+			exfat_build_free_extents(sb);
+			fe = exfat_free_extent_max(sbi);
+		}
+
+		if (fe->len)
+			clu = fe->start;
+		else
+			clu = exfat_find_free_bitmap(sb, hint);
+		if (clu == EXFAT_EOF_CLUSTER)
+			return clu;
+	}
+
+	len = min(len, sbi->num_clusters - clu);
+	end = exfat_find_next_bitmap(sb, clu, clu + len, true);
+	*ret_len = end - clu;
+
+	if (extend && clu == hint) {
+		len = max_t(unsigned int, *ret_len,
+			    EXFAT_PREALLOC_SIZE >> sbi->cluster_size_bits);
+		exfat_free_extent_del(sbi, clu,
+				min(len, sbi->num_clusters - clu));
+	}
+
+	return clu;
+}
+
 int exfat_set_bitmap(struct inode *inode, unsigned int clu)
 {
 	int i, b;
@@ -155,6 +360,7 @@ int exfat_set_bitmap(struct inode *inode, unsigned int clu)
 
 	set_bit_le(b, sbi->vol_amap[i]->b_data);
 	exfat_update_bh(sbi->vol_amap[i], IS_DIRSYNC(inode));
+	exfat_free_extent_del(sbi, clu, 1);
 	return 0;
 }
 
@@ -173,6 +379,7 @@ void exfat_clear_bitmap(struct inode *inode, unsigned int clu)
 
 	clear_bit_le(b, sbi->vol_amap[i]->b_data);
 	exfat_update_bh(sbi->vol_amap[i], IS_DIRSYNC(inode));
+	exfat_free_extent_put(sbi, clu);
 
 	if (opts->discard) {
 		int ret_discard;
@@ -188,52 +395,6 @@ void exfat_clear_bitmap(struct inode *inode, unsigned int clu)
 	}
 }
 
-/*
- * If the value of "clu" is 0, it means cluster 2 which is the first cluster of
- * the cluster heap.
- */
-unsigned int exfat_find_free_bitmap(struct super_block *sb, unsigned int clu)
-{
-	unsigned int i, map_i, map_b, ent_idx;
-	unsigned int clu_base, clu_free;
-	unsigned char k, clu_mask;
-	struct exfat_sb_info *sbi = EXFAT_SB(sb);
-
-	WARN_ON(clu < EXFAT_FIRST_CLUSTER);
-	ent_idx = CLUSTER_TO_BITMAP_ENT(clu);
-	clu_base = BITMAP_ENT_TO_CLUSTER(ent_idx & ~(BITS_PER_BYTE_MASK));
-	clu_mask = IGNORED_BITS_REMAINED(clu, clu_base);
-
-	map_i = BITMAP_OFFSET_SECTOR_INDEX(sb, ent_idx);
-	map_b = BITMAP_OFFSET_BYTE_IN_SECTOR(sb, ent_idx);
-
-	for (i = EXFAT_FIRST_CLUSTER; i < sbi->num_clusters;
-	     i += BITS_PER_BYTE) {
-		k = *(sbi->vol_amap[map_i]->b_data + map_b);
-		if (clu_mask > 0) {
-			k |= clu_mask;
-			clu_mask = 0;
-		}
-		if (k < 0xFF) {
-			clu_free = clu_base + free_bit[k];
-			if (clu_free < sbi->num_clusters)
-				return clu_free;
-		}
-		clu_base += BITS_PER_BYTE;
-
-		if (++map_b >= sb->s_blocksize ||
-		    clu_base >= sbi->num_clusters) {
-			if (++map_i >= sbi->map_sectors) {
-				clu_base = EXFAT_FIRST_CLUSTER;
-				map_i = 0;
-			}
-			map_b = 0;
-		}
-	}
-
-	return EXFAT_EOF_CLUSTER;
-}
-
 int exfat_count_used_clusters(struct super_block *sb, unsigned int *ret_count)
 {
 	struct exfat_sb_info *sbi = EXFAT_SB(sb);
@@ -6,6 +6,7 @@
 #include <linux/slab.h>
 #include <linux/bio.h>
 #include <linux/buffer_head.h>
+#include <linux/hash.h>
 
 #include "exfat_raw.h"
 #include "exfat_fs.h"
@@ -907,6 +908,286 @@ enum {
 	DIRENT_STEP_SECD,
 };
 
+/*
+ * Hashed lookup of directory entries.
+ *
+ * exfat_find_dir_entry() scans every entry of the directory, so a lookup
+ * in a directory holding thousands of files reads all of them.  For large
+ * directories, an index of the entry sets by the name hash and length in
+ * their stream extension entry is built on the first lookup and kept up to
+ * date as entry sets are added and removed, all under sbi->s_lock.  Names
+ * are compared on disk for the candidates the index returns, so a stale
+ * index entry costs a read, never a wrong answer.
+ */
+#define EXFAT_DIR_INDEX_MIN_SIZE	EXFAT_DEN_TO_B(1024)
+#define EXFAT_DIR_INDEX_HASH_BITS	10
+
+struct exfat_dir_index_entry {
+	struct hlist_node node;
+	int entry;
+	u16 name_hash;
+	unsigned char name_len;
+};
+
+struct exfat_dir_index {
+	struct hlist_head hash[1 << EXFAT_DIR_INDEX_HASH_BITS];
+};
+
+static struct hlist_head *exfat_dir_index_head(struct exfat_dir_index *index,
+		u16 name_hash, unsigned char name_len)
+{
+	u32 key = ((u32)name_len << 16) | name_hash;
+
+	return &index->hash[hash_32(key, EXFAT_DIR_INDEX_HASH_BITS)];
+}
+
+static void exfat_dir_index_destroy(struct exfat_dir_index *index)
+{
+	struct exfat_dir_index_entry *ie;
+	struct hlist_node *tmp;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(index->hash); i++)
+		hlist_for_each_entry_safe(ie, tmp, &index->hash[i], node)
+			kfree(ie);
+	kfree(index);
+}
+
+static int exfat_dir_index_insert(struct exfat_dir_index *index, int entry,
+		u16 name_hash, unsigned char name_len)
+{
+	struct exfat_dir_index_entry *ie;
+
+	ie = kmalloc(sizeof(*ie), GFP_NOFS);
+	if (!ie)
+		return -ENOMEM;
+
+	ie->entry = entry;
+	ie->name_hash = name_hash;
+	ie->name_len = name_len;
+	hlist_add_head(&ie->node,
+		exfat_dir_index_head(index, name_hash, name_len));
+	return 0;
+}
+
+static int exfat_dir_index_build(struct super_block *sb,
+		struct exfat_inode_info *ei, struct exfat_chain *p_dir)
+{
+	int i, dentry = 0, file_entry = -1, ret = 0;
+	int dentries_per_clu = EXFAT_SB(sb)->dentries_per_clu;
+	struct exfat_dir_index *index;
+	struct exfat_chain clu;
+
+	index = kmalloc(sizeof(*index), GFP_NOFS);
+	if (!index)
+		return -ENOMEM;
+	for (i = 0; i < ARRAY_SIZE(index->hash); i++)
+		INIT_HLIST_HEAD(&index->hash[i]);
+
+	exfat_chain_dup(&clu, p_dir);
+	while (clu.dir != EXFAT_EOF_CLUSTER) {
+		for (i = 0; i < dentries_per_clu; i++, dentry++) {
+			struct exfat_dentry *ep;
+			struct buffer_head *bh;
+			unsigned int type;
+
+			ep = exfat_get_dentry(sb, &clu, i, &bh, NULL);
+			if (!ep) {
+				ret = -EIO;
+				goto out;
+			}
+
+			type = exfat_get_entry_type(ep);
+			if (type == TYPE_FILE || type == TYPE_DIR)
+				file_entry = dentry;
+			else if (type == TYPE_STREAM &&
+				 file_entry == dentry - 1)
+				ret = exfat_dir_index_insert(index, file_entry,
+					le16_to_cpu(ep->dentry.stream.name_hash),
+					ep->dentry.stream.name_len);
+			brelse(bh);
+
+			if (ret)
+				goto out;
+			if (type == TYPE_UNUSED)
+				goto out;
+		}
+
+		if (clu.flags == ALLOC_NO_FAT_CHAIN) {
+			if (--clu.size > 0)
+				clu.dir++;
+			else
+				clu.dir = EXFAT_EOF_CLUSTER;
+		} else {
+			if (exfat_get_next_cluster(sb, &clu.dir)) {
+				ret = -EIO;
+				goto out;
+			}
+		}
+	}
+out:
+	if (ret) {
+		exfat_dir_index_destroy(index);
+		return ret;
+	}
+
+	ei->dir_index = index;
+	return 0;
+}
+
+/*
+ * return values:
+ *   1		: the entry set at @entry holds the name
+ *   0		: it does not
+ *   -EIO	: it could not be read or is not a valid entry set
+ */
+static int exfat_dir_index_match(struct super_block *sb,
+		struct exfat_chain *p_dir, int entry,
+		struct exfat_uni_name *p_uniname)
+{
+	int i, len, name_len = 0, ret = 0;
+	unsigned short entry_uniname[16];
+	unsigned short *uniname = p_uniname->name;
+	struct exfat_entry_set_cache *es;
+	struct exfat_dentry *ep;
+	unsigned int type;
+
+	es = exfat_get_dentry_set(sb, p_dir, entry, ES_ALL_ENTRIES);
+	if (!es)
+		return -EIO;
+
+	ep = exfat_get_dentry_cached(es, 0);
+	type = exfat_get_entry_type(ep);
+	if (type != TYPE_FILE && type != TYPE_DIR)
+		goto out;
+
+	ep = exfat_get_dentry_cached(es, 1);
+	if (le16_to_cpu(ep->dentry.stream.name_hash) != p_uniname->name_hash ||
+	    ep->dentry.stream.name_len != p_uniname->name_len)
+		goto out;
+
+	for (i = 2; i < es->num_entries && name_len < p_uniname->name_len;
+	     i++) {
+		ep = exfat_get_dentry_cached(es, i);
+		if (exfat_get_entry_type(ep) != TYPE_EXTEND)
+			goto out;
+
+		len = exfat_extract_uni_name(ep, entry_uniname);
+		len = min(len, p_uniname->name_len - name_len);
+		if (exfat_uniname_ncmp(sb, uniname, entry_uniname, len))
+			goto out;
+
+		uniname += EXFAT_FILE_NAME_LEN;
+		name_len += len;
+	}
+	ret = name_len == p_uniname->name_len;
+out:
+	exfat_free_dentry_set(es, false);
+	return ret;
+}
+
+/*
+ * return values:
+ *   >= 0	: dir entry position with the name in dir
+ *   -ENOENT	: entry with the name does not exist
+ *   -EAGAIN	: no index, scan the directory instead
+ */
+static int exfat_dir_index_find(struct super_block *sb,
+		struct exfat_inode_info *ei, struct exfat_chain *p_dir,
+		struct exfat_uni_name *p_uniname)
+{
+	struct exfat_dir_index_entry *ie;
+	struct hlist_head *head;
+	int ret;
+
+	if (!ei->dir_index) {
+		if (i_size_read(&ei->vfs_inode) < EXFAT_DIR_INDEX_MIN_SIZE)
+			return -EAGAIN;
+		if (exfat_dir_index_build(sb, ei, p_dir))
+			return -EAGAIN;
+	}
+
+	head = exfat_dir_index_head(ei->dir_index, p_uniname->name_hash,
+			p_uniname->name_len);
+	hlist_for_each_entry(ie, head, node) {
+		if (ie->name_hash != p_uniname->name_hash ||
+		    ie->name_len != p_uniname->name_len)
+			continue;
+
+		ret = exfat_dir_index_match(sb, p_dir, ie->entry, p_uniname);
+		if (ret > 0)
+			return ie->entry;
+		if (ret < 0) {
+			/* Let the scan report errors */
+			exfat_dir_index_free(&ei->vfs_inode);
+			return -EAGAIN;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/* An entry set holding @p_uniname was written at @entry of @dir */
+void exfat_dir_index_add(struct inode *dir, int entry,
+		struct exfat_uni_name *p_uniname)
+{
+	struct exfat_inode_info *ei = EXFAT_I(dir);
+
+	if (!ei->dir_index)
+		return;
+
+	if (exfat_dir_index_insert(ei->dir_index, entry, p_uniname->name_hash,
+			p_uniname->name_len))
+		exfat_dir_index_free(dir);
+}
+
+/*
+ * The entry set at @entry of @dir is going away.  Its stream extension
+ * entry must still hold the name hash and length, which removing the entry
+ * set leaves in place.
+ */
+void exfat_dir_index_del(struct inode *dir, struct exfat_chain *p_dir,
+		int entry)
+{
+	struct exfat_inode_info *ei = EXFAT_I(dir);
+	struct exfat_dir_index_entry *ie;
+	struct exfat_dentry *ep;
+	struct buffer_head *bh;
+	struct hlist_head *head;
+
+	if (!ei->dir_index)
+		return;
+
+	ep = exfat_get_dentry(dir->i_sb, p_dir, entry + 1, &bh, NULL);
+	if (!ep) {
+		exfat_dir_index_free(dir);
+		return;
+	}
+
+	head = exfat_dir_index_head(ei->dir_index,
+			le16_to_cpu(ep->dentry.stream.name_hash),
+			ep->dentry.stream.name_len);
+	brelse(bh);
+
+	hlist_for_each_entry(ie, head, node) {
+		if (ie->entry == entry) {
+			hlist_del(&ie->node);
+			kfree(ie);
+			return;
+		}
+	}
+}
+
+void exfat_dir_index_free(struct inode *dir)
+{
+	struct exfat_inode_info *ei = EXFAT_I(dir);
+
+	if (ei->dir_index) {
+		exfat_dir_index_destroy(ei->dir_index);
+		ei->dir_index = NULL;
+	}
+}
+
 /*
  * return values:
  *   >= 0	: return dir entiry position with the name in dir
@@ -927,6 +1208,13 @@ int exfat_find_dir_entry(struct super_block *sb, struct exfat_inode_info *ei,
 	struct exfat_hint_femp candi_empty;
 	struct exfat_sb_info *sbi = EXFAT_SB(sb);
 
+	if (type == TYPE_ALL) {
+		dentry = exfat_dir_index_find(sb, ei, p_dir, p_uniname);
+		if (dentry != -EAGAIN)
+			return dentry;
+		dentry = 0;
+	}
+
 	dentries_per_clu = sbi->dentries_per_clu;
 
 	exfat_chain_dup(&clu, p_dir);
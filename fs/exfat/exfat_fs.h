@@ -208,6 +208,17 @@ struct exfat_mount_options {
 	int time_offset; /* Offset of timestamps from UTC (in minutes) */
 };
 
+/* number of free extents cached per volume */
+#define EXFAT_FREE_EXTENTS	16
+/* clusters kept free after the end of a growing chain */
+#define EXFAT_PREALLOC_SIZE	(16 * 1024 * 1024)
+
+/* a run of free clusters, cached from the allocation bitmap */
+struct exfat_free_extent {
+	unsigned int start;
+	unsigned int len;
+};
+
 /*
  * EXFAT file system superblock in-memory data
  */
@@ -236,6 +247,8 @@ struct exfat_sb_info {
 
 	unsigned int clu_srch_ptr; /* cluster search pointer */
 	unsigned int used_clusters; /* number of used clusters */
+	/* largest free runs */
+	struct exfat_free_extent free_ext[EXFAT_FREE_EXTENTS];
 
 	struct mutex s_lock; /* superblock lock */
 	struct exfat_mount_options options;
@@ -272,6 +285,8 @@ struct exfat_inode_info {
 	struct exfat_hint hint_stat;
 	/* hint for first empty entry */
 	struct exfat_hint_femp hint_femp;
+	/* index of entries by name hash, for directories */
+	struct exfat_dir_index *dir_index;
 
 	spinlock_t cache_lru_lock;
 	struct list_head cache_lru;
@@ -410,6 +425,9 @@ void exfat_free_bitmap(struct exfat_sb_info *sbi);
 int exfat_set_bitmap(struct inode *inode, unsigned int clu);
 void exfat_clear_bitmap(struct inode *inode, unsigned int clu);
 unsigned int exfat_find_free_bitmap(struct super_block *sb, unsigned int clu);
+void exfat_build_free_extents(struct super_block *sb);
+unsigned int exfat_find_free_extent(struct super_block *sb, unsigned int hint,
+		unsigned int len, unsigned int *ret_len, bool extend);
 int exfat_count_used_clusters(struct super_block *sb, unsigned int *ret_count);
 
 /* file.c */
@@ -463,6 +481,11 @@ struct exfat_entry_set_cache *exfat_get_dentry_set(struct super_block *sb,
 		struct exfat_chain *p_dir, int entry, unsigned int type);
 int exfat_free_dentry_set(struct exfat_entry_set_cache *es, int sync);
 int exfat_count_dir_entries(struct super_block *sb, struct exfat_chain *p_dir);
+void exfat_dir_index_add(struct inode *dir, int entry,
+		struct exfat_uni_name *p_uniname);
+void exfat_dir_index_del(struct inode *dir, struct exfat_chain *p_dir,
+		int entry);
+void exfat_dir_index_free(struct inode *dir);
 
 /* inode.c */
 extern const struct inode_operations exfat_file_inode_operations;
@@ -280,10 +280,11 @@ int exfat_alloc_cluster(struct inode *inode, unsigned int num_alloc,
 		struct exfat_chain *p_chain)
 {
 	int ret = -ENOSPC;
-	unsigned int num_clusters = 0, total_cnt;
+	unsigned int num_clusters = 0, total_cnt, run;
 	unsigned int hint_clu, new_clu, last_clu = EXFAT_EOF_CLUSTER;
 	struct super_block *sb = inode->i_sb;
 	struct exfat_sb_info *sbi = EXFAT_SB(sb);
+	bool extend = p_chain->dir != EXFAT_EOF_CLUSTER;
 
 	total_cnt = EXFAT_DATA_CLUSTER_COUNT(sbi);
 
@@ -306,7 +307,8 @@ int exfat_alloc_cluster(struct inode *inode, unsigned int num_alloc,
 			sbi->clu_srch_ptr = EXFAT_FIRST_CLUSTER;
 		}
 
-		hint_clu = exfat_find_free_bitmap(sb, sbi->clu_srch_ptr);
+		hint_clu = exfat_find_free_extent(sb, sbi->clu_srch_ptr,
+				num_alloc, &run, false);
 		if (hint_clu == EXFAT_EOF_CLUSTER)
 			return -ENOSPC;
 	}
@@ -326,8 +328,8 @@ int exfat_alloc_cluster(struct inode *inode, unsigned int num_alloc,
 
 	p_chain->dir = EXFAT_EOF_CLUSTER;
 
-	while ((new_clu = exfat_find_free_bitmap(sb, hint_clu)) !=
-	       EXFAT_EOF_CLUSTER) {
+	while ((new_clu = exfat_find_free_extent(sb, hint_clu, num_alloc,
+			&run, extend)) != EXFAT_EOF_CLUSTER) {
 		if (new_clu != hint_clu &&
 		    p_chain->flags == ALLOC_NO_FAT_CHAIN) {
 			if (exfat_chain_cont_cluster(sb, p_chain->dir,
@@ -338,33 +340,37 @@ int exfat_alloc_cluster(struct inode *inode, unsigned int num_alloc,
 			p_chain->flags = ALLOC_FAT_CHAIN;
 		}
 
-		/* update allocation bitmap */
-		if (exfat_set_bitmap(inode, new_clu)) {
-			ret = -EIO;
-			goto free_cluster;
-		}
-
-		num_clusters++;
-
-		/* update FAT table */
-		if (p_chain->flags == ALLOC_FAT_CHAIN) {
-			if (exfat_ent_set(sb, new_clu, EXFAT_EOF_CLUSTER)) {
+		for (; run > 0; run--, new_clu++) {
+			/* update allocation bitmap */
+			if (exfat_set_bitmap(inode, new_clu)) {
 				ret = -EIO;
 				goto free_cluster;
 			}
-		}
 
-		if (p_chain->dir == EXFAT_EOF_CLUSTER) {
-			p_chain->dir = new_clu;
-		} else if (p_chain->flags == ALLOC_FAT_CHAIN) {
-			if (exfat_ent_set(sb, last_clu, new_clu)) {
-				ret = -EIO;
-				goto free_cluster;
+			num_clusters++;
+
+			/* update FAT table */
+			if (p_chain->flags == ALLOC_FAT_CHAIN) {
+				if (exfat_ent_set(sb, new_clu,
+						EXFAT_EOF_CLUSTER)) {
+					ret = -EIO;
+					goto free_cluster;
+				}
+			}
+
+			if (p_chain->dir == EXFAT_EOF_CLUSTER) {
+				p_chain->dir = new_clu;
+			} else if (p_chain->flags == ALLOC_FAT_CHAIN) {
+				if (exfat_ent_set(sb, last_clu, new_clu)) {
+					ret = -EIO;
+					goto free_cluster;
+				}
 			}
+			last_clu = new_clu;
+			num_alloc--;
 		}
-		last_clu = new_clu;
 
-		if (--num_alloc == 0) {
+		if (num_alloc == 0) {
 			sbi->clu_srch_ptr = hint_clu;
 			sbi->used_clusters += num_clusters;
 
@@ -372,7 +378,7 @@ int exfat_alloc_cluster(struct inode *inode, unsigned int num_alloc,
 			return 0;
 		}
 
-		hint_clu = new_clu + 1;
+		hint_clu = last_clu + 1;
 		if (hint_clu >= sbi->num_clusters) {
 			hint_clu = EXFAT_FIRST_CLUSTER;
 
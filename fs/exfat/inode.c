@@ -654,4 +654,5 @@ void exfat_evict_inode(struct inode *inode)
 	clear_inode(inode);
 	exfat_cache_inval_inode(inode);
 	exfat_unhash_inode(inode);
+	exfat_dir_index_free(inode);
 }
@@ -517,6 +517,7 @@ static int exfat_add_entry(struct inode *inode, const char *path,
 	ret = exfat_init_ext_entry(inode, p_dir, dentry, num_entries, &uniname);
 	if (ret)
 		goto out;
+	exfat_dir_index_add(inode, dentry, &uniname);
 
 	info->dir = *p_dir;
 	info->entry = dentry;
@@ -804,6 +805,7 @@ static int exfat_unlink(struct inode *dir, struct dentry *dentry)
 		err = -EIO;
 		goto unlock;
 	}
+	exfat_dir_index_del(dir, &cdir, entry);
 
 	/* This doesn't modify ei */
 	ei->dir.dir = DIR_DELETED;
@@ -970,6 +972,7 @@ static int exfat_rmdir(struct inode *dir, struct dentry *dentry)
 		exfat_err(sb, "failed to exfat_remove_entries : err(%d)", err);
 		goto unlock;
 	}
+	exfat_dir_index_del(dir, &cdir, entry);
 	ei->dir.dir = DIR_DELETED;
 	exfat_clear_volume_dirty(sb);
 
@@ -1058,7 +1061,9 @@ static int exfat_rename_file(struct inode *inode, struct exfat_chain *p_dir,
 			num_new_entries, p_uniname);
 		if (ret)
 			return ret;
+		exfat_dir_index_add(inode, newentry, p_uniname);
 
+		exfat_dir_index_del(inode, p_dir, oldentry);
 		exfat_remove_entries(inode, p_dir, oldentry, 0,
 			num_old_entries);
 		ei->entry = newentry;
@@ -1069,10 +1074,13 @@ static int exfat_rename_file(struct inode *inode, struct exfat_chain *p_dir,
 		}
 		exfat_update_bh(old_bh, sync);
 		brelse(old_bh);
+		/* Before the old name hash gets overwritten */
+		exfat_dir_index_del(inode, p_dir, oldentry);
 		ret = exfat_init_ext_entry(inode, p_dir, oldentry,
 			num_new_entries, p_uniname);
 		if (ret)
 			return ret;
+		exfat_dir_index_add(inode, oldentry, p_uniname);
 
 		exfat_remove_entries(inode, p_dir, oldentry, num_new_entries,
 			num_old_entries);
@@ -1141,6 +1149,7 @@ static int exfat_move_file(struct inode *inode, struct exfat_chain *p_olddir,
 		p_uniname);
 	if (ret)
 		return ret;
+	exfat_dir_index_add(inode, newentry, p_uniname);
 
 	exfat_remove_entries(inode, p_olddir, oldentry, 0, num_old_entries);
 
@@ -1260,12 +1269,21 @@ static int __exfat_rename(struct inode *old_parent_inode,
 
 	exfat_set_volume_dirty(sb);
 
-	if (olddir.dir == newdir.dir)
+	if (olddir.dir == newdir.dir) {
 		ret = exfat_rename_file(new_parent_inode, &olddir, dentry,
 				&uni_name, ei);
-	else
+	} else {
 		ret = exfat_move_file(new_parent_inode, &olddir, dentry,
 				&newdir, &uni_name, ei);
+		if (!ret)
+			exfat_dir_index_del(old_parent_inode, &olddir, dentry);
+	}
+
+	/* Don't trust the indexes to match whatever made it to disk */
+	if (ret) {
+		exfat_dir_index_free(old_parent_inode);
+		exfat_dir_index_free(new_parent_inode);
+	}
 
 	if (!ret && new_inode) {
 		/* delete entries of new_dir */
@@ -1287,6 +1305,7 @@ static int __exfat_rename(struct inode *old_parent_inode,
 			ret = -EIO;
 			goto del_out;
 		}
+		exfat_dir_index_del(new_parent_inode, p_dir, new_entry);
 
 		/* Free the clusters if new_inode is a dir(as if exfat_rmdir) */
 		if (new_entry_type == TYPE_DIR) {
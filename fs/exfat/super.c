@@ -187,6 +187,7 @@ static struct inode *exfat_alloc_inode(struct super_block *sb)
 		return NULL;
 
 	init_rwsem(&ei->truncate_lock);
+	ei->dir_index = NULL;
 	return &ei->vfs_inode;
 }
 
@@ -604,6 +605,8 @@ static int __exfat_fill_super(struct super_block *sb)
 		goto free_alloc_bitmap;
 	}
 
+	exfat_build_free_extents(sb);
+
 	return 0;
 
 free_alloc_bitmap:
@@ -51,9 +51,13 @@ struct fat_mount_options {
 		 tz_set:1,	   /* Filesystem timestamps' offset set */
 		 rodir:1,	   /* allow ATTR_RO for directory */
 		 discard:1,	   /* Issue discard requests on deletions */
-		 dos1xfloppy:1;	   /* Assume default BPB for DOS 1.x floppies */
+		 dos1xfloppy:1,	   /* Assume default BPB for DOS 1.x floppies */
+		 fatcache:1;	   /* Keep the whole FAT in memory */
 };
 
+/* largest FAT kept in memory with "fatcache", 16MB */
+#define FAT_TABLE_MAX_CLUSTERS	(1UL << 22)
+
 #define FAT_HASH_BITS	8
 #define FAT_HASH_SIZE	(1UL << FAT_HASH_BITS)
 
@@ -89,6 +93,8 @@ struct msdos_sb_info {
 
 	int fatent_shift;
 	const struct fatent_operations *fatent_ops;
+	u32 *fat_table;		      /* in-memory FAT, or NULL */
+	unsigned long *fat_dirty;     /* FAT blocks not in the backup FATs */
 	struct inode *fat_inode;
 	struct inode *fsinfo_inode;
 
@@ -384,12 +390,17 @@ static inline bool fat_valid_entry(struct msdos_sb_info *sbi, int entry)
 extern void fat_ent_access_init(struct super_block *sb);
 extern int fat_ent_read(struct inode *inode, struct fat_entry *fatent,
 			int entry);
+extern int fat_ent_lookup(struct inode *inode, struct fat_entry *fatent,
+			  int entry);
 extern int fat_ent_write(struct inode *inode, struct fat_entry *fatent,
 			 int new, int wait);
+extern int fat_flush_mirror(struct super_block *sb);
 extern int fat_alloc_clusters(struct inode *inode, int *cluster,
 			      int nr_cluster);
 extern int fat_free_clusters(struct inode *inode, int cluster);
 extern int fat_count_free_clusters(struct super_block *sb);
+extern int fat_table_load(struct super_block *sb);
+extern void fat_table_free(struct msdos_sb_info *sbi);
 extern int fat_trim_fs(struct inode *inode, struct fstrim_range *range);
 
 /* fat/file.c */
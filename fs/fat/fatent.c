@@ -284,6 +284,15 @@ static inline void unlock_fat(struct msdos_sb_info *sbi)
 	mutex_unlock(&sbi->fat_lock);
 }
 
+/* Store an entry in the FAT block and in the in-memory FAT, if any */
+static void fat_ent_put(struct msdos_sb_info *sbi, struct fat_entry *fatent,
+			int new)
+{
+	sbi->fatent_ops->ent_put(fatent, new);
+	if (sbi->fat_table)
+		WRITE_ONCE(sbi->fat_table[fatent->entry], new);
+}
+
 void fat_ent_access_init(struct super_block *sb)
 {
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
@@ -370,9 +379,28 @@ int fat_ent_read(struct inode *inode, struct fat_entry *fatent, int entry)
 	return ops->ent_get(fatent);
 }
 
+/*
+ * Same as fat_ent_read(), for callers which only want the value of the
+ * entry.  With an in-memory FAT no block is read and @fatent is unused.
+ */
+int fat_ent_lookup(struct inode *inode, struct fat_entry *fatent, int entry)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(inode->i_sb);
+
+	if (!sbi->fat_table)
+		return fat_ent_read(inode, fatent, entry);
+
+	if (!fat_valid_entry(sbi, entry)) {
+		fat_fs_error(inode->i_sb, "invalid access to FAT (entry 0x%08x)",
+			     entry);
+		return -EIO;
+	}
+	return READ_ONCE(sbi->fat_table[entry]);
+}
+
 /* FIXME: We can write the blocks as more big chunk. */
-static int fat_mirror_bhs(struct super_block *sb, struct buffer_head **bhs,
-			  int nr_bhs)
+static int __fat_mirror_bhs(struct super_block *sb, struct buffer_head **bhs,
+			    int nr_bhs)
 {
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
 	struct buffer_head *c_bh;
@@ -405,14 +433,92 @@ static int fat_mirror_bhs(struct super_block *sb, struct buffer_head **bhs,
 	return err;
 }
 
+/*
+ * Copy the FAT blocks to the backup FATs.  With an in-memory FAT, unless
+ * the filesystem is synchronous, the blocks are only noted in ->fat_dirty
+ * here, and copied by fat_flush_mirror() once for all the changes made to
+ * them in the meantime.
+ */
+static int fat_mirror_bhs(struct super_block *sb, struct buffer_head **bhs,
+			  int nr_bhs)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	int n;
+
+	if (!sbi->fat_dirty || (sb->s_flags & SB_SYNCHRONOUS))
+		return __fat_mirror_bhs(sb, bhs, nr_bhs);
+
+	for (n = 0; n < nr_bhs; n++)
+		set_bit(bhs[n]->b_blocknr - sbi->fat_start, sbi->fat_dirty);
+	/* fat_write_inode() of fsinfo_inode flushes them in the background */
+	__mark_inode_dirty(sbi->fsinfo_inode, I_DIRTY_SYNC);
+	return 0;
+}
+
+static void fat_flush_mirror_done(struct msdos_sb_info *sbi,
+				  struct buffer_head **bhs, int nr_bhs, int err)
+{
+	int i;
+
+	for (i = 0; i < nr_bhs; i++) {
+		/* still to be copied next time */
+		if (err)
+			set_bit(bhs[i]->b_blocknr - sbi->fat_start,
+				sbi->fat_dirty);
+		brelse(bhs[i]);
+	}
+}
+
+int fat_flush_mirror(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	struct buffer_head *bhs[MAX_BUF_PER_PAGE];
+	unsigned long blocknr = 0;
+	int err = 0, nr_bhs = 0;
+
+	if (!sbi->fat_dirty)
+		return 0;
+
+	lock_fat(sbi);
+	for (;;) {
+		blocknr = find_next_bit(sbi->fat_dirty, sbi->fat_length,
+					blocknr);
+		if (blocknr < sbi->fat_length) {
+			bhs[nr_bhs] = sb_bread(sb, sbi->fat_start + blocknr);
+			if (!bhs[nr_bhs]) {
+				err = -EIO;
+				break;
+			}
+			clear_bit(blocknr, sbi->fat_dirty);
+			nr_bhs++;
+			blocknr++;
+		}
+		if (!nr_bhs)
+			break;
+
+		if (nr_bhs == MAX_BUF_PER_PAGE || blocknr >= sbi->fat_length) {
+			err = __fat_mirror_bhs(sb, bhs, nr_bhs);
+			fat_flush_mirror_done(sbi, bhs, nr_bhs, err);
+			nr_bhs = 0;
+			if (err)
+				break;
+		}
+	}
+	fat_flush_mirror_done(sbi, bhs, nr_bhs, err);
+	unlock_fat(sbi);
+
+	if (err)
+		fat_msg(sb, KERN_ERR, "failed to update the backup FATs");
+	return err;
+}
+
 int fat_ent_write(struct inode *inode, struct fat_entry *fatent,
 		  int new, int wait)
 {
 	struct super_block *sb = inode->i_sb;
-	const struct fatent_operations *ops = MSDOS_SB(sb)->fatent_ops;
 	int err;
 
-	ops->ent_put(fatent, new);
+	fat_ent_put(MSDOS_SB(sb), fatent, new);
 	if (wait) {
 		err = fat_sync_bhs(fatent->bhs, fatent->nr_bhs);
 		if (err)
@@ -461,6 +567,42 @@ static void fat_collect_bhs(struct buffer_head **bhs, int *nr_bhs,
 	}
 }
 
+/* Returns the first free entry from @entry on, wrapping around, or -1 */
+static int fat_table_find_free(struct msdos_sb_info *sbi, int entry)
+{
+	int i;
+
+	for (i = entry; i < sbi->max_cluster; i++) {
+		if (sbi->fat_table[i] == FAT_ENT_FREE)
+			return i;
+	}
+	for (i = FAT_START_ENT; i < entry && i < sbi->max_cluster; i++) {
+		if (sbi->fat_table[i] == FAT_ENT_FREE)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Make the free entry @fatent the end of the cluster chain ending at
+ * @prev_ent, if any.  The buffers of @fatent are collected into @bhs.
+ */
+static void fat_alloc_entry(struct msdos_sb_info *sbi,
+			    struct fat_entry *fatent, struct fat_entry *prev_ent,
+			    struct buffer_head **bhs, int *nr_bhs)
+{
+	/* make the cluster chain */
+	fat_ent_put(sbi, fatent, FAT_ENT_EOF);
+	if (prev_ent->nr_bhs)
+		fat_ent_put(sbi, prev_ent, fatent->entry);
+
+	fat_collect_bhs(bhs, nr_bhs, fatent);
+
+	sbi->prev_free = fatent->entry;
+	if (sbi->free_clusters != -1)
+		sbi->free_clusters--;
+}
+
 int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 {
 	struct super_block *sb = inode->i_sb;
@@ -483,6 +625,34 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 	count = FAT_START_ENT;
 	fatent_init(&prev_ent);
 	fatent_init(&fatent);
+
+	if (sbi->fat_table) {
+		int entry = sbi->prev_free;
+
+		/* Find the free entries in memory, and read only their blocks */
+		while (idx_clus < nr_cluster) {
+			entry = fat_table_find_free(sbi, entry + 1);
+			if (entry < 0)
+				goto nospc;
+
+			err = fat_ent_read(inode, &fatent, entry);
+			if (err < 0)
+				goto out;
+			if (err != FAT_ENT_FREE) {
+				fat_fs_error(sb, "%s: in-memory FAT out of sync (entry 0x%08x)",
+					     __func__, entry);
+				err = -EIO;
+				goto out;
+			}
+
+			fat_alloc_entry(sbi, &fatent, &prev_ent, bhs, &nr_bhs);
+			cluster[idx_clus] = entry;
+			idx_clus++;
+			prev_ent = fatent;
+		}
+		goto out;
+	}
+
 	fatent_set_entry(&fatent, sbi->prev_free + 1);
 	while (count < sbi->max_cluster) {
 		if (fatent.entry >= sbi->max_cluster)
@@ -497,16 +667,8 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 			if (ops->ent_get(&fatent) == FAT_ENT_FREE) {
 				int entry = fatent.entry;
 
-				/* make the cluster chain */
-				ops->ent_put(&fatent, FAT_ENT_EOF);
-				if (prev_ent.nr_bhs)
-					ops->ent_put(&prev_ent, entry);
-
-				fat_collect_bhs(bhs, &nr_bhs, &fatent);
-
-				sbi->prev_free = entry;
-				if (sbi->free_clusters != -1)
-					sbi->free_clusters--;
+				fat_alloc_entry(sbi, &fatent, &prev_ent,
+						bhs, &nr_bhs);
 
 				cluster[idx_clus] = entry;
 				idx_clus++;
@@ -525,6 +687,7 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 		} while (fat_ent_next(sbi, &fatent));
 	}
 
+nospc:
 	/* Couldn't allocate the free entries */
 	sbi->free_clusters = 0;
 	sbi->free_clus_valid = 1;
@@ -553,7 +716,6 @@ int fat_free_clusters(struct inode *inode, int cluster)
 {
 	struct super_block *sb = inode->i_sb;
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
-	const struct fatent_operations *ops = sbi->fatent_ops;
 	struct fat_entry fatent;
 	struct buffer_head *bhs[MAX_BUF_PER_PAGE];
 	int i, err, nr_bhs;
@@ -592,7 +754,7 @@ int fat_free_clusters(struct inode *inode, int cluster)
 			}
 		}
 
-		ops->ent_put(&fatent, FAT_ENT_FREE);
+		fat_ent_put(sbi, &fatent, FAT_ENT_FREE);
 		if (sbi->free_clusters != -1) {
 			sbi->free_clusters++;
 			dirty_fsinfo = 1;
@@ -750,6 +912,77 @@ int fat_count_free_clusters(struct super_block *sb)
 	return err;
 }
 
+/*
+ * Read the whole FAT into memory for the "fatcache" mount option.  Cluster
+ * chains are then followed and free clusters searched for there, and the
+ * copies to the backup FATs are batched, see fat_mirror_bhs().  The free
+ * clusters are counted on the way.
+ */
+int fat_table_load(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	const struct fatent_operations *ops = sbi->fatent_ops;
+	struct fat_entry fatent;
+	struct fatent_ra fatent_ra;
+	u32 *table;
+	int err = 0, free = 0;
+
+	if (sbi->max_cluster > FAT_TABLE_MAX_CLUSTERS) {
+		fat_msg(sb, KERN_WARNING, "too many clusters for \"fatcache\"");
+		return -EFBIG;
+	}
+
+	table = kvmalloc_array(sbi->max_cluster, sizeof(*table), GFP_KERNEL);
+	if (!table)
+		return -ENOMEM;
+	table[0] = table[1] = FAT_ENT_EOF;
+
+	fatent_init(&fatent);
+	fatent_set_entry(&fatent, FAT_START_ENT);
+	fat_ra_init(sb, &fatent_ra, &fatent, sbi->max_cluster);
+	while (fatent.entry < sbi->max_cluster) {
+		/* readahead of fat blocks */
+		fat_ent_reada(sb, &fatent_ra, &fatent);
+
+		err = fat_ent_read_block(sb, &fatent);
+		if (err)
+			goto out;
+
+		do {
+			table[fatent.entry] = ops->ent_get(&fatent);
+			if (table[fatent.entry] == FAT_ENT_FREE)
+				free++;
+		} while (fat_ent_next(sbi, &fatent));
+		cond_resched();
+	}
+	fatent_brelse(&fatent);
+
+	if (sbi->fats > 1) {
+		sbi->fat_dirty = bitmap_zalloc(sbi->fat_length, GFP_KERNEL);
+		if (!sbi->fat_dirty) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	sbi->fat_table = table;
+	sbi->free_clusters = free;
+	sbi->free_clus_valid = 1;
+	mark_fsinfo_dirty(sb);
+	return 0;
+out:
+	kvfree(table);
+	return err;
+}
+
+void fat_table_free(struct msdos_sb_info *sbi)
+{
+	kvfree(sbi->fat_table);
+	sbi->fat_table = NULL;
+	bitmap_free(sbi->fat_dirty);
+	sbi->fat_dirty = NULL;
+}
+
 static int fat_trim_clusters(struct super_block *sb, u32 clus, u32 nr_clus)
 {
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
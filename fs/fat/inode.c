@@ -733,6 +733,9 @@ static void fat_put_super(struct super_block *sb)
 
 	fat_set_state(sb, 0, 0);
 
+	fat_flush_mirror(sb);
+	fat_table_free(sbi);
+
 	iput(sbi->fsinfo_inode);
 	iput(sbi->fat_inode);
 
@@ -908,7 +911,9 @@ static int fat_write_inode(struct inode *inode, struct writeback_control *wbc)
 		struct super_block *sb = inode->i_sb;
 
 		mutex_lock(&MSDOS_SB(sb)->s_lock);
-		err = fat_clusters_flush(sb);
+		err = fat_flush_mirror(sb);
+		if (!err)
+			err = fat_clusters_flush(sb);
 		mutex_unlock(&MSDOS_SB(sb)->s_lock);
 	} else
 		err = __fat_write_inode(inode, wbc->sync_mode == WB_SYNC_ALL);
@@ -1024,6 +1029,8 @@ static int fat_show_options(struct seq_file *m, struct dentry *root)
 		seq_puts(m, ",discard");
 	if (opts->dos1xfloppy)
 		seq_puts(m, ",dos1xfloppy");
+	if (opts->fatcache)
+		seq_puts(m, ",fatcache");
 
 	return 0;
 }
@@ -1039,6 +1046,7 @@ enum {
 	Opt_obsolete, Opt_flush, Opt_tz_utc, Opt_rodir, Opt_err_cont,
 	Opt_err_panic, Opt_err_ro, Opt_discard, Opt_nfs, Opt_time_offset,
 	Opt_nfs_stale_rw, Opt_nfs_nostale_ro, Opt_err, Opt_dos1xfloppy,
+	Opt_fatcache,
 };
 
 static const match_table_t fat_tokens = {
@@ -1072,6 +1080,7 @@ static const match_table_t fat_tokens = {
 	{Opt_nfs_stale_rw, "nfs=stale_rw"},
 	{Opt_nfs_nostale_ro, "nfs=nostale_ro"},
 	{Opt_dos1xfloppy, "dos1xfloppy"},
+	{Opt_fatcache, "fatcache"},
 	{Opt_obsolete, "conv=binary"},
 	{Opt_obsolete, "conv=text"},
 	{Opt_obsolete, "conv=auto"},
@@ -1341,6 +1350,9 @@ static int parse_options(struct super_block *sb, char *options, int is_vfat,
 		case Opt_discard:
 			opts->discard = 1;
 			break;
+		case Opt_fatcache:
+			opts->fatcache = 1;
+			break;
 
 		/* obsolete mount options */
 		case Opt_obsolete:
@@ -1881,6 +1893,11 @@ int fat_fill_super(struct super_block *sb, void *data, int silent, int isvfat,
 					"the device does not support discard");
 	}
 
+	if (sbi->options.fatcache && fat_table_load(sb)) {
+		fat_msg(sb, KERN_WARNING, "not keeping the FAT in memory");
+		sbi->options.fatcache = 0;
+	}
+
 	fat_set_state(sb, 1, 0);
 	return 0;
 
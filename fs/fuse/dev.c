@@ -21,6 +21,7 @@
 #include <linux/swap.h>
 #include <linux/splice.h>
 #include <linux/sched.h>
+#include <linux/percpu.h>
 
 MODULE_ALIAS_MISCDEV(FUSE_MINOR);
 MODULE_ALIAS("devname:fuse");
@@ -194,8 +195,7 @@ EXPORT_SYMBOL_GPL(fuse_len_args);
 
 u64 fuse_get_unique(struct fuse_iqueue *fiq)
 {
-	fiq->reqctr += FUSE_REQ_ID_STEP;
-	return fiq->reqctr;
+	return atomic64_add_return(FUSE_REQ_ID_STEP, &fiq->reqctr);
 }
 EXPORT_SYMBOL_GPL(fuse_get_unique);
 
@@ -204,13 +204,45 @@ static unsigned int fuse_req_hash(u64 unique)
 	return hash_long(unique & ~FUSE_INT_REQ_BIT, FUSE_PQ_HASH_BITS);
 }
 
+/*
+ * Devices bound to a CPU wait on their per-CPU queue, so if nobody waits on
+ * fiq->waitq, one of them must be woken to serve the shared queue.  Prefer
+ * one on the local CPU.
+ */
+static void fuse_wake_cpu_reader(struct fuse_iqueue *fiq)
+{
+	struct fuse_cpu_queue __percpu *cpu_queues = READ_ONCE(fiq->cpu_queues);
+	struct fuse_cpu_queue *cq;
+	int cpu;
+
+	if (!cpu_queues)
+		return;
+
+	cq = raw_cpu_ptr(cpu_queues);
+	if (wq_has_sleeper(&cq->waitq)) {
+		wake_up(&cq->waitq);
+		return;
+	}
+
+	for_each_possible_cpu(cpu) {
+		cq = per_cpu_ptr(cpu_queues, cpu);
+		if (wq_has_sleeper(&cq->waitq)) {
+			wake_up(&cq->waitq);
+			return;
+		}
+	}
+}
+
 /**
  * A new request is available, wake fiq->waitq
  */
 static void fuse_dev_wake_and_unlock(struct fuse_iqueue *fiq)
 __releases(fiq->lock)
 {
-	wake_up(&fiq->waitq);
+	if (wq_has_sleeper(&fiq->waitq))
+		wake_up(&fiq->waitq);
+	else
+		fuse_wake_cpu_reader(fiq);
 	kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
 	spin_unlock(&fiq->lock);
 }
@@ -222,17 +254,78 @@ const struct fuse_iqueue_ops fuse_dev_fiq_ops = {
 };
 EXPORT_SYMBOL_GPL(fuse_dev_fiq_ops);
 
-static void queue_request_and_unlock(struct fuse_iqueue *fiq,
-				     struct fuse_req *req)
-__releases(fiq->lock)
+static void fuse_req_set_len(struct fuse_req *req)
 {
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		fuse_len_args(req->args->in_numargs,
 			      (struct fuse_arg *) req->args->in_args);
+}
+
+static void queue_request_and_unlock(struct fuse_iqueue *fiq,
+				     struct fuse_req *req)
+__releases(fiq->lock)
+{
+	fuse_req_set_len(req);
 	list_add_tail(&req->list, &fiq->pending);
 	fiq->ops->wake_pending_and_unlock(fiq);
 }
 
+/*
+ * Queue a request on the queue of the submitting CPU, without touching
+ * fiq->lock.  Returns false if no reader bound to this CPU is waiting for a
+ * request, in which case the request has to go to fiq->pending: a bound
+ * reader that is busy, or blocked serving another request, must not hold up
+ * requests that any other reader could take.
+ */
+static bool queue_request_cpu(struct fuse_iqueue *fiq, struct fuse_req *req)
+{
+	struct fuse_cpu_queue __percpu *cpu_queues = READ_ONCE(fiq->cpu_queues);
+	struct fuse_cpu_queue *cq;
+
+	if (!cpu_queues)
+		return false;
+
+	/* Migrating away from here only costs locality */
+	cq = raw_cpu_ptr(cpu_queues);
+	if (!READ_ONCE(cq->nr_readers))
+		return false;
+
+	spin_lock(&cq->lock);
+	/* fuse_abort_conn() clears fiq->connected before flushing cq */
+	if (!cq->nr_readers || !READ_ONCE(fiq->connected) ||
+	    !wq_has_sleeper(&cq->waitq)) {
+		spin_unlock(&cq->lock);
+		return false;
+	}
+	req->in.h.unique = fuse_get_unique(fiq);
+	fuse_req_set_len(req);
+	req->cq = cq;
+	list_add_tail(&req->list, &cq->pending);
+	wake_up(&cq->waitq);
+	spin_unlock(&cq->lock);
+	kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
+
+	return true;
+}
+
+/*
+ * Lock the queue a pending request is on.  req->cq only ever changes from a
+ * per-CPU queue to NULL, under both that queue's lock and fiq->lock.
+ */
+static spinlock_t *lock_request_queue(struct fuse_iqueue *fiq,
+				      struct fuse_req *req)
+{
+	for (;;) {
+		struct fuse_cpu_queue *cq = READ_ONCE(req->cq);
+		spinlock_t *lock = cq ? &cq->lock : &fiq->lock;
+
+		spin_lock(lock);
+		if (READ_ONCE(req->cq) == cq)
+			return lock;
+		spin_unlock(lock);
+	}
+}
+
 void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 		       u64 nodeid, u64 nlookup)
 {
@@ -263,6 +356,8 @@ static void flush_bg_queue(struct fuse_conn *fc)
 		req = list_first_entry(&fc->bg_queue, struct fuse_req, list);
 		list_del(&req->list);
 		fc->active_background++;
+		if (queue_request_cpu(fiq, req))
+			continue;
 		spin_lock(&fiq->lock);
 		req->in.h.unique = fuse_get_unique(fiq);
 		queue_request_and_unlock(fiq, req);
@@ -369,6 +464,7 @@ static void request_wait_answer(struct fuse_req *req)
 {
 	struct fuse_conn *fc = req->fm->fc;
 	struct fuse_iqueue *fiq = &fc->iq;
+	spinlock_t *lock;
 	int err;
 
 	if (!fc->no_interrupt) {
@@ -392,16 +488,16 @@ static void request_wait_answer(struct fuse_req *req)
 		if (!err)
 			return;
 
-		spin_lock(&fiq->lock);
+		lock = lock_request_queue(fiq, req);
 		/* Request is not yet in userspace, bail out */
 		if (test_bit(FR_PENDING, &req->flags)) {
 			list_del(&req->list);
-			spin_unlock(&fiq->lock);
+			spin_unlock(lock);
 			__fuse_put_request(req);
 			req->out.h.error = -EINTR;
 			return;
 		}
-		spin_unlock(&fiq->lock);
+		spin_unlock(lock);
 	}
 
 	/*
@@ -416,21 +512,24 @@ static void __fuse_request_send(struct fuse_req *req)
 	struct fuse_iqueue *fiq = &req->fm->fc->iq;
 
 	BUG_ON(test_bit(FR_BACKGROUND, &req->flags));
-	spin_lock(&fiq->lock);
-	if (!fiq->connected) {
-		spin_unlock(&fiq->lock);
-		req->out.h.error = -ENOTCONN;
-	} else {
+	/* acquire extra reference, since request is still needed
+	   after fuse_request_end() */
+	__fuse_get_request(req);
+	if (!queue_request_cpu(fiq, req)) {
+		spin_lock(&fiq->lock);
+		if (!fiq->connected) {
+			spin_unlock(&fiq->lock);
+			__fuse_put_request(req);
+			req->out.h.error = -ENOTCONN;
+			return;
+		}
 		req->in.h.unique = fuse_get_unique(fiq);
-		/* acquire extra reference, since request is still needed
-		   after fuse_request_end() */
-		__fuse_get_request(req);
 		queue_request_and_unlock(fiq, req);
-
-		request_wait_answer(req);
-		/* Pairs with smp_wmb() in fuse_request_end() */
-		smp_rmb();
 	}
+
+	request_wait_answer(req);
+	/* Pairs with smp_wmb() in fuse_request_end() */
+	smp_rmb();
 }
 
 static void fuse_adjust_compat(struct fuse_conn *fc, struct fuse_args *args)
@@ -1031,6 +1130,55 @@ static int request_pending(struct fuse_iqueue *fiq)
 		forget_pending(fiq);
 }
 
+static int cpu_request_pending(struct fuse_cpu_queue *cq)
+{
+	return cq && !list_empty(&cq->pending);
+}
+
+/* Take the oldest request off the per-CPU queue of a bound device */
+static struct fuse_req *fuse_dequeue_cpu_request(struct fuse_cpu_queue *cq)
+{
+	struct fuse_req *req = NULL;
+
+	spin_lock(&cq->lock);
+	if (!list_empty(&cq->pending)) {
+		req = list_first_entry(&cq->pending, struct fuse_req, list);
+		clear_bit(FR_PENDING, &req->flags);
+		list_del_init(&req->list);
+	}
+	spin_unlock(&cq->lock);
+
+	return req;
+}
+
+/*
+ * Take a request off the per-CPU queue of some other CPU.  Used by readers
+ * with nothing else to do, so that a request never waits for a reader of its
+ * own CPU while others are idle.
+ */
+static struct fuse_req *fuse_steal_cpu_request(struct fuse_iqueue *fiq,
+					       struct fuse_cpu_queue *own)
+{
+	struct fuse_cpu_queue __percpu *cpu_queues = READ_ONCE(fiq->cpu_queues);
+	struct fuse_cpu_queue *cq;
+	struct fuse_req *req;
+	int cpu;
+
+	if (!cpu_queues)
+		return NULL;
+
+	for_each_possible_cpu(cpu) {
+		cq = per_cpu_ptr(cpu_queues, cpu);
+		if (cq == own || list_empty(&cq->pending))
+			continue;
+		req = fuse_dequeue_cpu_request(cq);
+		if (req)
+			return req;
+	}
+
+	return NULL;
+}
+
 /*
  * Transfer an interrupt request to userspace
  *
@@ -1201,6 +1349,8 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 	struct fuse_conn *fc = fud->fc;
 	struct fuse_iqueue *fiq = &fc->iq;
 	struct fuse_pqueue *fpq = &fud->pq;
+	struct fuse_cpu_queue *cq = READ_ONCE(fud->cq);
+	wait_queue_head_t *waitq = cq ? &cq->waitq : &fiq->waitq;
 	struct fuse_req *req;
 	struct fuse_args *args;
 	unsigned reqsize;
@@ -1226,15 +1376,27 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 
  restart:
 	for (;;) {
+		/* Interrupts go first, as they would on the shared queue */
+		if (cq && list_empty(&fiq->interrupts)) {
+			req = fuse_dequeue_cpu_request(cq);
+			if (req)
+				goto found;
+		}
+
 		spin_lock(&fiq->lock);
 		if (!fiq->connected || request_pending(fiq))
 			break;
 		spin_unlock(&fiq->lock);
 
+		req = fuse_steal_cpu_request(fiq, cq);
+		if (req)
+			goto found;
+
 		if (file->f_flags & O_NONBLOCK)
 			return -EAGAIN;
-		err = wait_event_interruptible_exclusive(fiq->waitq,
-				!fiq->connected || request_pending(fiq));
+		err = wait_event_interruptible_exclusive(*waitq,
+				!fiq->connected || request_pending(fiq) ||
+				cpu_request_pending(cq));
 		if (err)
 			return err;
 	}
@@ -1263,6 +1425,7 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 	list_del_init(&req->list);
 	spin_unlock(&fiq->lock);
 
+found:
 	args = req->args;
 	reqsize = req->in.h.len;
 
@@ -2047,18 +2210,22 @@ static __poll_t fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	__poll_t mask = EPOLLOUT | EPOLLWRNORM;
 	struct fuse_iqueue *fiq;
+	struct fuse_cpu_queue *cq;
 	struct fuse_dev *fud = fuse_get_dev(file);
 
 	if (!fud)
 		return EPOLLERR;
 
 	fiq = &fud->fc->iq;
+	cq = READ_ONCE(fud->cq);
 	poll_wait(file, &fiq->waitq, wait);
+	if (cq)
+		poll_wait(file, &cq->waitq, wait);
 
 	spin_lock(&fiq->lock);
 	if (!fiq->connected)
 		mask = EPOLLERR;
-	else if (request_pending(fiq))
+	else if (request_pending(fiq) || cpu_request_pending(cq))
 		mask |= EPOLLIN | EPOLLRDNORM;
 	spin_unlock(&fiq->lock);
 
@@ -2093,6 +2260,29 @@ static void end_polls(struct fuse_conn *fc)
 	}
 }
 
+/* Pull the pending requests off the per-CPU queues and wake their readers */
+static void fuse_abort_cpu_queues(struct fuse_iqueue *fiq,
+				  struct list_head *to_end)
+{
+	struct fuse_cpu_queue __percpu *cpu_queues = READ_ONCE(fiq->cpu_queues);
+	struct fuse_req *req;
+	int cpu;
+
+	if (!cpu_queues)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct fuse_cpu_queue *cq = per_cpu_ptr(cpu_queues, cpu);
+
+		spin_lock(&cq->lock);
+		list_for_each_entry(req, &cq->pending, list)
+			clear_bit(FR_PENDING, &req->flags);
+		list_splice_tail_init(&cq->pending, to_end);
+		wake_up_all(&cq->waitq);
+		spin_unlock(&cq->lock);
+	}
+}
+
 /*
  * Abort all requests.
  *
@@ -2164,6 +2354,7 @@ void fuse_abort_conn(struct fuse_conn *fc)
 			kfree(fuse_dequeue_forget(fiq, 1, NULL));
 		wake_up_all(&fiq->waitq);
 		spin_unlock(&fiq->lock);
+		fuse_abort_cpu_queues(fiq, &to_end);
 		kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
 		end_polls(fc);
 		wake_up_all(&fc->blocked_waitq);
@@ -2183,6 +2374,37 @@ void fuse_wait_aborted(struct fuse_conn *fc)
 	wait_event(fc->blocked_waitq, atomic_read(&fc->num_waiting) == 0);
 }
 
+/*
+ * When the last device bound to a CPU goes away, move the requests still
+ * queued for that CPU back to the shared queue.
+ */
+static void fuse_dev_unbind_cpu(struct fuse_dev *fud)
+{
+	struct fuse_iqueue *fiq = &fud->fc->iq;
+	struct fuse_cpu_queue *cq = fud->cq;
+	struct fuse_req *req;
+
+	spin_lock(&cq->lock);
+	cq->nr_readers--;
+	if (cq->nr_readers || list_empty(&cq->pending)) {
+		spin_unlock(&cq->lock);
+		return;
+	}
+
+	spin_lock(&fiq->lock);
+	if (!fiq->connected) {
+		/* fuse_abort_conn() will end them */
+		spin_unlock(&fiq->lock);
+		spin_unlock(&cq->lock);
+		return;
+	}
+	list_for_each_entry(req, &cq->pending, list)
+		WRITE_ONCE(req->cq, NULL);
+	list_splice_init(&cq->pending, &fiq->pending);
+	fiq->ops->wake_pending_and_unlock(fiq);
+	spin_unlock(&cq->lock);
+}
+
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
 	struct fuse_dev *fud = fuse_get_dev(file);
@@ -2201,6 +2423,9 @@ int fuse_dev_release(struct inode *inode, struct file *file)
 
 		end_requests(&to_end);
 
+		if (fud->cq)
+			fuse_dev_unbind_cpu(fud);
+
 		/* Are we the last open device? */
 		if (atomic_dec_and_test(&fc->dev_count)) {
 			WARN_ON(fc->iq.fasync != NULL);
@@ -2240,42 +2465,149 @@ static int fuse_device_clone(struct fuse_conn *fc, struct file *new)
 	return 0;
 }
 
-static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
-			   unsigned long arg)
+static long fuse_dev_ioctl_clone(struct file *file, __u32 __user *argp)
 {
-	int err = -ENOTTY;
+	int oldfd;
+	int err = -EFAULT;
 
-	if (cmd == FUSE_DEV_IOC_CLONE) {
-		int oldfd;
+	if (!get_user(oldfd, argp)) {
+		struct file *old = fget(oldfd);
 
-		err = -EFAULT;
-		if (!get_user(oldfd, (__u32 __user *) arg)) {
-			struct file *old = fget(oldfd);
+		err = -EINVAL;
+		if (old) {
+			struct fuse_dev *fud = NULL;
 
-			err = -EINVAL;
-			if (old) {
-				struct fuse_dev *fud = NULL;
-
-				/*
-				 * Check against file->f_op because CUSE
-				 * uses the same ioctl handler.
-				 */
-				if (old->f_op == file->f_op &&
-				    old->f_cred->user_ns == file->f_cred->user_ns)
-					fud = fuse_get_dev(old);
-
-				if (fud) {
-					mutex_lock(&fuse_mutex);
-					err = fuse_device_clone(fud->fc, file);
-					mutex_unlock(&fuse_mutex);
-				}
-				fput(old);
+			/*
+			 * Check against file->f_op because CUSE
+			 * uses the same ioctl handler.
+			 */
+			if (old->f_op == file->f_op &&
+			    old->f_cred->user_ns == file->f_cred->user_ns)
+				fud = fuse_get_dev(old);
+
+			if (fud) {
+				mutex_lock(&fuse_mutex);
+				err = fuse_device_clone(fud->fc, file);
+				mutex_unlock(&fuse_mutex);
 			}
+			fput(old);
 		}
 	}
 	return err;
 }
 
+static long fuse_dev_ioctl_backing_open(struct file *file,
+					struct fuse_backing_map __user *argp)
+{
+	struct fuse_dev *fud = fuse_get_dev(file);
+	struct fuse_backing_map map;
+
+	if (!fud)
+		return -EPERM;
+
+	if (copy_from_user(&map, argp, sizeof(map)))
+		return -EFAULT;
+
+	return fuse_backing_open(fud->fc, &map);
+}
+
+static long fuse_dev_ioctl_backing_close(struct file *file, __u32 __user *argp)
+{
+	struct fuse_dev *fud = fuse_get_dev(file);
+	int backing_id;
+
+	if (!fud)
+		return -EPERM;
+
+	if (get_user(backing_id, argp))
+		return -EFAULT;
+
+	return fuse_backing_close(fud->fc, backing_id);
+}
+
+static long fuse_dev_ioctl_bind_cpu(struct file *file, __u32 __user *argp)
+{
+	struct fuse_dev *fud = fuse_get_dev(file);
+	struct fuse_cpu_queue __percpu *cpu_queues;
+	struct fuse_iqueue *fiq;
+	struct fuse_cpu_queue *cq;
+	u32 cpu;
+
+	if (!fud)
+		return -EPERM;
+
+	if (get_user(cpu, argp))
+		return -EFAULT;
+
+	if (cpu >= nr_cpu_ids || !cpu_possible(cpu))
+		return -EINVAL;
+
+	fiq = &fud->fc->iq;
+	if (fiq->ops != &fuse_dev_fiq_ops)
+		return -EINVAL;
+
+	cpu_queues = READ_ONCE(fiq->cpu_queues);
+	if (!cpu_queues) {
+		struct fuse_cpu_queue __percpu *new;
+		int i;
+
+		new = alloc_percpu(struct fuse_cpu_queue);
+		if (!new)
+			return -ENOMEM;
+
+		for_each_possible_cpu(i) {
+			cq = per_cpu_ptr(new, i);
+			spin_lock_init(&cq->lock);
+			init_waitqueue_head(&cq->waitq);
+			INIT_LIST_HEAD(&cq->pending);
+		}
+
+		spin_lock(&fiq->lock);
+		cpu_queues = fiq->cpu_queues;
+		if (!cpu_queues) {
+			/* Pairs with READ_ONCE() in queue_request_cpu() */
+			smp_store_release(&fiq->cpu_queues, new);
+			cpu_queues = new;
+			new = NULL;
+		}
+		spin_unlock(&fiq->lock);
+		free_percpu(new);
+	}
+
+	cq = per_cpu_ptr(cpu_queues, cpu);
+	if (cmpxchg(&fud->cq, NULL, cq))
+		return -EBUSY;
+
+	spin_lock(&cq->lock);
+	cq->nr_readers++;
+	spin_unlock(&cq->lock);
+
+	return 0;
+}
+
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	void __user *argp = (void __user *)arg;
+
+	switch (cmd) {
+	case FUSE_DEV_IOC_CLONE:
+		return fuse_dev_ioctl_clone(file, argp);
+
+	case FUSE_DEV_IOC_BACKING_OPEN:
+		return fuse_dev_ioctl_backing_open(file, argp);
+
+	case FUSE_DEV_IOC_BACKING_CLOSE:
+		return fuse_dev_ioctl_backing_close(file, argp);
+
+	case FUSE_DEV_IOC_BIND_CPU:
+		return fuse_dev_ioctl_bind_cpu(file, argp);
+
+	default:
+		return -ENOTTY;
+	}
+}
+
 const struct file_operations fuse_dev_operations = {
 	.owner		= THIS_MODULE,
 	.open		= fuse_dev_open,
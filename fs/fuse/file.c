@@ -136,6 +136,7 @@ int fuse_do_open(struct fuse_mount *fm, u64 nodeid, struct file *file,
 	struct fuse_conn *fc = fm->fc;
 	struct fuse_file *ff;
 	int opcode = isdir ? FUSE_OPENDIR : FUSE_OPEN;
+	int backing_id = 0;
 
 	ff = fuse_file_alloc(fm);
 	if (!ff)
@@ -152,6 +153,7 @@ int fuse_do_open(struct fuse_mount *fm, u64 nodeid, struct file *file,
 		if (!err) {
 			ff->fh = outarg.fh;
 			ff->open_flags = outarg.open_flags;
+			backing_id = outarg.backing_id;
 
 		} else if (err != -ENOSYS) {
 			fuse_file_free(ff);
@@ -165,9 +167,19 @@ int fuse_do_open(struct fuse_mount *fm, u64 nodeid, struct file *file,
 	}
 
 	if (isdir)
-		ff->open_flags &= ~FOPEN_DIRECT_IO;
+		ff->open_flags &= ~(FOPEN_DIRECT_IO | FOPEN_PASSTHROUGH);
 
 	ff->nodeid = nodeid;
+
+	if (ff->open_flags & FOPEN_PASSTHROUGH) {
+		int err = fuse_passthrough_open(file, ff, backing_id);
+
+		if (err) {
+			fuse_sync_release(NULL, ff, file->f_flags);
+			return err;
+		}
+	}
+
 	file->private_data = ff;
 
 	return 0;
@@ -283,6 +295,8 @@ static void fuse_prepare_release(struct fuse_inode *fi, struct fuse_file *ff,
 
 	wake_up_interruptible_all(&ff->poll_wait);
 
+	fuse_passthrough_release(ff);
+
 	ra->inarg.fh = ff->fh;
 	ra->inarg.flags = flags;
 	ra->args.in_numargs = 1;
@@ -1547,14 +1561,55 @@ static ssize_t fuse_direct_read_iter(struct kiocb *iocb, struct iov_iter *to)
 	return res;
 }
 
+/*
+ * With FOPEN_PARALLEL_DIRECT_WRITES, direct writes may run in parallel under
+ * the shared inode lock, unless they could change i_size or the inode could
+ * have page writeback for fuse_direct_io() to wait for: fuse_sync_writes()
+ * needs the exclusive lock.  Writeback needs cached pages, either written
+ * with writeback_cache or through a shared writable mapping.
+ */
+static bool fuse_dio_wr_exclusive_lock(struct kiocb *iocb,
+				       struct iov_iter *from)
+{
+	struct file *file = iocb->ki_filp;
+	struct fuse_file *ff = file->private_data;
+	struct inode *inode = file_inode(file);
+	struct fuse_conn *fc = get_fuse_conn(inode);
+	size_t count = iov_iter_count(from);
+
+	if (!(ff->open_flags & FOPEN_PARALLEL_DIRECT_WRITES) ||
+	    iocb->ki_flags & IOCB_APPEND || !count)
+		return true;
+
+	if (iocb->ki_pos + count > i_size_read(inode))
+		return true;
+
+	if (fc->writeback_cache || file->f_mapping->nrpages ||
+	    mapping_writably_mapped(file->f_mapping))
+		return true;
+
+	return fuse_range_is_writeback(inode, iocb->ki_pos >> PAGE_SHIFT,
+				       (iocb->ki_pos + count - 1) >> PAGE_SHIFT);
+}
+
 static ssize_t fuse_direct_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
 	struct inode *inode = file_inode(iocb->ki_filp);
 	struct fuse_io_priv io = FUSE_IO_PRIV_SYNC(iocb);
+	bool exclusive = fuse_dio_wr_exclusive_lock(iocb, from);
 	ssize_t res;
 
-	/* Don't allow parallel writes to the same file */
-	inode_lock(inode);
+	if (exclusive) {
+		inode_lock(inode);
+	} else {
+		inode_lock_shared(inode);
+		/* Recheck, i_size may have changed before we got the lock */
+		if (fuse_dio_wr_exclusive_lock(iocb, from)) {
+			inode_unlock_shared(inode);
+			inode_lock(inode);
+			exclusive = true;
+		}
+	}
 	res = generic_write_checks(iocb, from);
 	if (res > 0) {
 		if (!is_sync_kiocb(iocb) && iocb->ki_flags & IOCB_DIRECT) {
@@ -1567,7 +1622,10 @@ static ssize_t fuse_direct_write_iter(struct kiocb *iocb, struct iov_iter *from)
 	fuse_invalidate_attr(inode);
 	if (res > 0)
 		fuse_write_update_size(inode, iocb->ki_pos);
-	inode_unlock(inode);
+	if (exclusive)
+		inode_unlock(inode);
+	else
+		inode_unlock_shared(inode);
 
 	return res;
 }
@@ -1581,6 +1639,9 @@ static ssize_t fuse_file_read_iter(struct kiocb *iocb, struct iov_iter *to)
 	if (fuse_is_bad(inode))
 		return -EIO;
 
+	if (ff->passthrough)
+		return fuse_passthrough_read_iter(iocb, to);
+
 	if (FUSE_IS_DAX(inode))
 		return fuse_dax_read_iter(iocb, to);
 
@@ -1599,6 +1660,9 @@ static ssize_t fuse_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
 	if (fuse_is_bad(inode))
 		return -EIO;
 
+	if (ff->passthrough)
+		return fuse_passthrough_write_iter(iocb, from);
+
 	if (FUSE_IS_DAX(inode))
 		return fuse_dax_write_iter(iocb, from);
 
@@ -2371,6 +2435,9 @@ static int fuse_file_mmap(struct file *file, struct vm_area_struct *vma)
 {
 	struct fuse_file *ff = file->private_data;
 
+	if (ff->passthrough)
+		return fuse_passthrough_mmap(file, vma);
+
 	/* DAX mmap is superior to direct_io mmap */
 	if (FUSE_IS_DAX(file_inode(file)))
 		return fuse_dax_mmap(file, vma);
@@ -31,6 +31,7 @@
 #include <linux/pid_namespace.h>
 #include <linux/refcount.h>
 #include <linux/user_namespace.h>
+#include <linux/idr.h>
 
 /** Default max number of pages that can be used in a single read request */
 #define FUSE_DEFAULT_MAX_PAGES_PER_REQ 32
@@ -231,6 +232,9 @@ struct fuse_file {
 	/** Wait queue head for poll */
 	wait_queue_head_t poll_wait;
 
+	/** Backing file for FOPEN_PASSTHROUGH, NULL otherwise */
+	struct file *passthrough;
+
 	/** Has flock been performed on this file? */
 	bool flock:1;
 };
@@ -373,6 +377,9 @@ struct fuse_req {
 	/** Used to wake up the task waiting for completion of request*/
 	wait_queue_head_t waitq;
 
+	/** Per-CPU input queue this request was put on, NULL for fiq */
+	struct fuse_cpu_queue *cq;
+
 #if IS_ENABLED(CONFIG_VIRTIO_FS)
 	/** virtio-fs's physically contiguous buffer for in and out args */
 	void *argbuf;
@@ -431,7 +438,7 @@ struct fuse_iqueue {
 	wait_queue_head_t waitq;
 
 	/** The next unique request id */
-	u64 reqctr;
+	atomic64_t reqctr;
 
 	/** The list of pending requests */
 	struct list_head pending;
@@ -454,6 +461,32 @@ struct fuse_iqueue {
 
 	/** Device-specific state */
 	void *priv;
+
+	/** Per-CPU queues, allocated when a device is first bound to a CPU */
+	struct fuse_cpu_queue __percpu *cpu_queues;
+};
+
+/**
+ * Per-CPU input queue
+ *
+ * Requests submitted on a CPU that has a /dev/fuse device bound to it
+ * (FUSE_DEV_IOC_BIND_CPU) are queued here instead of fiq->pending when one
+ * of those devices is waiting for a request.  They are read by the devices
+ * bound to that CPU, or by any reader that would otherwise go idle.
+ * Interrupts and forgets always go through the fuse_iqueue.
+ */
+struct fuse_cpu_queue {
+	/** Lock protecting accesses to members of this structure */
+	spinlock_t lock;
+
+	/** Readers bound to this CPU are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** The list of pending requests */
+	struct list_head pending;
+
+	/** Number of devices bound to this CPU */
+	unsigned int nr_readers;
 };
 
 #define FUSE_PQ_HASH_BITS 8
@@ -485,6 +518,9 @@ struct fuse_dev {
 
 	/** list entry on fc->devices */
 	struct list_head entry;
+
+	/** Per-CPU queue this device is bound to, or NULL */
+	struct fuse_cpu_queue *cq;
 };
 
 struct fuse_fs_context {
@@ -504,6 +540,7 @@ struct fuse_fs_context {
 	bool no_force_umount:1;
 	bool legacy_opts_show:1;
 	bool dax:1;
+	bool passthrough:1;
 	unsigned int max_read;
 	unsigned int blksize;
 	const char *subtype;
@@ -747,6 +784,9 @@ struct fuse_conn {
 	/* Auto-mount submounts announced by the server */
 	unsigned int auto_submounts:1;
 
+	/** Passthrough of file I/O to backing files is enabled */
+	unsigned int passthrough:1;
+
 	/** The number of requests waiting for completion */
 	atomic_t num_waiting;
 
@@ -790,6 +830,9 @@ struct fuse_conn {
 
 	/** List of filesystems using this connection */
 	struct list_head mounts;
+
+	/** Backing files registered for passthrough, protected by lock */
+	struct idr backing_files;
 };
 
 /*
@@ -1231,4 +1274,15 @@ void fuse_dax_inode_cleanup(struct inode *inode);
 bool fuse_dax_check_alignment(struct fuse_conn *fc, unsigned int map_alignment);
 void fuse_dax_cancel_work(struct fuse_conn *fc);
 
+/* passthrough.c */
+int fuse_backing_open(struct fuse_conn *fc, struct fuse_backing_map *map);
+int fuse_backing_close(struct fuse_conn *fc, int backing_id);
+void fuse_backing_files_free(struct fuse_conn *fc);
+int fuse_passthrough_open(struct file *file, struct fuse_file *ff,
+			  int backing_id);
+void fuse_passthrough_release(struct fuse_file *ff);
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb, struct iov_iter *from);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+
 #endif /* _FS_FUSE_I_H */
@@ -506,6 +506,7 @@ enum {
 	OPT_ALLOW_OTHER,
 	OPT_MAX_READ,
 	OPT_BLKSIZE,
+	OPT_PASSTHROUGH,
 	OPT_ERR
 };
 
@@ -520,6 +521,7 @@ static const struct fs_parameter_spec fuse_fs_parameters[] = {
 	fsparam_u32	("max_read",		OPT_MAX_READ),
 	fsparam_u32	("blksize",		OPT_BLKSIZE),
 	fsparam_string	("subtype",		OPT_SUBTYPE),
+	fsparam_flag	("passthrough",		OPT_PASSTHROUGH),
 	{}
 };
 
@@ -603,6 +605,12 @@ static int fuse_parse_param(struct fs_context *fc, struct fs_parameter *param)
 		ctx->blksize = result.uint_32;
 		break;
 
+	case OPT_PASSTHROUGH:
+		if (!capable(CAP_SYS_ADMIN))
+			return invalfc(fc, "passthrough requires CAP_SYS_ADMIN");
+		ctx->passthrough = true;
+		break;
+
 	default:
 		return -EINVAL;
 	}
@@ -643,6 +651,8 @@ static int fuse_show_options(struct seq_file *m, struct dentry *root)
 	if (fc->dax)
 		seq_puts(m, ",dax");
 #endif
+	if (fc->passthrough)
+		seq_puts(m, ",passthrough");
 
 	return 0;
 }
@@ -693,6 +703,7 @@ void fuse_conn_init(struct fuse_conn *fc, struct fuse_mount *fm,
 	fc->congestion_threshold = FUSE_DEFAULT_CONGESTION_THRESHOLD;
 	atomic64_set(&fc->khctr, 0);
 	fc->polled_files = RB_ROOT;
+	idr_init(&fc->backing_files);
 	fc->blocked = 0;
 	fc->initialized = 0;
 	fc->connected = 1;
@@ -716,6 +727,8 @@ void fuse_conn_put(struct fuse_conn *fc)
 
 		if (IS_ENABLED(CONFIG_FUSE_DAX))
 			fuse_dax_conn_free(fc);
+		fuse_backing_files_free(fc);
+		free_percpu(fiq->cpu_queues);
 		if (fiq->ops->release)
 			fiq->ops->release(fiq);
 		put_pid_ns(fc->pid_ns);
@@ -1374,6 +1387,11 @@ int fuse_fill_super_common(struct super_block *sb, struct fuse_fs_context *ctx)
 	fc->destroy = ctx->destroy;
 	fc->no_control = ctx->no_control;
 	fc->no_force_umount = ctx->no_force_umount;
+	fc->passthrough = ctx->passthrough;
+
+	/* Nothing may be stacked on top of us, see fuse_backing_open() */
+	if (fc->passthrough)
+		sb->s_stack_depth = FILESYSTEM_MAX_STACK_DEPTH;
 
 	err = -ENOMEM;
 	root = fuse_get_root_inode(sb, ctx->rootmode);
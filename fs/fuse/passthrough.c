@@ -0,0 +1,397 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * FUSE passthrough to backing files.
+ *
+ * The server registers a file it has opened with FUSE_DEV_IOC_BACKING_OPEN
+ * and names the returned id in the reply to OPEN or CREATE.  Reads, writes
+ * and mmap of such an open file are then done on the backing file directly,
+ * without a round trip to userspace.  All other operations, including
+ * metadata ones, still go to the server.
+ */
+
+#include "fuse_i.h"
+
+#include <linux/cred.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/idr.h>
+#include <linux/slab.h>
+#include <linux/uio.h>
+#include <linux/workqueue.h>
+
+struct fuse_backing {
+	struct file *file;
+	const struct cred *cred;
+	refcount_t count;
+};
+
+struct fuse_passthrough_aio {
+	struct kiocb iocb;
+	struct kiocb *orig_iocb;
+	/* Write completions are finished from here, see below */
+	struct work_struct work;
+	long res;
+	long res2;
+};
+
+static void fuse_backing_free(struct fuse_backing *fb)
+{
+	fput(fb->file);
+	put_cred(fb->cred);
+	kfree(fb);
+}
+
+static void fuse_backing_put(struct fuse_backing *fb)
+{
+	if (refcount_dec_and_test(&fb->count))
+		fuse_backing_free(fb);
+}
+
+static struct fuse_backing *fuse_backing_lookup(struct fuse_conn *fc,
+						int backing_id)
+{
+	struct fuse_backing *fb;
+
+	spin_lock(&fc->lock);
+	fb = idr_find(&fc->backing_files, backing_id);
+	if (fb)
+		refcount_inc(&fb->count);
+	spin_unlock(&fc->lock);
+
+	return fb;
+}
+
+int fuse_backing_open(struct fuse_conn *fc, struct fuse_backing_map *map)
+{
+	struct super_block *backing_sb;
+	struct fuse_backing *fb;
+	struct file *file;
+	int res;
+
+	if (!fc->passthrough || !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (map->flags || map->padding)
+		return -EINVAL;
+
+	file = fget(map->fd);
+	if (!file)
+		return -EBADF;
+
+	res = -EOPNOTSUPP;
+	if (!S_ISREG(file_inode(file)->i_mode) ||
+	    !file->f_op->read_iter || !file->f_op->write_iter)
+		goto out_fput;
+
+	/* A passthrough fuse sb claims the maximum depth, so no loops */
+	backing_sb = file_inode(file)->i_sb;
+	res = -ELOOP;
+	if (backing_sb->s_stack_depth >= FILESYSTEM_MAX_STACK_DEPTH)
+		goto out_fput;
+
+	res = -ENOMEM;
+	fb = kmalloc(sizeof(*fb), GFP_KERNEL);
+	if (!fb)
+		goto out_fput;
+
+	fb->cred = prepare_creds();
+	if (!fb->cred) {
+		kfree(fb);
+		goto out_fput;
+	}
+	fb->file = file;
+	refcount_set(&fb->count, 1);
+
+	idr_preload(GFP_KERNEL);
+	spin_lock(&fc->lock);
+	res = idr_alloc_cyclic(&fc->backing_files, fb, 1, 0, GFP_ATOMIC);
+	spin_unlock(&fc->lock);
+	idr_preload_end();
+
+	if (res < 0)
+		fuse_backing_free(fb);
+
+	return res;
+
+out_fput:
+	fput(file);
+	return res;
+}
+
+int fuse_backing_close(struct fuse_conn *fc, int backing_id)
+{
+	struct fuse_backing *fb;
+
+	if (!fc->passthrough || !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (backing_id <= 0)
+		return -EINVAL;
+
+	spin_lock(&fc->lock);
+	fb = idr_remove(&fc->backing_files, backing_id);
+	spin_unlock(&fc->lock);
+
+	if (!fb)
+		return -ENOENT;
+
+	fuse_backing_put(fb);
+	return 0;
+}
+
+static int fuse_backing_id_free(int id, void *p, void *data)
+{
+	fuse_backing_put(p);
+	return 0;
+}
+
+void fuse_backing_files_free(struct fuse_conn *fc)
+{
+	idr_for_each(&fc->backing_files, fuse_backing_id_free, NULL);
+	idr_destroy(&fc->backing_files);
+}
+
+/*
+ * Open our own instance of the backing file for @file, with the open flags
+ * of @file and the credentials of the server that registered it.  Any
+ * O_TRUNC has already been done by the server.
+ */
+int fuse_passthrough_open(struct file *file, struct fuse_file *ff,
+			  int backing_id)
+{
+	struct fuse_conn *fc = ff->fm->fc;
+	struct fuse_backing *fb;
+	struct file *backing_file;
+	int flags;
+
+	if (!fc->passthrough)
+		return -EIO;
+
+	fb = fuse_backing_lookup(fc, backing_id);
+	if (!fb)
+		return -EIO;
+
+	flags = file->f_flags & ~(O_CREAT | O_EXCL | O_NOCTTY | O_TRUNC);
+	backing_file = dentry_open(&fb->file->f_path, flags, fb->cred);
+	fuse_backing_put(fb);
+
+	if (IS_ERR(backing_file))
+		return PTR_ERR(backing_file);
+
+	ff->passthrough = backing_file;
+	return 0;
+}
+
+void fuse_passthrough_release(struct fuse_file *ff)
+{
+	if (ff->passthrough) {
+		fput(ff->passthrough);
+		ff->passthrough = NULL;
+	}
+}
+
+static rwf_t fuse_iocb_to_rwf(int ifl)
+{
+	rwf_t flags = 0;
+
+	if (ifl & IOCB_NOWAIT)
+		flags |= RWF_NOWAIT;
+	if (ifl & IOCB_HIPRI)
+		flags |= RWF_HIPRI;
+	if (ifl & IOCB_DSYNC)
+		flags |= RWF_DSYNC;
+	if (ifl & IOCB_SYNC)
+		flags |= RWF_SYNC;
+
+	return flags;
+}
+
+static void fuse_passthrough_end_write(struct inode *inode, loff_t pos)
+{
+	fuse_write_update_size(inode, pos);
+	fuse_invalidate_attr(inode);
+}
+
+static void fuse_passthrough_aio_cleanup(struct fuse_passthrough_aio *aio)
+{
+	struct kiocb *iocb = &aio->iocb;
+	struct kiocb *orig_iocb = aio->orig_iocb;
+
+	if (iocb->ki_flags & IOCB_WRITE) {
+		/* Actually acquired in fuse_passthrough_write_iter() */
+		__sb_writers_acquired(file_inode(iocb->ki_filp)->i_sb,
+				      SB_FREEZE_WRITE);
+		file_end_write(iocb->ki_filp);
+		fuse_passthrough_end_write(file_inode(orig_iocb->ki_filp),
+					   iocb->ki_pos);
+	}
+
+	orig_iocb->ki_pos = iocb->ki_pos;
+	fput(iocb->ki_filp);
+	kfree(aio);
+}
+
+static void fuse_passthrough_aio_finish(struct fuse_passthrough_aio *aio,
+					long res, long res2)
+{
+	struct kiocb *orig_iocb = aio->orig_iocb;
+
+	fuse_passthrough_aio_cleanup(aio);
+	orig_iocb->ki_complete(orig_iocb, res, res2);
+}
+
+static void fuse_passthrough_aio_complete_work(struct work_struct *work)
+{
+	struct fuse_passthrough_aio *aio =
+		container_of(work, struct fuse_passthrough_aio, work);
+
+	fuse_passthrough_aio_finish(aio, aio->res, aio->res2);
+}
+
+static void fuse_passthrough_aio_complete(struct kiocb *iocb, long res,
+					  long res2)
+{
+	struct fuse_passthrough_aio *aio =
+		container_of(iocb, struct fuse_passthrough_aio, iocb);
+
+	/*
+	 * The backing file may complete the request from irq or softirq
+	 * context, but updating the fuse inode size after a write takes
+	 * fi->lock, so punt write completions to process context.
+	 */
+	if (iocb->ki_flags & IOCB_WRITE) {
+		aio->res = res;
+		aio->res2 = res2;
+		INIT_WORK(&aio->work, fuse_passthrough_aio_complete_work);
+		schedule_work(&aio->work);
+		return;
+	}
+
+	fuse_passthrough_aio_finish(aio, res, res2);
+}
+
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *file = iocb->ki_filp;
+	struct fuse_file *ff = file->private_data;
+	struct file *backing_file = ff->passthrough;
+	const struct cred *old_cred;
+	ssize_t ret;
+
+	if (!iov_iter_count(to))
+		return 0;
+
+	if (iocb->ki_flags & IOCB_DIRECT &&
+	    (!backing_file->f_mapping->a_ops ||
+	     !backing_file->f_mapping->a_ops->direct_IO))
+		return -EINVAL;
+
+	old_cred = override_creds(backing_file->f_cred);
+	if (is_sync_kiocb(iocb)) {
+		ret = vfs_iter_read(backing_file, to, &iocb->ki_pos,
+				    fuse_iocb_to_rwf(iocb->ki_flags));
+	} else {
+		struct fuse_passthrough_aio *aio;
+
+		ret = -ENOMEM;
+		aio = kzalloc(sizeof(*aio), GFP_KERNEL);
+		if (!aio)
+			goto out;
+
+		aio->orig_iocb = iocb;
+		kiocb_clone(&aio->iocb, iocb, get_file(backing_file));
+		aio->iocb.ki_complete = fuse_passthrough_aio_complete;
+		ret = vfs_iocb_iter_read(backing_file, &aio->iocb, to);
+		if (ret != -EIOCBQUEUED)
+			fuse_passthrough_aio_cleanup(aio);
+	}
+out:
+	revert_creds(old_cred);
+	file_accessed(file);
+
+	return ret;
+}
+
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file *file = iocb->ki_filp;
+	struct inode *inode = file_inode(file);
+	struct fuse_file *ff = file->private_data;
+	struct file *backing_file = ff->passthrough;
+	const struct cred *old_cred;
+	ssize_t ret;
+
+	if (!iov_iter_count(from))
+		return 0;
+
+	if (iocb->ki_flags & IOCB_DIRECT &&
+	    (!backing_file->f_mapping->a_ops ||
+	     !backing_file->f_mapping->a_ops->direct_IO))
+		return -EINVAL;
+
+	inode_lock(inode);
+	old_cred = override_creds(backing_file->f_cred);
+	if (is_sync_kiocb(iocb)) {
+		file_start_write(backing_file);
+		ret = vfs_iter_write(backing_file, from, &iocb->ki_pos,
+				     fuse_iocb_to_rwf(iocb->ki_flags));
+		file_end_write(backing_file);
+		if (ret > 0)
+			fuse_passthrough_end_write(inode, iocb->ki_pos);
+	} else {
+		struct fuse_passthrough_aio *aio;
+
+		ret = -ENOMEM;
+		aio = kzalloc(sizeof(*aio), GFP_KERNEL);
+		if (!aio)
+			goto out;
+
+		file_start_write(backing_file);
+		/* Pacify lockdep, same trick as done in aio_write() */
+		__sb_writers_release(file_inode(backing_file)->i_sb,
+				     SB_FREEZE_WRITE);
+		aio->orig_iocb = iocb;
+		kiocb_clone(&aio->iocb, iocb, get_file(backing_file));
+		aio->iocb.ki_complete = fuse_passthrough_aio_complete;
+		ret = vfs_iocb_iter_write(backing_file, &aio->iocb, from);
+		if (ret != -EIOCBQUEUED)
+			fuse_passthrough_aio_cleanup(aio);
+	}
+out:
+	revert_creds(old_cred);
+	inode_unlock(inode);
+
+	return ret;
+}
+
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *backing_file = ff->passthrough;
+	const struct cred *old_cred;
+	int ret;
+
+	if (!backing_file->f_op->mmap)
+		return -ENODEV;
+
+	if (WARN_ON(file != vma->vm_file))
+		return -EIO;
+
+	vma->vm_file = get_file(backing_file);
+
+	old_cred = override_creds(backing_file->f_cred);
+	ret = call_mmap(vma->vm_file, vma);
+	revert_creds(old_cred);
+
+	if (ret) {
+		/* Drop reference count from new vm_file value */
+		fput(backing_file);
+	} else {
+		/* Drop reference count from previous vm_file value */
+		fput(file);
+	}
+
+	file_accessed(file);
+
+	return ret;
+}
@@ -48,6 +48,50 @@ static inline struct iomap_page *to_iomap_page(struct page *page)
 
 static struct bio_set iomap_ioend_bioset;
 
+/* the largest page the page cache may hand to a buffered write */
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+#define IOMAP_MAX_PAGE_SIZE	HPAGE_PMD_SIZE
+#else
+#define IOMAP_MAX_PAGE_SIZE	PAGE_SIZE
+#endif
+
+/*
+ * The page cache may hand us transparent huge pages, which are treated as a
+ * single unit: state is kept in the head page and offsets are relative to it.
+ * bio_for_each_segment_all() still walks them one base page at a time, so map
+ * such a segment back to the head page.
+ */
+static inline struct page *iomap_bvec_thp(struct bio_vec *bvec,
+		unsigned int *offp)
+{
+	struct page *head = thp_head(bvec->bv_page);
+
+	*offp = ((bvec->bv_page - head) << PAGE_SHIFT) + bvec->bv_offset;
+	return head;
+}
+
+static void
+iomap_flush_dcache(struct page *page, unsigned off, unsigned len)
+{
+	unsigned i;
+
+	for (i = off >> PAGE_SHIFT; i <= (off + len - 1) >> PAGE_SHIFT; i++)
+		flush_dcache_page(page + i);
+}
+
+/* zero_user_segment() only handles a single base page */
+static void
+iomap_zero_segment(struct page *page, unsigned start, unsigned end)
+{
+	while (start < end) {
+		unsigned poff = offset_in_page(start);
+		unsigned plen = min_t(unsigned, PAGE_SIZE - poff, end - start);
+
+		zero_user(page + (start >> PAGE_SHIFT), poff, plen);
+		start += plen;
+	}
+}
+
 static struct iomap_page *
 iomap_page_create(struct inode *inode, struct page *page)
 {
@@ -85,15 +129,16 @@ iomap_page_release(struct page *page)
  * Calculate the range inside the page that we actually need to read.
  */
 static void
-iomap_adjust_read_range(struct inode *inode, struct iomap_page *iop,
+iomap_adjust_read_range(struct inode *inode, struct page *page,
 		loff_t *pos, loff_t length, unsigned *offp, unsigned *lenp)
 {
+	struct iomap_page *iop = to_iomap_page(page);
 	loff_t orig_pos = *pos;
 	loff_t isize = i_size_read(inode);
 	unsigned block_bits = inode->i_blkbits;
 	unsigned block_size = (1 << block_bits);
-	unsigned poff = offset_in_page(*pos);
-	unsigned plen = min_t(loff_t, PAGE_SIZE - poff, length);
+	unsigned poff = offset_in_thp(page, *pos);
+	unsigned plen = min_t(loff_t, thp_size(page) - poff, length);
 	unsigned first = poff >> block_bits;
 	unsigned last = (poff + plen - 1) >> block_bits;
 
@@ -131,7 +176,7 @@ iomap_adjust_read_range(struct inode *inode, struct iomap_page *iop,
 	 * page cache for blocks that are entirely outside of i_size.
 	 */
 	if (orig_pos <= isize && orig_pos + length > isize) {
-		unsigned end = offset_in_page(isize - 1) >> block_bits;
+		unsigned end = offset_in_thp(page, isize - 1) >> block_bits;
 
 		if (first <= end && last > end)
 			plen -= (last - end) * block_size;
@@ -172,14 +217,15 @@ iomap_set_range_uptodate(struct page *page, unsigned off, unsigned len)
 static void
 iomap_read_page_end_io(struct bio_vec *bvec, int error)
 {
-	struct page *page = bvec->bv_page;
+	unsigned int off;
+	struct page *page = iomap_bvec_thp(bvec, &off);
 	struct iomap_page *iop = to_iomap_page(page);
 
 	if (unlikely(error)) {
 		ClearPageUptodate(page);
 		SetPageError(page);
 	} else {
-		iomap_set_range_uptodate(page, bvec->bv_offset, bvec->bv_len);
+		iomap_set_range_uptodate(page, off, bvec->bv_len);
 	}
 
 	if (!iop || atomic_sub_and_test(bvec->bv_len, &iop->read_bytes_pending))
@@ -252,12 +298,12 @@ iomap_readpage_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 	}
 
 	/* zero post-eof blocks as the page may be mapped */
-	iomap_adjust_read_range(inode, iop, &pos, length, &poff, &plen);
+	iomap_adjust_read_range(inode, page, &pos, length, &poff, &plen);
 	if (plen == 0)
 		goto done;
 
 	if (iomap_block_needs_zeroing(inode, iomap, pos)) {
-		zero_user(page, poff, plen);
+		iomap_zero_segment(page, poff, poff + plen);
 		iomap_set_range_uptodate(page, poff, plen);
 		goto done;
 	}
@@ -322,9 +368,9 @@ iomap_readpage(struct page *page, const struct iomap_ops *ops)
 
 	trace_iomap_readpage(page->mapping->host, 1);
 
-	for (poff = 0; poff < PAGE_SIZE; poff += ret) {
+	for (poff = 0; poff < thp_size(page); poff += ret) {
 		ret = iomap_apply(inode, page_offset(page) + poff,
-				PAGE_SIZE - poff, 0, ops, &ctx,
+				thp_size(page) - poff, 0, ops, &ctx,
 				iomap_readpage_actor);
 		if (ret <= 0) {
 			WARN_ON_ONCE(ret == 0);
@@ -358,7 +404,8 @@ iomap_readahead_actor(struct inode *inode, loff_t pos, loff_t length,
 	loff_t done, ret;
 
 	for (done = 0; done < length; done += ret) {
-		if (ctx->cur_page && offset_in_page(pos + done) == 0) {
+		if (ctx->cur_page &&
+		    offset_in_thp(ctx->cur_page, pos + done) == 0) {
 			if (!ctx->cur_page_in_bio)
 				unlock_page(ctx->cur_page);
 			put_page(ctx->cur_page);
@@ -433,13 +480,15 @@ int
 iomap_is_partially_uptodate(struct page *page, unsigned long from,
 		unsigned long count)
 {
-	struct iomap_page *iop = to_iomap_page(page);
-	struct inode *inode = page->mapping->host;
+	struct page *head = thp_head(page);
+	struct iomap_page *iop = to_iomap_page(head);
+	struct inode *inode = head->mapping->host;
 	unsigned len, first, last;
 	unsigned i;
 
 	/* Limit range to one page */
 	len = min_t(unsigned, PAGE_SIZE - from, count);
+	from += (page - head) << PAGE_SHIFT;
 
 	/* First and last blocks in range within page */
 	first = from >> inode->i_blkbits;
@@ -460,7 +509,7 @@ int
 iomap_releasepage(struct page *page, gfp_t gfp_mask)
 {
 	trace_iomap_releasepage(page->mapping->host, page_offset(page),
-			PAGE_SIZE);
+			thp_size(page));
 
 	/*
 	 * mm accommodates an old ext3 case where clean pages might not have had
@@ -483,7 +532,7 @@ iomap_invalidatepage(struct page *page, unsigned int offset, unsigned int len)
 	 * If we are invalidating the entire page, clear the dirty state from it
 	 * and release it to avoid unnecessary buildup of the LRU.
 	 */
-	if (offset == 0 && len == PAGE_SIZE) {
+	if (offset == 0 && len == thp_size(page)) {
 		WARN_ON_ONCE(PageWriteback(page));
 		cancel_dirty_page(page);
 		iomap_page_release(page);
@@ -550,18 +599,18 @@ static int
 __iomap_write_begin(struct inode *inode, loff_t pos, unsigned len, int flags,
 		struct page *page, struct iomap *srcmap)
 {
-	struct iomap_page *iop = iomap_page_create(inode, page);
 	loff_t block_size = i_blocksize(inode);
 	loff_t block_start = round_down(pos, block_size);
 	loff_t block_end = round_up(pos + len, block_size);
-	unsigned from = offset_in_page(pos), to = from + len, poff, plen;
+	unsigned from = offset_in_thp(page, pos), to = from + len, poff, plen;
 
+	iomap_page_create(inode, page);
 	if (PageUptodate(page))
 		return 0;
 	ClearPageError(page);
 
 	do {
-		iomap_adjust_read_range(inode, iop, &block_start,
+		iomap_adjust_read_range(inode, page, &block_start,
 				block_end - block_start, &poff, &plen);
 		if (plen == 0)
 			break;
@@ -574,7 +623,8 @@ __iomap_write_begin(struct inode *inode, loff_t pos, unsigned len, int flags,
 		if (iomap_block_needs_zeroing(inode, srcmap, block_start)) {
 			if (WARN_ON_ONCE(flags & IOMAP_WRITE_F_UNSHARE))
 				return -EIO;
-			zero_user_segments(page, poff, from, to, poff + plen);
+			iomap_zero_segment(page, poff, from);
+			iomap_zero_segment(page, to, poff + plen);
 		} else {
 			int status = iomap_read_page_sync(block_start, page,
 					poff, plen, srcmap);
@@ -587,11 +637,18 @@ __iomap_write_begin(struct inode *inode, loff_t pos, unsigned len, int flags,
 	return 0;
 }
 
+/*
+ * Returns the locked head page covering @pos.  If that is a THP, the caller
+ * may copy up to the end of it rather than only to the end of a base page;
+ * @len is trimmed to what the returned page can take.
+ */
 static int
-iomap_write_begin(struct inode *inode, loff_t pos, unsigned len, unsigned flags,
-		struct page **pagep, struct iomap *iomap, struct iomap *srcmap)
+iomap_write_begin(struct inode *inode, loff_t pos, unsigned *lenp,
+		unsigned flags, struct page **pagep, struct iomap *iomap,
+		struct iomap *srcmap)
 {
 	const struct iomap_page_ops *page_ops = iomap->page_ops;
+	unsigned len = *lenp;
 	struct page *page;
 	int status = 0;
 
@@ -603,6 +660,11 @@ iomap_write_begin(struct inode *inode, loff_t pos, unsigned len, unsigned flags,
 		return -EINTR;
 
 	if (page_ops && page_ops->page_prepare) {
+		/*
+		 * ->page_prepare() reserves resources for the whole range, and
+		 * the file systems using it never see THPs.
+		 */
+		len = min_t(unsigned, len, PAGE_SIZE - offset_in_page(pos));
 		status = page_ops->page_prepare(inode, pos, len, iomap);
 		if (status)
 			return status;
@@ -614,6 +676,8 @@ iomap_write_begin(struct inode *inode, loff_t pos, unsigned len, unsigned flags,
 		status = -ENOMEM;
 		goto out_no_page;
 	}
+	page = thp_head(page);
+	len = min_t(unsigned, len, thp_size(page) - offset_in_thp(page, pos));
 
 	if (srcmap->type == IOMAP_INLINE)
 		iomap_read_inline_data(inode, page, srcmap);
@@ -626,6 +690,7 @@ iomap_write_begin(struct inode *inode, loff_t pos, unsigned len, unsigned flags,
 	if (unlikely(status))
 		goto out_unlock;
 
+	*lenp = len;
 	*pagep = page;
 	return 0;
 
@@ -668,7 +733,7 @@ EXPORT_SYMBOL_GPL(iomap_set_page_dirty);
 static size_t __iomap_write_end(struct inode *inode, loff_t pos, size_t len,
 		size_t copied, struct page *page)
 {
-	flush_dcache_page(page);
+	iomap_flush_dcache(page, offset_in_thp(page, pos), len);
 
 	/*
 	 * The blocks that were entirely written will now be uptodate, so we
@@ -683,7 +748,7 @@ static size_t __iomap_write_end(struct inode *inode, loff_t pos, size_t len,
 	 */
 	if (unlikely(copied < len && !PageUptodate(page)))
 		return 0;
-	iomap_set_range_uptodate(page, offset_in_page(pos), len);
+	iomap_set_range_uptodate(page, offset_in_thp(page, pos), len);
 	iomap_set_page_dirty(page);
 	return copied;
 }
@@ -745,6 +810,33 @@ static size_t iomap_write_end(struct inode *inode, loff_t pos, size_t len,
 	return ret;
 }
 
+/*
+ * Copy into a page that may be a THP.  Highmem base pages can only be mapped
+ * one at a time, so do it page by page, stopping at the first short copy.
+ */
+static size_t
+iomap_copy_from_user(struct page *page, struct iov_iter *i,
+		unsigned long offset, unsigned long bytes)
+{
+	struct iov_iter iter = *i;
+	size_t copied = 0;
+
+	while (copied < bytes) {
+		unsigned long poff = offset_in_page(offset + copied);
+		size_t n = min_t(size_t, PAGE_SIZE - poff, bytes - copied);
+		size_t ret;
+
+		ret = iov_iter_copy_from_user_atomic(
+				page + ((offset + copied) >> PAGE_SHIFT),
+				&iter, poff, n);
+		copied += ret;
+		if (ret < n)
+			break;
+		iov_iter_advance(&iter, ret);
+	}
+	return copied;
+}
+
 static loff_t
 iomap_write_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 		struct iomap *iomap, struct iomap *srcmap)
@@ -756,11 +848,15 @@ iomap_write_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 	do {
 		struct page *page;
 		unsigned long offset;	/* Offset into pagecache page */
-		unsigned long bytes;	/* Bytes to write to page */
+		unsigned bytes;		/* Bytes to write to page */
 		size_t copied;		/* Bytes copied from user */
 
-		offset = offset_in_page(pos);
-		bytes = min_t(unsigned long, PAGE_SIZE - offset,
+		/*
+		 * Try for as much as the largest page the page cache may give
+		 * us; iomap_write_begin() trims it to the page it finds.
+		 */
+		offset = pos & (IOMAP_MAX_PAGE_SIZE - 1);
+		bytes = min_t(unsigned long, IOMAP_MAX_PAGE_SIZE - offset,
 						iov_iter_count(i));
 again:
 		if (bytes > length)
@@ -774,22 +870,26 @@ iomap_write_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 		 *
 		 * Not only is this an optimisation, but it is also required
 		 * to check that the address is actually valid, when atomic
-		 * usercopies are used, below.
+		 * usercopies are used, below.  Only the first base page is
+		 * faulted in; the rest of a THP simply takes the short copy
+		 * path below if the source isn't resident.
 		 */
-		if (unlikely(iov_iter_fault_in_readable(i, bytes))) {
+		if (unlikely(iov_iter_fault_in_readable(i, min_t(unsigned,
+				bytes, PAGE_SIZE - offset_in_page(pos))))) {
 			status = -EFAULT;
 			break;
 		}
 
-		status = iomap_write_begin(inode, pos, bytes, 0, &page, iomap,
+		status = iomap_write_begin(inode, pos, &bytes, 0, &page, iomap,
 				srcmap);
 		if (unlikely(status))
 			break;
+		offset = offset_in_thp(page, pos);
 
 		if (mapping_writably_mapped(inode->i_mapping))
-			flush_dcache_page(page);
+			iomap_flush_dcache(page, offset, bytes);
 
-		copied = iov_iter_copy_from_user_atomic(page, i, offset, bytes);
+		copied = iomap_copy_from_user(page, i, offset, bytes);
 
 		copied = iomap_write_end(inode, pos, bytes, copied, page, iomap,
 				srcmap);
@@ -806,7 +906,8 @@ iomap_write_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 			 * because not all segments in the iov can be copied at
 			 * once without a pagefault.
 			 */
-			bytes = min_t(unsigned long, PAGE_SIZE - offset,
+			bytes = min_t(unsigned long, PAGE_SIZE -
+						offset_in_page(pos),
 						iov_iter_single_seg_count(i));
 			goto again;
 		}
@@ -855,11 +956,12 @@ iomap_unshare_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 		return length;
 
 	do {
-		unsigned long offset = offset_in_page(pos);
-		unsigned long bytes = min_t(loff_t, PAGE_SIZE - offset, length);
+		unsigned long offset = pos & (IOMAP_MAX_PAGE_SIZE - 1);
+		unsigned bytes = min_t(loff_t, IOMAP_MAX_PAGE_SIZE - offset,
+				length);
 		struct page *page;
 
-		status = iomap_write_begin(inode, pos, bytes,
+		status = iomap_write_begin(inode, pos, &bytes,
 				IOMAP_WRITE_F_UNSHARE, &page, iomap, srcmap);
 		if (unlikely(status))
 			return status;
@@ -905,14 +1007,15 @@ static s64 iomap_zero(struct inode *inode, loff_t pos, u64 length,
 {
 	struct page *page;
 	int status;
-	unsigned offset = offset_in_page(pos);
-	unsigned bytes = min_t(u64, PAGE_SIZE - offset, length);
+	unsigned offset = pos & (IOMAP_MAX_PAGE_SIZE - 1);
+	unsigned bytes = min_t(u64, IOMAP_MAX_PAGE_SIZE - offset, length);
 
-	status = iomap_write_begin(inode, pos, bytes, 0, &page, iomap, srcmap);
+	status = iomap_write_begin(inode, pos, &bytes, 0, &page, iomap, srcmap);
 	if (status)
 		return status;
 
-	zero_user(page, offset, bytes);
+	offset = offset_in_thp(page, pos);
+	iomap_zero_segment(page, offset, offset + bytes);
 	mark_page_accessed(page);
 
 	return iomap_write_end(inode, pos, bytes, bytes, page, iomap, srcmap);
@@ -1084,9 +1187,13 @@ iomap_finish_ioend(struct iomap_ioend *ioend, int error)
 			next = bio->bi_private;
 
 		/* walk each page on bio, ending page IO on them */
-		bio_for_each_segment_all(bv, bio, iter_all)
-			iomap_finish_page_writeback(inode, bv->bv_page, error,
+		bio_for_each_segment_all(bv, bio, iter_all) {
+			unsigned int off;
+
+			iomap_finish_page_writeback(inode,
+					iomap_bvec_thp(bv, &off), error,
 					bv->bv_len);
+		}
 		bio_put(bio);
 	}
 	/* The ioend has been freed by bio_put() */
@@ -1292,7 +1399,7 @@ iomap_add_to_ioend(struct inode *inode, loff_t offset, struct page *page,
 {
 	sector_t sector = iomap_sector(&wpc->iomap, offset);
 	unsigned len = i_blocksize(inode);
-	unsigned poff = offset & (PAGE_SIZE - 1);
+	unsigned poff = offset_in_thp(page, offset);
 	bool merged, same_page = false;
 
 	if (!wpc->ioend || !iomap_can_add_to_ioend(wpc, offset, sector)) {
@@ -1355,7 +1462,7 @@ iomap_writepage_map(struct iomap_writepage_ctx *wpc,
 	 * one.
 	 */
 	for (i = 0, file_offset = page_offset(page);
-	     i < (PAGE_SIZE >> inode->i_blkbits) && file_offset < end_offset;
+	     i < i_blocks_per_page(inode, page) && file_offset < end_offset;
 	     i++, file_offset += len) {
 		if (iop && !test_bit(i, iop->uptodate))
 			continue;
@@ -1443,7 +1550,7 @@ iomap_do_writepage(struct page *page, struct writeback_control *wbc, void *data)
 	u64 end_offset;
 	loff_t offset;
 
-	trace_iomap_writepage(inode, page_offset(page), PAGE_SIZE);
+	trace_iomap_writepage(inode, page_offset(page), thp_size(page));
 
 	/*
 	 * Refuse to write the page out if we are called from reclaim context.
@@ -1481,8 +1588,8 @@ iomap_do_writepage(struct page *page, struct writeback_control *wbc, void *data)
 	 */
 	offset = i_size_read(inode);
 	end_index = offset >> PAGE_SHIFT;
-	if (page->index < end_index)
-		end_offset = (loff_t)(page->index + 1) << PAGE_SHIFT;
+	if (page->index + thp_nr_pages(page) - 1 < end_index)
+		end_offset = page_offset(page) + thp_size(page);
 	else {
 		/*
 		 * Check whether the page to write out is beyond or straddles
@@ -1495,7 +1602,7 @@ iomap_do_writepage(struct page *page, struct writeback_control *wbc, void *data)
 		 * |				    |      Straddles     |
 		 * ---------------------------------^-----------|--------|
 		 */
-		unsigned offset_into_page = offset & (PAGE_SIZE - 1);
+		unsigned offset_into_page = offset_in_thp(page, offset);
 
 		/*
 		 * Skip the page if it is fully outside i_size, e.g. due to a
@@ -1526,7 +1633,7 @@ iomap_do_writepage(struct page *page, struct writeback_control *wbc, void *data)
 		 * memory is zeroed when mapped, and writes to that region are
 		 * not written out to the file."
 		 */
-		zero_user_segment(page, offset_into_page, PAGE_SIZE);
+		iomap_zero_segment(page, offset_into_page, thp_size(page));
 
 		/* Adjust the end_offset to the end of file */
 		end_offset = offset;
@@ -10,6 +10,8 @@
 #include <linux/backing-dev.h>
 #include <linux/uio.h>
 #include <linux/task_io_accounting_ops.h>
+#include <linux/cpuhotplug.h>
+#include <linux/percpu.h>
 #include "trace.h"
 
 #include "../internal.h"
@@ -23,6 +25,18 @@
 #define IOMAP_DIO_WRITE		(1 << 30)
 #define IOMAP_DIO_DIRTY		(1 << 31)
 
+/*
+ * Number of hardware queues a synchronous polled dio keeps track of.  Bios
+ * are only marked polled while there is room to record where they went, the
+ * rest of a larger request completes through interrupts.
+ */
+#define IOMAP_DIO_POLL_QUEUES	4
+
+struct iomap_dio_poll {
+	struct request_queue	*queue;
+	blk_qc_t		cookie;
+};
+
 struct iomap_dio {
 	struct kiocb		*iocb;
 	const struct iomap_dio_ops *dops;
@@ -38,8 +52,9 @@ struct iomap_dio {
 		struct {
 			struct iov_iter		*iter;
 			struct task_struct	*waiter;
-			struct request_queue	*last_queue;
-			blk_qc_t		cookie;
+			unsigned int		max_poll;
+			unsigned int		nr_poll;
+			struct iomap_dio_poll	poll[IOMAP_DIO_POLL_QUEUES];
 		} submit;
 
 		/* used for aio completion: */
@@ -59,21 +74,126 @@ int iomap_dio_iopoll(struct kiocb *kiocb, bool spin)
 }
 EXPORT_SYMBOL_GPL(iomap_dio_iopoll);
 
+/*
+ * One struct iomap_dio is kept around per CPU, so that small direct I/O,
+ * which usually completes on the submitting CPU, doesn't have to go through
+ * the allocator twice for every request.
+ */
+static DEFINE_PER_CPU(struct iomap_dio *, iomap_dio_cache);
+
+static struct iomap_dio *iomap_dio_alloc(void)
+{
+	struct iomap_dio *dio = this_cpu_xchg(iomap_dio_cache, NULL);
+
+	if (dio)
+		return dio;
+	return kmalloc(sizeof(*dio), GFP_KERNEL);
+}
+
+static void iomap_dio_free(struct iomap_dio *dio)
+{
+	/* may be called from bio completion, hence the irq-safe this_cpu op */
+	if (this_cpu_cmpxchg(iomap_dio_cache, NULL, dio))
+		kfree(dio);
+}
+
+static int iomap_dio_cpu_dead(unsigned int cpu)
+{
+	kfree(xchg(per_cpu_ptr(&iomap_dio_cache, cpu), NULL));
+	return 0;
+}
+
+/*
+ * Remember which hardware queue a polled bio went to.  Queues that can't be
+ * polled complete the bio through an interrupt, leave those alone.
+ */
+static void iomap_dio_add_poll(struct iomap_dio *dio, struct request_queue *q,
+		blk_qc_t cookie)
+{
+	unsigned int i;
+
+	if (!blk_qc_t_valid(cookie) ||
+	    !test_bit(QUEUE_FLAG_POLL, &q->queue_flags))
+		return;
+
+	for (i = 0; i < dio->submit.nr_poll; i++) {
+		struct iomap_dio_poll *p = &dio->submit.poll[i];
+
+		if (p->queue == q && blk_qc_t_to_queue_num(p->cookie) ==
+				     blk_qc_t_to_queue_num(cookie)) {
+			p->cookie = cookie;
+			return;
+		}
+	}
+	if (WARN_ON_ONCE(i >= dio->submit.max_poll))
+		return;
+	dio->submit.poll[i].queue = q;
+	dio->submit.poll[i].cookie = cookie;
+	dio->submit.nr_poll++;
+}
+
 static void iomap_dio_submit_bio(struct iomap_dio *dio, struct iomap *iomap,
 		struct bio *bio, loff_t pos)
 {
+	bool polled = false;
+	blk_qc_t cookie;
+
 	atomic_inc(&dio->ref);
 
-	if (dio->iocb->ki_flags & IOCB_HIPRI)
+	/*
+	 * A bio can land on a hardware queue not seen before, so only poll it
+	 * if there is still room to record one more.
+	 */
+	if ((dio->iocb->ki_flags & IOCB_HIPRI) &&
+	    dio->submit.nr_poll < dio->submit.max_poll) {
 		bio_set_polled(bio, dio->iocb);
+		polled = true;
+	}
 
-	dio->submit.last_queue = bdev_get_queue(iomap->bdev);
 	if (dio->dops && dio->dops->submit_io)
-		dio->submit.cookie = dio->dops->submit_io(
-				file_inode(dio->iocb->ki_filp),
+		cookie = dio->dops->submit_io(file_inode(dio->iocb->ki_filp),
 				iomap, bio, pos);
 	else
-		dio->submit.cookie = submit_bio(bio);
+		cookie = submit_bio(bio);
+
+	if (polled)
+		iomap_dio_add_poll(dio, bdev_get_queue(iomap->bdev), cookie);
+}
+
+/*
+ * Poll every hardware queue the dio has bios on until the dio completes.
+ * With a single queue blk_poll() can spin by itself, otherwise we poll them
+ * in turn without spinning so that we get to look at all of them.  Polled
+ * bios never raise an interrupt, so we must not go to sleep while any are
+ * outstanding: only give up the CPU once a reschedule is due, in
+ * TASK_RUNNING so the caller's blk_io_schedule() comes straight back.
+ * The non-spinning blk_poll() always leaves us in TASK_RUNNING, after which
+ * it reports success for any queue, so only the waiter tells us the dio has
+ * completed.
+ */
+static bool iomap_dio_poll(struct iomap_dio *dio)
+{
+	unsigned int i;
+
+	if (!dio->submit.nr_poll)
+		return false;
+	if (dio->submit.nr_poll == 1)
+		return blk_poll(dio->submit.poll[0].queue,
+				dio->submit.poll[0].cookie, true);
+
+	do {
+		for (i = 0; i < dio->submit.nr_poll; i++) {
+			struct iomap_dio_poll *p = &dio->submit.poll[i];
+
+			blk_poll(p->queue, p->cookie, false);
+		}
+		if (!READ_ONCE(dio->submit.waiter))
+			return true;
+		cpu_relax();
+	} while (!need_resched());
+
+	__set_current_state(TASK_RUNNING);
+	return false;
 }
 
 ssize_t iomap_dio_complete(struct iomap_dio *dio)
@@ -126,7 +246,7 @@ ssize_t iomap_dio_complete(struct iomap_dio *dio)
 	if (ret > 0 && (dio->flags & IOMAP_DIO_NEED_SYNC))
 		ret = generic_write_sync(iocb, ret);
 
-	kfree(dio);
+	iomap_dio_free(dio);
 
 	return ret;
 }
@@ -437,7 +557,7 @@ __iomap_dio_rw(struct kiocb *iocb, struct iov_iter *iter,
 	if (WARN_ON(is_sync_kiocb(iocb) && !wait_for_completion))
 		return ERR_PTR(-EIO);
 
-	dio = kmalloc(sizeof(*dio), GFP_KERNEL);
+	dio = iomap_dio_alloc();
 	if (!dio)
 		return ERR_PTR(-ENOMEM);
 
@@ -451,8 +571,9 @@ __iomap_dio_rw(struct kiocb *iocb, struct iov_iter *iter,
 
 	dio->submit.iter = iter;
 	dio->submit.waiter = current;
-	dio->submit.cookie = BLK_QC_T_NONE;
-	dio->submit.last_queue = NULL;
+	dio->submit.nr_poll = 0;
+	/* ->iopoll only knows about a single queue */
+	dio->submit.max_poll = wait_for_completion ? IOMAP_DIO_POLL_QUEUES : 1;
 
 	if (iov_iter_rw(iter) == READ) {
 		if (pos >= dio->i_size)
@@ -548,8 +669,13 @@ __iomap_dio_rw(struct kiocb *iocb, struct iov_iter *iter,
 	if (dio->flags & IOMAP_DIO_WRITE_FUA)
 		dio->flags &= ~IOMAP_DIO_NEED_SYNC;
 
-	WRITE_ONCE(iocb->ki_cookie, dio->submit.cookie);
-	WRITE_ONCE(iocb->private, dio->submit.last_queue);
+	if (dio->submit.nr_poll) {
+		WRITE_ONCE(iocb->ki_cookie, dio->submit.poll[0].cookie);
+		WRITE_ONCE(iocb->private, dio->submit.poll[0].queue);
+	} else {
+		WRITE_ONCE(iocb->ki_cookie, BLK_QC_T_NONE);
+		WRITE_ONCE(iocb->private, NULL);
+	}
 
 	/*
 	 * We are about to drop our additional submission reference, which
@@ -577,9 +703,7 @@ __iomap_dio_rw(struct kiocb *iocb, struct iov_iter *iter,
 				break;
 
 			if (!(iocb->ki_flags & IOCB_HIPRI) ||
-			    !dio->submit.last_queue ||
-			    !blk_poll(dio->submit.last_queue,
-					 dio->submit.cookie, true))
+			    !iomap_dio_poll(dio))
 				blk_io_schedule();
 		}
 		__set_current_state(TASK_RUNNING);
@@ -588,7 +712,7 @@ __iomap_dio_rw(struct kiocb *iocb, struct iov_iter *iter,
 	return dio;
 
 out_free_dio:
-	kfree(dio);
+	iomap_dio_free(dio);
 	if (ret)
 		return ERR_PTR(ret);
 	return NULL;
@@ -608,3 +732,13 @@ iomap_dio_rw(struct kiocb *iocb, struct iov_iter *iter,
 	return iomap_dio_complete(dio);
 }
 EXPORT_SYMBOL_GPL(iomap_dio_rw);
+
+static int __init iomap_dio_init(void)
+{
+	int ret;
+
+	ret = cpuhp_setup_state_nocalls(CPUHP_BP_PREPARE_DYN, "fs/iomap:dead",
+					NULL, iomap_dio_cpu_dead);
+	return ret < 0 ? ret : 0;
+}
+fs_initcall(iomap_dio_init);
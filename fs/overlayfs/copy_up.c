@@ -18,9 +18,16 @@
 #include <linux/fdtable.h>
 #include <linux/ratelimit.h>
 #include <linux/exportfs.h>
+#include <linux/mount.h>
+#include <linux/wait_bit.h>
+#include <linux/workqueue.h>
 #include "overlayfs.h"
 
-#define OVL_COPY_UP_CHUNK_SIZE (1 << 20)
+#define OVL_COPY_UP_CHUNK_SHIFT 20
+#define OVL_COPY_UP_CHUNK_SIZE (1 << OVL_COPY_UP_CHUNK_SHIFT)
+
+/* Smaller files are not worth the bookkeeping of a lazy copy up */
+#define OVL_LAZY_COPY_UP_MIN_SIZE (64 * OVL_COPY_UP_CHUNK_SIZE)
 
 static int ovl_ccup_set(const char *buf, const struct kernel_param *param)
 {
@@ -36,6 +43,11 @@ static int ovl_ccup_get(char *buf, const struct kernel_param *param)
 module_param_call(check_copy_up, ovl_ccup_set, ovl_ccup_get, NULL, 0644);
 MODULE_PARM_DESC(check_copy_up, "Obsolete; does nothing");
 
+static bool ovl_lazy_copy_up_def;
+module_param_named(lazy_copy_up, ovl_lazy_copy_up_def, bool, 0644);
+MODULE_PARM_DESC(lazy_copy_up,
+		 "Lazily copy up data of large files (needs metacopy)");
+
 static bool ovl_must_copy_xattr(const char *name)
 {
 	return !strcmp(name, XATTR_POSIX_ACL_ACCESS) ||
@@ -861,8 +873,650 @@ static int ovl_copy_up_meta_inode_data(struct ovl_copy_up_ctx *c)
 	return err;
 }
 
+/*
+ * Lazy data copy up.
+ *
+ * With metacopy enabled, the data of a large file that is opened write-only
+ * is not copied up before the open returns.  The upper file stays a metacopy
+ * file and its data is copied up chunk by chunk by a background work item.
+ * Writes first copy up the chunks they touch, reads are served from upper
+ * for chunks that were copied up and from lower for the rest, and anything
+ * that needs all of the upper data waits for the copy up to finish.  When
+ * it does, the metacopy xattr is removed as in ovl_copy_up_meta_inode_data().
+ *
+ * Until then the data written to upper is only reachable through the overlay
+ * inode, so that is kept in memory.  If the copy up fails, fsync() and
+ * syncfs() get the error, and writes, syncfs() and unmount try it again.
+ */
+enum ovl_lazy_copy_state {
+	OVL_LAZY_RUNNING,	/* work is queued or running */
+	OVL_LAZY_DONE,		/* all data copied up, OVL_UPPERDATA is set */
+	OVL_LAZY_WRITTEN,	/* upper was written through the overlay */
+};
+
+struct ovl_lazy_copy {
+	struct inode *inode;
+	struct list_head list;		/* on ofs->lazy_list until done */
+	/* Released once done, see ovl_lazy_copy_put_data() */
+	refcount_t data_count;
+	struct file *lowerfile;
+	struct file *upperfile;
+	unsigned long *copied;		/* chunks that were copied up */
+	loff_t size;			/* size of the lower data */
+	unsigned long nchunks;
+	struct mutex lock;		/* serializes copy up of chunks */
+	/* Held shared by writes to upper, see ovl_lazy_copy_up_write_begin() */
+	struct rw_semaphore write_sem;
+	struct work_struct work;
+	wait_queue_head_t waitq;
+	char *capability;
+	ssize_t cap_size;
+	unsigned long state;
+	refcount_t count;
+	int err;
+};
+
+static bool ovl_lazy_copy_up_possible(struct dentry *dentry,
+				      struct kstat *stat, int flags)
+{
+	struct ovl_fs *ofs = OVL_FS(dentry->d_sb);
+
+	if (!ovl_lazy_copy_up_def || !ofs->config.metacopy)
+		return false;
+
+	if (!S_ISREG(stat->mode) || (flags & O_TRUNC))
+		return false;
+
+	/* Would have to wait at open anyway, see ovl_lazy_copy_up_open() */
+	if ((flags & O_ACCMODE) == O_RDWR)
+		return false;
+
+	return stat->size >= OVL_LAZY_COPY_UP_MIN_SIZE;
+}
+
+static struct ovl_lazy_copy *ovl_lazy_copy(struct inode *inode)
+{
+	/* Pairs with smp_store_release() in ovl_lazy_copy_up_start() */
+	return smp_load_acquire(&OVL_I(inode)->lazy);
+}
+
+bool ovl_lazy_copy_up_pending(struct inode *inode)
+{
+	struct ovl_lazy_copy *lc = ovl_lazy_copy(inode);
+
+	if (!lc)
+		return false;
+	if (!test_bit(OVL_LAZY_DONE, &lc->state))
+		return true;
+
+	/* Pairs with smp_mb__before_atomic() in ovl_lazy_copy_finish() */
+	smp_rmb();
+	return false;
+}
+
+static bool ovl_lazy_chunk_copied(struct ovl_lazy_copy *lc, unsigned long idx)
+{
+	if (!test_bit(idx, lc->copied))
+		return false;
+
+	/* Pairs with smp_mb__before_atomic() in ovl_lazy_copy_chunk() */
+	smp_rmb();
+	return true;
+}
+
+static void ovl_lazy_copy_free_data(struct ovl_lazy_copy *lc)
+{
+	if (lc->upperfile)
+		fput(lc->upperfile);
+	if (lc->lowerfile)
+		fput(lc->lowerfile);
+	kvfree(lc->copied);
+	lc->upperfile = lc->lowerfile = NULL;
+	lc->copied = NULL;
+}
+
+/*
+ * The lower and upper files and the bitmap of copied chunks are only needed
+ * while the copy up is pending.  The work drops the initial reference once
+ * it is done, readers take one to use them without locking.  Writers don't
+ * need one, the copy up is not done while they hold lc->write_sem.
+ */
+static void ovl_lazy_copy_put_data(struct ovl_lazy_copy *lc)
+{
+	if (refcount_dec_and_test(&lc->data_count))
+		ovl_lazy_copy_free_data(lc);
+}
+
+/* Fails once the copy up of @inode, if any, is done */
+bool ovl_lazy_copy_up_get_data(struct inode *inode)
+{
+	struct ovl_lazy_copy *lc = ovl_lazy_copy(inode);
+
+	return lc && refcount_inc_not_zero(&lc->data_count);
+}
+
+void ovl_lazy_copy_up_put_data(struct inode *inode)
+{
+	ovl_lazy_copy_put_data(ovl_lazy_copy(inode));
+}
+
+static void ovl_lazy_copy_put(struct ovl_lazy_copy *lc)
+{
+	if (!refcount_dec_and_test(&lc->count))
+		return;
+
+	/* Not done, or no reader is left to drop data_count */
+	ovl_lazy_copy_free_data(lc);
+	kfree(lc->capability);
+	mutex_destroy(&lc->lock);
+	kfree(lc);
+}
+
+/* Copy up one chunk, unless it was copied up already.  Needs mounter creds. */
+static int ovl_lazy_copy_chunk(struct ovl_lazy_copy *lc, unsigned long idx)
+{
+	struct vfsmount *upper_mnt = ovl_upper_mnt(OVL_FS(lc->inode->i_sb));
+	loff_t pos = (loff_t)idx << OVL_COPY_UP_CHUNK_SHIFT;
+	loff_t end = min_t(loff_t, pos + OVL_COPY_UP_CHUNK_SIZE, lc->size);
+	loff_t data_pos, new_pos;
+	long bytes;
+	int err;
+
+	if (ovl_lazy_chunk_copied(lc, idx))
+		return 0;
+
+	err = mnt_want_write(upper_mnt);
+	if (err)
+		return err;
+
+	mutex_lock(&lc->lock);
+	if (test_bit(idx, lc->copied))
+		goto out;
+
+	/* Leave holes in lower as holes in upper, see ovl_copy_up_data() */
+	data_pos = vfs_llseek(lc->lowerfile, pos, SEEK_DATA);
+	if (data_pos == -ENXIO || data_pos >= end)
+		pos = end;
+	else if (data_pos > pos)
+		pos = data_pos;
+
+	new_pos = pos;
+	while (pos < end) {
+		bytes = do_splice_direct(lc->lowerfile, &pos,
+					 lc->upperfile, &new_pos,
+					 end - pos, SPLICE_F_MOVE);
+		if (bytes <= 0) {
+			err = bytes ?: -EIO;
+			break;
+		}
+	}
+
+	if (!err) {
+		smp_mb__before_atomic();
+		set_bit(idx, lc->copied);
+	}
+out:
+	mutex_unlock(&lc->lock);
+	mnt_drop_write(upper_mnt);
+
+	return err;
+}
+
+/*
+ * All data is in upper, turn it into a regular upper file.  Takes write_sem
+ * to serialize against ovl_write_iter(): a write either sees the copy up
+ * pending and sets OVL_LAZY_WRITTEN before we test it, or sees it done.
+ *
+ * Not the inode lock: truncate and O_TRUNC open wait for the copy up with
+ * it held.
+ */
+static int ovl_lazy_copy_finish(struct ovl_lazy_copy *lc)
+{
+	struct inode *inode = lc->inode;
+	struct ovl_fs *ofs = OVL_FS(inode->i_sb);
+	struct dentry *upperdentry = ovl_i_dentry_upper(inode);
+	int err;
+
+	down_write(&lc->write_sem);
+	err = mnt_want_write(ovl_upper_mnt(ofs));
+	if (err)
+		goto out_unlock;
+
+	ovl_inode_lock(inode);
+	if (ovl_should_sync(ofs))
+		err = vfs_fsync(lc->upperfile, 0);
+
+	/*
+	 * Copying up data cleared security.capability, put it back unless it
+	 * was written through the overlay, which would have cleared it too.
+	 */
+	if (!err && lc->capability &&
+	    !test_bit(OVL_LAZY_WRITTEN, &lc->state))
+		err = vfs_setxattr(upperdentry, XATTR_NAME_CAPS,
+				   lc->capability, lc->cap_size, 0);
+	if (!err)
+		err = ovl_do_removexattr(ofs, upperdentry, OVL_XATTR_METACOPY);
+	if (!err) {
+		ovl_set_upperdata(inode);
+		/* OVL_UPPERDATA must be seen set by whoever sees DONE */
+		smp_mb__before_atomic();
+		set_bit(OVL_LAZY_DONE, &lc->state);
+	}
+	ovl_inode_unlock(inode);
+	mnt_drop_write(ovl_upper_mnt(ofs));
+out_unlock:
+	up_write(&lc->write_sem);
+
+	return err;
+}
+
+/*
+ * Until its data is all in upper, the inode of a lazy copy up is kept in
+ * memory: the data written to upper is only reachable through it.
+ */
+static void ovl_lazy_copy_unpin(struct ovl_lazy_copy *lc)
+{
+	struct ovl_fs *ofs = OVL_FS(lc->inode->i_sb);
+	bool pinned;
+
+	spin_lock(&ofs->lazy_lock);
+	pinned = !list_empty(&lc->list);
+	list_del_init(&lc->list);
+	spin_unlock(&ofs->lazy_lock);
+
+	if (pinned)
+		iput(lc->inode);
+}
+
+static void ovl_lazy_copy_work(struct work_struct *work)
+{
+	struct ovl_lazy_copy *lc = container_of(work, struct ovl_lazy_copy,
+						work);
+	struct inode *inode = lc->inode;
+	struct ovl_fs *ofs = OVL_FS(inode->i_sb);
+	const struct cred *old_cred;
+	unsigned long idx;
+	int err = 0;
+
+	/* Requeued while finishing the copy up, see ovl_lazy_copy_queue() */
+	if (test_bit(OVL_LAZY_DONE, &lc->state))
+		goto out;
+
+	old_cred = ovl_override_creds(inode->i_sb);
+	for (idx = 0; !err && idx < lc->nchunks; idx++) {
+		err = ovl_lazy_copy_chunk(lc, idx);
+		cond_resched();
+	}
+	if (!err)
+		err = ovl_lazy_copy_finish(lc);
+	revert_creds(old_cred);
+
+	/* Report to fsync() and syncfs() that written data is not stable */
+	if (err) {
+		pr_warn_ratelimited("lazy copy up of inode %lu failed (%i)\n",
+				    inode->i_ino, err);
+		mapping_set_error(inode->i_mapping, err);
+	} else {
+		ovl_lazy_copy_put_data(lc);
+		ovl_lazy_copy_unpin(lc);
+	}
+	WRITE_ONCE(lc->err, err);
+out:
+	smp_mb__before_atomic();
+	clear_bit(OVL_LAZY_RUNNING, &lc->state);
+	wake_up_all(&lc->waitq);
+
+	iput(inode);
+	ovl_lazy_copy_put(lc);
+	if (atomic_dec_and_test(&ofs->lazy_copies))
+		wake_up_var(&ofs->lazy_copies);
+}
+
+/* Caller holds a reference to lc->inode */
+static void ovl_lazy_copy_queue(struct ovl_lazy_copy *lc)
+{
+	struct ovl_fs *ofs = OVL_FS(lc->inode->i_sb);
+
+	if (test_bit(OVL_LAZY_DONE, &lc->state) ||
+	    test_and_set_bit(OVL_LAZY_RUNNING, &lc->state))
+		return;
+
+	/* Dropped by ovl_lazy_copy_work() */
+	ihold(lc->inode);
+	refcount_inc(&lc->count);
+	atomic_inc(&ofs->lazy_copies);
+	queue_work(system_unbound_wq, &lc->work);
+}
+
+/*
+ * Start a lazy copy up of the data of a file that was just copied up
+ * metadata only.  Called with ovl_inode->lock held.
+ */
+static int ovl_lazy_copy_up_start(struct ovl_copy_up_ctx *c)
+{
+	struct inode *inode = d_inode(c->dentry);
+	struct ovl_fs *ofs = OVL_FS(inode->i_sb);
+	struct path upperpath, datapath;
+	struct ovl_lazy_copy *lc;
+	int err;
+
+	ovl_path_upper(c->dentry, &upperpath);
+	if (WARN_ON(upperpath.dentry == NULL))
+		return -EIO;
+
+	ovl_path_lowerdata(c->dentry, &datapath);
+	if (WARN_ON(datapath.dentry == NULL))
+		return -EIO;
+
+	lc = kzalloc(sizeof(*lc), GFP_KERNEL);
+	if (!lc)
+		return -ENOMEM;
+
+	lc->inode = inode;
+	INIT_LIST_HEAD(&lc->list);
+	lc->size = c->stat.size;
+	lc->nchunks = DIV_ROUND_UP(lc->size, OVL_COPY_UP_CHUNK_SIZE);
+	mutex_init(&lc->lock);
+	init_rwsem(&lc->write_sem);
+	INIT_WORK(&lc->work, ovl_lazy_copy_work);
+	init_waitqueue_head(&lc->waitq);
+	refcount_set(&lc->count, 1);
+	refcount_set(&lc->data_count, 1);
+
+	err = -ENOMEM;
+	lc->copied = kvcalloc(BITS_TO_LONGS(lc->nchunks), sizeof(long),
+			      GFP_KERNEL);
+	if (!lc->copied)
+		goto out_free;
+
+	err = lc->cap_size = ovl_getxattr(upperpath.dentry, XATTR_NAME_CAPS,
+					  &lc->capability);
+	if (lc->cap_size < 0)
+		goto out_free;
+
+	lc->lowerfile = ovl_path_open(&datapath, O_LARGEFILE | O_RDONLY);
+	if (IS_ERR(lc->lowerfile)) {
+		err = PTR_ERR(lc->lowerfile);
+		goto out_free;
+	}
+
+	lc->upperfile = ovl_path_open(&upperpath, O_LARGEFILE | O_RDWR);
+	if (IS_ERR(lc->upperfile)) {
+		err = PTR_ERR(lc->upperfile);
+		fput(lc->lowerfile);
+		goto out_free;
+	}
+
+	/* Dropped by ovl_lazy_copy_unpin() */
+	ihold(inode);
+	spin_lock(&ofs->lazy_lock);
+	list_add_tail(&lc->list, &ofs->lazy_list);
+	spin_unlock(&ofs->lazy_lock);
+
+	/* Dropped by ovl_lazy_copy_up_free() */
+	smp_store_release(&OVL_I(inode)->lazy, lc);
+	ovl_lazy_copy_queue(lc);
+
+	return 0;
+
+out_free:
+	kfree(lc->capability);
+	kvfree(lc->copied);
+	mutex_destroy(&lc->lock);
+	kfree(lc);
+	return err;
+}
+
+/*
+ * Wait for the lazy copy up of @inode, if any, to finish.  If it failed,
+ * try once more, as the error may have been transient.
+ */
+int ovl_lazy_copy_up_wait(struct inode *inode)
+{
+	struct ovl_lazy_copy *lc = ovl_lazy_copy(inode);
+	bool retried = false;
+	int err;
+
+	if (!lc)
+		return 0;
+
+	for (;;) {
+		err = wait_event_killable(lc->waitq,
+				!test_bit(OVL_LAZY_RUNNING, &lc->state));
+		if (err)
+			return err;
+
+		if (test_bit(OVL_LAZY_DONE, &lc->state))
+			return 0;
+
+		if (retried)
+			return READ_ONCE(lc->err);
+
+		ovl_lazy_copy_queue(lc);
+		retried = true;
+	}
+}
+
+/*
+ * A mapping can only be backed by one real file, and while the copy up is
+ * pending lower lacks the data written through the overlay and upper the
+ * data that was not copied yet.  Waiting for the copy up under mmap_lock
+ * could deadlock against a write faulting in its buffer while it holds off
+ * the copy up finishing, so wait on open instead if the file can be mmapped
+ * (it is open for read) and its mapping would need upper data: a shared
+ * writable mapping needs it, and so does any mapping once upper was written
+ * to.  Files open for read only otherwise map lower, like before a copy up.
+ */
+int ovl_lazy_copy_up_open(struct inode *inode, fmode_t mode)
+{
+	struct ovl_lazy_copy *lc = ovl_lazy_copy(inode);
+
+	if (!lc || !(mode & FMODE_READ))
+		return 0;
+
+	if (!(mode & FMODE_WRITE) && !test_bit(OVL_LAZY_WRITTEN, &lc->state))
+		return 0;
+
+	return ovl_lazy_copy_up_wait(inode);
+}
+
+/* Retry the lazy copy up of @inode if it failed, without waiting for it */
+void ovl_lazy_copy_up_kick(struct inode *inode)
+{
+	struct ovl_lazy_copy *lc = ovl_lazy_copy(inode);
+
+	if (lc && !test_bit(OVL_LAZY_DONE, &lc->state))
+		ovl_lazy_copy_queue(lc);
+}
+
+/* Restart all lazy copy ups on @ofs that are not done and not running */
+static void ovl_lazy_copy_up_retry_all(struct ovl_fs *ofs)
+{
+	struct ovl_lazy_copy *lc;
+
+	spin_lock(&ofs->lazy_lock);
+	list_for_each_entry(lc, &ofs->lazy_list, list)
+		ovl_lazy_copy_queue(lc);
+	spin_unlock(&ofs->lazy_lock);
+}
+
+/* The error of a lazy copy up on @ofs that failed, if any */
+static int ovl_lazy_copy_up_error(struct ovl_fs *ofs)
+{
+	struct ovl_lazy_copy *lc;
+	int err = 0;
+
+	spin_lock(&ofs->lazy_lock);
+	list_for_each_entry(lc, &ofs->lazy_list, list) {
+		err = READ_ONCE(lc->err);
+		if (err)
+			break;
+	}
+	spin_unlock(&ofs->lazy_lock);
+
+	return err;
+}
+
+/*
+ * Make all data written to @ofs so far stable in upper: retry failed lazy
+ * copy ups and wait for all of them.  Returns the error of one that still
+ * failed, or -EINTR if killed while waiting.
+ */
+int ovl_lazy_copy_up_sync(struct ovl_fs *ofs)
+{
+	int err;
+
+	ovl_lazy_copy_up_retry_all(ofs);
+	err = wait_var_event_killable(&ofs->lazy_copies,
+				      !atomic_read(&ofs->lazy_copies));
+	if (err)
+		return err;
+
+	return ovl_lazy_copy_up_error(ofs);
+}
+
+/*
+ * On unmount, finish all lazy copy ups, trying failed ones once more, and
+ * drop their inode references.  Data written to a file whose copy up still
+ * fails is lost then, so say so loudly.
+ */
+void ovl_lazy_copy_up_shutdown(struct ovl_fs *ofs)
+{
+	struct ovl_lazy_copy *lc;
+
+	ovl_lazy_copy_up_retry_all(ofs);
+	wait_var_event(&ofs->lazy_copies, !atomic_read(&ofs->lazy_copies));
+
+	spin_lock(&ofs->lazy_lock);
+	while (!list_empty(&ofs->lazy_list)) {
+		lc = list_first_entry(&ofs->lazy_list, struct ovl_lazy_copy,
+				      list);
+		list_del_init(&lc->list);
+		spin_unlock(&ofs->lazy_lock);
+
+		pr_err("lazy copy up of inode %lu failed (%i), data written to it is lost\n",
+		       lc->inode->i_ino, READ_ONCE(lc->err));
+		iput(lc->inode);
+
+		spin_lock(&ofs->lazy_lock);
+	}
+	spin_unlock(&ofs->lazy_lock);
+}
+
+/*
+ * A write to a file whose copy up is pending holds off finishing the copy up
+ * until the data is written to upper.  Returns true, with lc->write_sem held
+ * for ovl_lazy_copy_up_write_end() to release, if the copy up is still
+ * pending.  Called with inode lock.
+ */
+bool ovl_lazy_copy_up_write_begin(struct inode *inode)
+{
+	struct ovl_lazy_copy *lc = ovl_lazy_copy(inode);
+
+	if (!ovl_lazy_copy_up_pending(inode))
+		return false;
+
+	down_read(&lc->write_sem);
+	if (ovl_lazy_copy_up_pending(inode))
+		return true;
+
+	up_read(&lc->write_sem);
+	return false;
+}
+
+void ovl_lazy_copy_up_write_end(struct inode *inode)
+{
+	up_read(&ovl_lazy_copy(inode)->write_sem);
+}
+
+/*
+ * Before a write of @len bytes at @pos, copy up the chunks of lower data
+ * that it overlaps.  If the background copy up has failed, start it again:
+ * the write itself only fails if copying up its own chunks does.  Called
+ * between ovl_lazy_copy_up_write_begin() and ovl_lazy_copy_up_write_end(),
+ * with mounter creds.
+ */
+int ovl_lazy_copy_up_range(struct inode *inode, loff_t pos, size_t len)
+{
+	struct ovl_lazy_copy *lc = ovl_lazy_copy(inode);
+	unsigned long idx, last;
+	int err;
+
+	if (READ_ONCE(lc->err))
+		ovl_lazy_copy_up_kick(inode);
+
+	set_bit(OVL_LAZY_WRITTEN, &lc->state);
+	if (!len || pos >= lc->size)
+		return 0;
+
+	last = (min_t(loff_t, pos + len, lc->size) - 1) >>
+		OVL_COPY_UP_CHUNK_SHIFT;
+	for (idx = pos >> OVL_COPY_UP_CHUNK_SHIFT; idx <= last; idx++) {
+		err = ovl_lazy_copy_chunk(lc, idx);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/*
+ * Read from a file whose data is being copied up lazily, from upper for the
+ * chunks that were copied up and from lower for the rest.  Beyond the end of
+ * the lower data there is only upper.  Called with mounter creds and a
+ * reference from ovl_lazy_copy_up_get_data().
+ */
+ssize_t ovl_lazy_copy_up_read(struct inode *inode, struct iov_iter *iter,
+			      loff_t *ppos, rwf_t flags)
+{
+	struct ovl_lazy_copy *lc = ovl_lazy_copy(inode);
+	ssize_t ret = 0;
+
+	while (iov_iter_count(iter)) {
+		size_t left = iov_iter_count(iter);
+		size_t len = left;
+		loff_t pos = *ppos;
+		struct file *realfile = lc->upperfile;
+		ssize_t bytes;
+
+		if (pos < lc->size) {
+			unsigned long idx = pos >> OVL_COPY_UP_CHUNK_SHIFT;
+			loff_t end;
+
+			end = (loff_t)(idx + 1) << OVL_COPY_UP_CHUNK_SHIFT;
+			len = min_t(loff_t, len, min(end, lc->size) - pos);
+			if (!ovl_lazy_chunk_copied(lc, idx))
+				realfile = lc->lowerfile;
+		}
+
+		iov_iter_truncate(iter, len);
+		bytes = vfs_iter_read(realfile, iter, ppos, flags);
+		iov_iter_reexpand(iter, left - max_t(ssize_t, bytes, 0));
+		if (bytes <= 0) {
+			if (!ret)
+				ret = bytes;
+			break;
+		}
+
+		ret += bytes;
+		if (bytes < len)
+			break;
+	}
+
+	return ret;
+}
+
+void ovl_lazy_copy_up_free(struct inode *inode)
+{
+	struct ovl_lazy_copy *lc = OVL_I(inode)->lazy;
+
+	/* Unfinished ones were reported by ovl_lazy_copy_up_shutdown() */
+	if (lc)
+		ovl_lazy_copy_put(lc);
+}
+
 static int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
-			   int flags)
+			   int flags, bool lazy)
 {
 	int err;
 	DEFINE_DELAYED_CALL(done);
@@ -882,7 +1536,10 @@ static int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
 	if (err)
 		return err;
 
-	ctx.metacopy = ovl_need_meta_copy_up(dentry, ctx.stat.mode, flags);
+	if (lazy)
+		lazy = ovl_lazy_copy_up_possible(dentry, &ctx.stat, flags);
+	ctx.metacopy = lazy ||
+		       ovl_need_meta_copy_up(dentry, ctx.stat.mode, flags);
 
 	if (parent) {
 		ovl_path_upper(parent, &parentpath);
@@ -916,8 +1573,16 @@ static int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
 			err = ovl_do_copy_up(&ctx);
 		if (!err && parent && !ovl_dentry_has_upper_alias(dentry))
 			err = ovl_link_up(&ctx);
-		if (!err && ovl_dentry_needs_data_copy_up_locked(dentry, flags))
-			err = ovl_copy_up_meta_inode_data(&ctx);
+		if (!err &&
+		    ovl_dentry_needs_data_copy_up_locked(dentry, flags)) {
+			/* Raced with lazy copy up, ovl_copy_up_flags() waits */
+			if (ovl_lazy_copy_up_pending(d_inode(dentry)))
+				err = 0;
+			else if (lazy)
+				err = ovl_lazy_copy_up_start(&ctx);
+			else
+				err = ovl_copy_up_meta_inode_data(&ctx);
+		}
 		ovl_copy_up_end(dentry);
 	}
 	do_delayed_call(&done);
@@ -925,7 +1590,7 @@ static int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
 	return err;
 }
 
-static int ovl_copy_up_flags(struct dentry *dentry, int flags)
+static int ovl_copy_up_flags(struct dentry *dentry, int flags, bool lazy)
 {
 	int err = 0;
 	const struct cred *old_cred;
@@ -947,6 +1612,14 @@ static int ovl_copy_up_flags(struct dentry *dentry, int flags)
 		if (ovl_already_copied_up(dentry, flags))
 			break;
 
+		/* Either good enough or has to finish before full copy up */
+		if (ovl_lazy_copy_up_pending(d_inode(dentry))) {
+			if (lazy)
+				break;
+			err = ovl_lazy_copy_up_wait(d_inode(dentry));
+			continue;
+		}
+
 		next = dget(dentry);
 		/* find the topmost dentry not yet copied up */
 		for (; !disconnected;) {
@@ -959,7 +1632,8 @@ static int ovl_copy_up_flags(struct dentry *dentry, int flags)
 			next = parent;
 		}
 
-		err = ovl_copy_up_one(parent, next, flags);
+		err = ovl_copy_up_one(parent, next, flags,
+				      lazy && next == dentry);
 
 		dput(parent);
 		dput(next);
@@ -984,14 +1658,14 @@ static bool ovl_open_need_copy_up(struct dentry *dentry, int flags)
 	return true;
 }
 
-int ovl_maybe_copy_up(struct dentry *dentry, int flags)
+static int __ovl_maybe_copy_up(struct dentry *dentry, int flags, bool lazy)
 {
 	int err = 0;
 
 	if (ovl_open_need_copy_up(dentry, flags)) {
 		err = ovl_want_write(dentry);
 		if (!err) {
-			err = ovl_copy_up_flags(dentry, flags);
+			err = ovl_copy_up_flags(dentry, flags, lazy);
 			ovl_drop_write(dentry);
 		}
 	}
@@ -999,12 +1673,26 @@ int ovl_maybe_copy_up(struct dentry *dentry, int flags)
 	return err;
 }
 
+int ovl_maybe_copy_up(struct dentry *dentry, int flags)
+{
+	return __ovl_maybe_copy_up(dentry, flags, false);
+}
+
+/*
+ * Like ovl_maybe_copy_up(), but for open, which can cope with the data copy
+ * up still being in progress, see ovl_lazy_copy_up_start().
+ */
+int ovl_open_copy_up(struct dentry *dentry, int flags)
+{
+	return __ovl_maybe_copy_up(dentry, flags, true);
+}
+
 int ovl_copy_up_with_data(struct dentry *dentry)
 {
-	return ovl_copy_up_flags(dentry, O_WRONLY);
+	return ovl_copy_up_flags(dentry, O_WRONLY, false);
 }
 
 int ovl_copy_up(struct dentry *dentry)
 {
-	return ovl_copy_up_flags(dentry, 0);
+	return ovl_copy_up_flags(dentry, 0, false);
 }
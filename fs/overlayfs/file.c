@@ -105,6 +105,20 @@ static int ovl_change_flags(struct file *file, unsigned int flags)
 	return 0;
 }
 
+/*
+ * While data is being copied up lazily, files open for write write to the
+ * upper file, everything else reads the lower data.
+ */
+static struct inode *ovl_file_realdata(const struct file *file)
+{
+	struct inode *inode = file_inode(file);
+
+	if ((file->f_mode & FMODE_WRITE) && ovl_lazy_copy_up_pending(inode))
+		return ovl_inode_upper(inode);
+
+	return ovl_inode_realdata(inode);
+}
+
 static int ovl_real_fdget_meta(const struct file *file, struct fd *real,
 			       bool allow_meta)
 {
@@ -117,7 +131,7 @@ static int ovl_real_fdget_meta(const struct file *file, struct fd *real,
 	if (allow_meta)
 		realinode = ovl_inode_real(inode);
 	else
-		realinode = ovl_inode_realdata(inode);
+		realinode = ovl_file_realdata(file);
 
 	/* Has it been copied up since we'd opened it? */
 	if (unlikely(file_inode(real->file) != realinode)) {
@@ -151,14 +165,18 @@ static int ovl_open(struct inode *inode, struct file *file)
 	struct file *realfile;
 	int err;
 
-	err = ovl_maybe_copy_up(file_dentry(file), file->f_flags);
+	err = ovl_open_copy_up(file_dentry(file), file->f_flags);
+	if (err)
+		return err;
+
+	err = ovl_lazy_copy_up_open(inode, file->f_mode);
 	if (err)
 		return err;
 
 	/* No longer need these flags, so don't pass them on to underlying fs */
 	file->f_flags &= ~(O_CREAT | O_EXCL | O_NOCTTY | O_TRUNC);
 
-	realfile = ovl_open_realfile(file, ovl_inode_realdata(inode));
+	realfile = ovl_open_realfile(file, ovl_file_realdata(file));
 	if (IS_ERR(realfile))
 		return PTR_ERR(realfile);
 
@@ -193,6 +211,20 @@ static loff_t ovl_llseek(struct file *file, loff_t offset, int whence)
 			return vfs_setpos(file, 0, 0);
 	}
 
+	/* Only the upper file knows the size, only lower where the data is */
+	if (ovl_lazy_copy_up_pending(inode)) {
+		struct inode *upperinode = ovl_inode_upper(inode);
+
+		if (whence != SEEK_DATA && whence != SEEK_HOLE)
+			return generic_file_llseek_size(file, offset, whence,
+						upperinode->i_sb->s_maxbytes,
+						i_size_read(upperinode));
+
+		ret = ovl_lazy_copy_up_wait(inode);
+		if (ret)
+			return ret;
+	}
+
 	ret = ovl_real_fdget(file, &real);
 	if (ret)
 		return ret;
@@ -287,6 +319,22 @@ static void ovl_aio_rw_complete(struct kiocb *iocb, long res, long res2)
 	orig_iocb->ki_complete(orig_iocb, res, res2);
 }
 
+static ssize_t ovl_lazy_read_iter(struct kiocb *iocb, struct iov_iter *iter)
+{
+	struct file *file = iocb->ki_filp;
+	const struct cred *old_cred;
+	ssize_t ret;
+
+	/* Until the copy up finishes, O_DIRECT reads use the page cache too */
+	old_cred = ovl_override_creds(file_inode(file)->i_sb);
+	ret = ovl_lazy_copy_up_read(file_inode(file), iter, &iocb->ki_pos,
+				    ovl_iocb_to_rwf(iocb->ki_flags));
+	revert_creds(old_cred);
+	ovl_file_accessed(file);
+
+	return ret;
+}
+
 static ssize_t ovl_read_iter(struct kiocb *iocb, struct iov_iter *iter)
 {
 	struct file *file = iocb->ki_filp;
@@ -297,6 +345,13 @@ static ssize_t ovl_read_iter(struct kiocb *iocb, struct iov_iter *iter)
 	if (!iov_iter_count(iter))
 		return 0;
 
+	/* The lazy copy up data can go away once done, hold on to it */
+	if (ovl_lazy_copy_up_get_data(file_inode(file))) {
+		ret = ovl_lazy_read_iter(iocb, iter);
+		ovl_lazy_copy_up_put_data(file_inode(file));
+		return ret;
+	}
+
 	ret = ovl_real_fdget(file, &real);
 	if (ret)
 		return ret;
@@ -345,6 +400,7 @@ static ssize_t ovl_write_iter(struct kiocb *iocb, struct iov_iter *iter)
 	const struct cred *old_cred;
 	ssize_t ret;
 	int ifl = iocb->ki_flags;
+	bool lazy;
 
 	if (!iov_iter_count(iter))
 		return 0;
@@ -370,6 +426,17 @@ static ssize_t ovl_write_iter(struct kiocb *iocb, struct iov_iter *iter)
 		ifl &= ~(IOCB_DSYNC | IOCB_SYNC);
 
 	old_cred = ovl_override_creds(file_inode(file)->i_sb);
+	lazy = ovl_lazy_copy_up_write_begin(inode);
+	if (lazy) {
+		loff_t pos = iocb->ki_pos;
+
+		if (ifl & IOCB_APPEND)
+			pos = i_size_read(file_inode(real.file));
+		ret = ovl_lazy_copy_up_range(inode, pos, iov_iter_count(iter));
+		if (ret)
+			goto out;
+	}
+
 	if (is_sync_kiocb(iocb)) {
 		file_start_write(real.file);
 		ret = vfs_iter_write(real.file, iter, &iocb->ki_pos,
@@ -400,6 +467,8 @@ static ssize_t ovl_write_iter(struct kiocb *iocb, struct iov_iter *iter)
 			ovl_aio_cleanup_handler(aio_req);
 	}
 out:
+	if (lazy)
+		ovl_lazy_copy_up_write_end(inode);
 	revert_creds(old_cred);
 out_fdput:
 	fdput(real);
@@ -418,6 +487,10 @@ static ssize_t ovl_splice_read(struct file *in, loff_t *ppos,
 	struct fd real;
 	const struct cred *old_cred;
 
+	/* Let ovl_read_iter() pick upper or lower for each chunk */
+	if (ovl_lazy_copy_up_pending(file_inode(in)))
+		return generic_file_splice_read(in, ppos, pipe, len, flags);
+
 	ret = ovl_real_fdget(in, &real);
 	if (ret)
 		return ret;
@@ -439,6 +512,10 @@ ovl_splice_write(struct pipe_inode_info *pipe, struct file *out,
 	const struct cred *old_cred;
 	ssize_t ret;
 
+	/* Let ovl_write_iter() copy up the chunks written to */
+	if (ovl_lazy_copy_up_pending(file_inode(out)))
+		return iter_file_splice_write(pipe, out, ppos, len, flags);
+
 	ret = ovl_real_fdget(out, &real);
 	if (ret)
 		return ret;
@@ -462,6 +539,10 @@ static int ovl_fsync(struct file *file, loff_t start, loff_t end, int datasync)
 	if (ret <= 0)
 		return ret;
 
+	ret = ovl_lazy_copy_up_wait(file_inode(file));
+	if (ret)
+		return ret;
+
 	ret = ovl_real_fdget_meta(file, &real, !datasync);
 	if (ret)
 		return ret;
@@ -516,6 +597,10 @@ static long ovl_fallocate(struct file *file, int mode, loff_t offset, loff_t len
 	const struct cred *old_cred;
 	int ret;
 
+	ret = ovl_lazy_copy_up_wait(inode);
+	if (ret)
+		return ret;
+
 	ret = ovl_real_fdget(file, &real);
 	if (ret)
 		return ret;
@@ -672,6 +757,12 @@ static loff_t ovl_copyfile(struct file *file_in, loff_t pos_in,
 	const struct cred *old_cred;
 	loff_t ret;
 
+	ret = ovl_lazy_copy_up_wait(inode_out);
+	if (!ret)
+		ret = ovl_lazy_copy_up_wait(file_inode(file_in));
+	if (ret)
+		return ret;
+
 	ret = ovl_real_fdget(file_out, &real_out);
 	if (ret)
 		return ret;
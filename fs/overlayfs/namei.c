@@ -833,6 +833,7 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 	unsigned int i;
 	int err;
 	bool uppermetacopy = false;
+	bool probe_lower = false;
 	struct ovl_lookup_data d = {
 		.sb = dentry->d_sb,
 		.name = dentry->d_name,
@@ -889,6 +890,17 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 		upperopaque = d.opaque;
 	}
 
+	/*
+	 * Without an upper entry we look the name up in the lower dirs of the
+	 * parent, which may know that it has no such name.
+	 */
+	if (!upperdentry && !d.stop && poe->numlower) {
+		if (ovl_lower_names_absent(dir, &d.name))
+			d.stop = true;
+		else
+			probe_lower = true;
+	}
+
 	if (!d.stop && poe->numlower) {
 		err = -ENOMEM;
 		stack = kcalloc(ofs->numlayer - 1, sizeof(struct ovl_path),
@@ -995,6 +1007,9 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 		}
 	}
 
+	if (probe_lower && !ctr)
+		ovl_lower_names_miss(dir, OVL_E(dentry->d_parent));
+
 	/*
 	 * For regular non-metacopy upper dentries, there is no lower
 	 * path based lookup, hence ctr will be zero. If a dentry is found
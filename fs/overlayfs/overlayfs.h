@@ -434,6 +434,9 @@ int ovl_check_empty_dir(struct dentry *dentry, struct list_head *list);
 void ovl_cleanup_whiteouts(struct dentry *upper, struct list_head *list);
 void ovl_cache_free(struct list_head *list);
 void ovl_dir_cache_free(struct inode *inode);
+bool ovl_lower_names_absent(struct inode *dir, const struct qstr *name);
+void ovl_lower_names_miss(struct inode *dir, struct ovl_entry *oe);
+void ovl_lower_names_free(struct inode *inode);
 int ovl_check_d_type_supported(struct path *realpath);
 int ovl_workdir_cleanup(struct inode *dir, struct vfsmount *mnt,
 			struct dentry *dentry, int level);
@@ -536,6 +539,21 @@ long ovl_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
 int ovl_copy_up(struct dentry *dentry);
 int ovl_copy_up_with_data(struct dentry *dentry);
 int ovl_maybe_copy_up(struct dentry *dentry, int flags);
+int ovl_open_copy_up(struct dentry *dentry, int flags);
+bool ovl_lazy_copy_up_pending(struct inode *inode);
+int ovl_lazy_copy_up_wait(struct inode *inode);
+int ovl_lazy_copy_up_open(struct inode *inode, fmode_t mode);
+void ovl_lazy_copy_up_kick(struct inode *inode);
+int ovl_lazy_copy_up_sync(struct ovl_fs *ofs);
+void ovl_lazy_copy_up_shutdown(struct ovl_fs *ofs);
+bool ovl_lazy_copy_up_write_begin(struct inode *inode);
+void ovl_lazy_copy_up_write_end(struct inode *inode);
+int ovl_lazy_copy_up_range(struct inode *inode, loff_t pos, size_t len);
+bool ovl_lazy_copy_up_get_data(struct inode *inode);
+void ovl_lazy_copy_up_put_data(struct inode *inode);
+ssize_t ovl_lazy_copy_up_read(struct inode *inode, struct iov_iter *iter,
+			      loff_t *ppos, rwf_t flags);
+void ovl_lazy_copy_up_free(struct inode *inode);
 int ovl_copy_xattr(struct super_block *sb, struct dentry *old,
 		   struct dentry *new);
 int ovl_set_attr(struct dentry *upper, struct kstat *stat);
@@ -81,6 +81,11 @@ struct ovl_fs {
 	struct dentry *whiteout;
 	/* r/o snapshot of upperdir sb's only taken on volatile mounts */
 	errseq_t errseq;
+	/* Lazy data copy ups in progress, each holds an inode reference */
+	atomic_t lazy_copies;
+	/* Lazy data copy ups not done yet, each pins its inode */
+	spinlock_t lazy_lock;
+	struct list_head lazy_list;
 };
 
 static inline struct vfsmount *ovl_upper_mnt(struct ovl_fs *ofs)
@@ -129,6 +134,13 @@ struct ovl_inode {
 	struct dentry *__upperdentry;
 	struct inode *lower;
 
+	/* names in lower dirs of a merge dir, see ovl_lower_names_absent() */
+	struct ovl_lower_names *lower_names;
+	unsigned int lower_misses;
+
+	/* data copy up in progress, see ovl_lazy_copy_up_start() */
+	struct ovl_lazy_copy *lazy;
+
 	/* synchronize copy up and more */
 	struct mutex lock;
 };
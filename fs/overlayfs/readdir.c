@@ -13,6 +13,8 @@
 #include <linux/security.h>
 #include <linux/cred.h>
 #include <linux/ratelimit.h>
+#include <linux/bsearch.h>
+#include <linux/sort.h>
 #include "overlayfs.h"
 
 struct ovl_cache_entry {
@@ -1025,6 +1027,190 @@ void ovl_cleanup_whiteouts(struct dentry *upper, struct list_head *list)
 	inode_unlock(upper->d_inode);
 }
 
+/*
+ * Lower layers are immutable, so the set of names in the lower dirs of a
+ * merge dir never changes.  Once a merge dir with a few lower layers has
+ * seen some lookups miss in all of them, the hashes of all the names in its
+ * lower dirs are collected here, and lookups of any other name skip the lower
+ * layers altogether.  A hash collision only costs a real lookup.
+ */
+#define OVL_LOWER_NAMES_MIN_LAYERS	2
+#define OVL_LOWER_NAMES_MISSES		4
+#define OVL_LOWER_NAMES_MAX		65536
+
+struct ovl_lower_names {
+	unsigned int count;
+	u32 hash[];
+};
+
+struct ovl_lower_names_data {
+	struct dir_context ctx;
+	u32 *hash;
+	unsigned int count;
+	unsigned int size;
+	unsigned int added;
+	int err;
+};
+
+static u32 ovl_lower_name_hash(const char *name, unsigned int len)
+{
+	return full_name_hash(NULL, name, len);
+}
+
+static int ovl_fill_lower_names(struct dir_context *ctx, const char *name,
+				int namelen, loff_t offset, u64 ino,
+				unsigned int d_type)
+{
+	struct ovl_lower_names_data *lnd =
+		container_of(ctx, struct ovl_lower_names_data, ctx);
+
+	if (name[0] == '.' && (namelen == 1 ||
+			       (namelen == 2 && name[1] == '.')))
+		return 0;
+
+	if (lnd->count == lnd->size) {
+		unsigned int size = lnd->size ? lnd->size * 2 : 256;
+		u32 *hash;
+
+		if (size > OVL_LOWER_NAMES_MAX) {
+			lnd->err = -E2BIG;
+			return -E2BIG;
+		}
+		hash = kvmalloc_array(size, sizeof(u32), GFP_KERNEL);
+		if (!hash) {
+			lnd->err = -ENOMEM;
+			return -ENOMEM;
+		}
+		if (lnd->hash)
+			memcpy(hash, lnd->hash, lnd->count * sizeof(u32));
+		kvfree(lnd->hash);
+		lnd->hash = hash;
+		lnd->size = size;
+	}
+	lnd->hash[lnd->count++] = ovl_lower_name_hash(name, namelen);
+	lnd->added++;
+
+	return 0;
+}
+
+static int ovl_lower_names_read(struct path *realpath,
+				struct ovl_lower_names_data *lnd)
+{
+	struct file *realfile;
+	int err;
+
+	realfile = ovl_path_open(realpath, O_RDONLY | O_LARGEFILE);
+	if (IS_ERR(realfile))
+		return PTR_ERR(realfile);
+
+	lnd->ctx.pos = 0;
+	do {
+		lnd->added = 0;
+		lnd->err = 0;
+		err = iterate_dir(realfile, &lnd->ctx);
+		if (err >= 0)
+			err = lnd->err;
+	} while (!err && lnd->added);
+
+	fput(realfile);
+
+	return err;
+}
+
+static int ovl_lower_name_cmp(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static struct ovl_lower_names *ovl_lower_names_build(struct ovl_entry *oe)
+{
+	struct ovl_lower_names_data lnd = {
+		.ctx.actor = ovl_fill_lower_names,
+	};
+	struct ovl_lower_names *names = NULL;
+	unsigned int i, n;
+	int err = 0;
+
+	for (i = 0; !err && i < oe->numlower; i++) {
+		struct path realpath = {
+			.mnt = oe->lowerstack[i].layer->mnt,
+			.dentry = oe->lowerstack[i].dentry,
+		};
+
+		err = ovl_lower_names_read(&realpath, &lnd);
+	}
+	if (err)
+		goto out;
+
+	sort(lnd.hash, lnd.count, sizeof(u32), ovl_lower_name_cmp, NULL);
+	for (i = 0, n = 0; i < lnd.count; i++) {
+		if (!n || lnd.hash[i] != lnd.hash[n - 1])
+			lnd.hash[n++] = lnd.hash[i];
+	}
+
+	err = -ENOMEM;
+	names = kvmalloc(struct_size(names, hash, n), GFP_KERNEL);
+	if (!names)
+		goto out;
+
+	names->count = n;
+	memcpy(names->hash, lnd.hash, n * sizeof(u32));
+	err = 0;
+out:
+	kvfree(lnd.hash);
+
+	return err ? ERR_PTR(err) : names;
+}
+
+/*
+ * Is @name known not to exist in any lower dir of merge dir @dir?
+ */
+bool ovl_lower_names_absent(struct inode *dir, const struct qstr *name)
+{
+	struct ovl_lower_names *names = READ_ONCE(OVL_I(dir)->lower_names);
+	u32 hash;
+
+	if (IS_ERR_OR_NULL(names))
+		return false;
+
+	hash = ovl_lower_name_hash(name->name, name->len);
+	return !bsearch(&hash, names->hash, names->count, sizeof(u32),
+			ovl_lower_name_cmp);
+}
+
+/*
+ * A lookup in merge dir @dir with lower stack @oe found nothing in any lower
+ * layer.  After a few of those, collect the names of the lower dirs.  On
+ * failure, e.g. because there are too many names, don't try again.
+ */
+void ovl_lower_names_miss(struct inode *dir, struct ovl_entry *oe)
+{
+	struct ovl_inode *oi = OVL_I(dir);
+	struct ovl_lower_names *names;
+
+	if (oe->numlower < OVL_LOWER_NAMES_MIN_LAYERS ||
+	    READ_ONCE(oi->lower_names))
+		return;
+
+	/* Racy, missing a count or building twice is harmless */
+	if (++oi->lower_misses < OVL_LOWER_NAMES_MISSES)
+		return;
+
+	names = ovl_lower_names_build(oe);
+	if (cmpxchg(&oi->lower_names, NULL, names) && !IS_ERR(names))
+		kvfree(names);
+}
+
+void ovl_lower_names_free(struct inode *inode)
+{
+	struct ovl_lower_names *names = OVL_I(inode)->lower_names;
+
+	if (!IS_ERR_OR_NULL(names))
+		kvfree(names);
+}
+
 static int ovl_check_d_type(struct dir_context *ctx, const char *name,
 			  int namelen, loff_t offset, u64 ino,
 			  unsigned int d_type)
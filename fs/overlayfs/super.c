@@ -186,6 +186,9 @@ static struct inode *ovl_alloc_inode(struct super_block *sb)
 	oi->__upperdentry = NULL;
 	oi->lower = NULL;
 	oi->lowerdata = NULL;
+	oi->lower_names = NULL;
+	oi->lower_misses = 0;
+	oi->lazy = NULL;
 	mutex_init(&oi->lock);
 
 	return &oi->vfs_inode;
@@ -206,10 +209,13 @@ static void ovl_destroy_inode(struct inode *inode)
 
 	dput(oi->__upperdentry);
 	iput(oi->lower);
-	if (S_ISDIR(inode->i_mode))
+	if (S_ISDIR(inode->i_mode)) {
 		ovl_dir_cache_free(inode);
-	else
+		ovl_lower_names_free(inode);
+	} else {
 		iput(oi->lowerdata);
+		ovl_lazy_copy_up_free(inode);
+	}
 }
 
 static void ovl_free_fs(struct ovl_fs *ofs)
@@ -289,6 +295,11 @@ static int ovl_sync_fs(struct super_block *sb, int wait)
 	if (!wait)
 		return 0;
 
+	/* Lazily copied up data is not stable before the copy up finishes */
+	ret = ovl_lazy_copy_up_sync(ofs);
+	if (ret)
+		return ret;
+
 	upper_sb = ovl_upper_mnt(ofs)->mnt_sb;
 
 	down_read(&upper_sb->s_umount);
@@ -391,6 +402,9 @@ static int ovl_remount(struct super_block *sb, int *flags, char *data)
 		return -EROFS;
 
 	if (*flags & SB_RDONLY && !sb_rdonly(sb)) {
+		ret = ovl_lazy_copy_up_sync(ofs);
+		if (ret)
+			return ret;
 		upper_sb = ovl_upper_mnt(ofs)->mnt_sb;
 		if (ovl_should_sync(ofs)) {
 			down_read(&upper_sb->s_umount);
@@ -1928,6 +1942,8 @@ static int ovl_fill_super(struct super_block *sb, void *data, int silent)
 	sb->s_stack_depth = 0;
 	sb->s_maxbytes = MAX_LFS_FILESIZE;
 	atomic_long_set(&ofs->last_ino, 1);
+	spin_lock_init(&ofs->lazy_lock);
+	INIT_LIST_HEAD(&ofs->lazy_list);
 	/* Assume underlaying fs uses 32bit inodes unless proven otherwise */
 	if (ofs->config.xino != OVL_XINO_OFF) {
 		ofs->xino_mode = BITS_PER_LONG - 32;
@@ -2050,11 +2066,25 @@ static struct dentry *ovl_mount(struct file_system_type *fs_type, int flags,
 	return mount_nodev(fs_type, flags, raw_data, ovl_fill_super);
 }
 
+static void ovl_kill_sb(struct super_block *sb)
+{
+	struct ovl_fs *ofs = sb->s_fs_info;
+
+	/*
+	 * Lazy copy ups hold inode references, which must be gone by now.
+	 * Without a root, ovl_fill_super() failed and already freed ofs.
+	 */
+	if (sb->s_root)
+		ovl_lazy_copy_up_shutdown(ofs);
+
+	kill_anon_super(sb);
+}
+
 static struct file_system_type ovl_fs_type = {
 	.owner		= THIS_MODULE,
 	.name		= "overlay",
 	.mount		= ovl_mount,
-	.kill_sb	= kill_anon_super,
+	.kill_sb	= ovl_kill_sb,
 };
 MODULE_ALIAS_FS("overlay");
 
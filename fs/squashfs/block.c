@@ -73,7 +73,7 @@ static int copy_bio_to_actor(struct bio *bio,
 	return copied_bytes;
 }
 
-static int squashfs_bio_read(struct super_block *sb, u64 index, int length,
+static int squashfs_bio_init(struct super_block *sb, u64 index, int length,
 			     struct bio **biop, int *block_offset)
 {
 	struct squashfs_sb_info *msblk = sb->s_fs_info;
@@ -116,10 +116,6 @@ static int squashfs_bio_read(struct super_block *sb, u64 index, int length,
 		total_len -= len;
 	}
 
-	error = submit_bio_wait(bio);
-	if (error)
-		goto out_free_bio;
-
 	*biop = bio;
 	*block_offset = index & ((1 << msblk->devblksize_log2) - 1);
 	return 0;
@@ -130,6 +126,22 @@ static int squashfs_bio_read(struct super_block *sb, u64 index, int length,
 	return error;
 }
 
+static int squashfs_bio_read(struct super_block *sb, u64 index, int length,
+			     struct bio **biop, int *block_offset)
+{
+	int error = squashfs_bio_init(sb, index, length, biop, block_offset);
+
+	if (error)
+		return error;
+
+	error = submit_bio_wait(*biop);
+	if (error) {
+		bio_free_pages(*biop);
+		bio_put(*biop);
+	}
+	return error;
+}
+
 /*
  * Read and decompress a metadata block or datablock.  Length is non-zero
  * if a datablock is being read (the size is stored elsewhere in the
@@ -231,3 +243,114 @@ int squashfs_read_data(struct super_block *sb, u64 index, int length,
 
 	return res;
 }
+
+static void squashfs_bio_end_io(struct bio *bio)
+{
+	struct squashfs_read_request *req = bio->bi_private;
+
+	complete(&req->done);
+}
+
+/*
+ * Start reading a datablock without waiting for the I/O, so that the reads
+ * of several blocks can be in flight while earlier ones are decompressed.
+ * Length is the on-disk length of the datablock as stored in the block
+ * list.  The request must always be finished, either by
+ * squashfs_read_data_complete(), which also reports any error from here, or
+ * by squashfs_read_data_cancel().
+ */
+void squashfs_read_data_submit(struct super_block *sb, u64 index, int length,
+			       struct squashfs_read_request *req)
+{
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	int size = SQUASHFS_COMPRESSED_SIZE_BLOCK(length);
+
+	req->bio = NULL;
+	req->index = index;
+	req->length = length;
+	init_completion(&req->done);
+
+	if (size < 0 || (index + size) > msblk->bytes_used) {
+		req->error = -EIO;
+		return;
+	}
+
+	req->error = squashfs_bio_init(sb, index, size, &req->bio,
+				       &req->offset);
+	if (req->error)
+		return;
+
+	req->bio->bi_private = req;
+	req->bio->bi_end_io = squashfs_bio_end_io;
+	submit_bio(req->bio);
+}
+
+/*
+ * Wait for a datablock read started by squashfs_read_data_submit() and
+ * decompress it.  Returns the same as squashfs_read_data().
+ */
+int squashfs_read_data_complete(struct super_block *sb,
+				struct squashfs_read_request *req,
+				u64 *next_index,
+				struct squashfs_page_actor *output)
+{
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	int compressed = SQUASHFS_COMPRESSED_BLOCK(req->length);
+	int length = SQUASHFS_COMPRESSED_SIZE_BLOCK(req->length);
+	int res = req->error;
+
+	if (!req->bio)
+		goto out;
+
+	wait_for_completion_io(&req->done);
+	res = blk_status_to_errno(req->bio->bi_status);
+	if (res)
+		goto out_free_bio;
+
+	TRACE("Block @ 0x%llx, %scompressed size %d, src size %d\n",
+		req->index, compressed ? "" : "un", length, output->length);
+
+	if (length > output->length) {
+		res = -EIO;
+		goto out_free_bio;
+	}
+
+	if (next_index)
+		*next_index = req->index + length;
+
+	if (compressed) {
+		if (!msblk->stream) {
+			res = -EIO;
+			goto out_free_bio;
+		}
+		res = squashfs_decompress(msblk, req->bio, req->offset, length,
+					  output);
+	} else {
+		res = copy_bio_to_actor(req->bio, output, req->offset, length);
+	}
+
+out_free_bio:
+	bio_free_pages(req->bio);
+	bio_put(req->bio);
+	req->bio = NULL;
+out:
+	if (res < 0)
+		ERROR("Failed to read block 0x%llx: %d\n", req->index, res);
+
+	return res;
+}
+
+/*
+ * Drop a datablock read started by squashfs_read_data_submit() whose
+ * contents turned out not to be needed.
+ */
+void squashfs_read_data_cancel(struct squashfs_read_request *req)
+{
+	if (!req->bio)
+		return;
+
+	wait_for_completion_io(&req->done);
+	bio_free_pages(req->bio);
+	bio_put(req->bio);
+	req->bio = NULL;
+}
@@ -39,6 +39,9 @@
 #include <linux/spinlock.h>
 #include <linux/wait.h>
 #include <linux/pagemap.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/rculist_nulls.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -46,119 +49,189 @@
 #include "page_actor.h"
 
 /*
- * Look-up block in cache, and increment usage count.  If not in cache, read
- * and decompress it from disk.
+ * Entries are hashed on their block, and looked up without taking the
+ * cache lock.  Entries are never freed while the cache exists, they are only
+ * recycled for another block by the (locked) miss path, so a lookup takes a
+ * reference and then checks the block again.  An entry being recycled has
+ * its refcount set to -1 so no reference can be taken on it meanwhile.  The
+ * hash chains are nulls lists, a walk which ends on the nulls marker of
+ * another chain raced with an entry being moved and is restarted.
  */
-struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
-	struct squashfs_cache *cache, u64 block, int length)
+static bool squashfs_cache_entry_get(struct squashfs_cache_entry *entry)
+{
+	return atomic_fetch_add_unless(&entry->refcount, 1, -1) >= 0;
+}
+
+
+static struct squashfs_cache_entry *squashfs_cache_find(
+	struct squashfs_cache *cache, u64 block)
 {
-	int i, n;
+	unsigned int slot = hash_64(block, cache->hash_bits);
 	struct squashfs_cache_entry *entry;
+	struct hlist_nulls_node *node;
+
+	rcu_read_lock();
+begin:
+	hlist_nulls_for_each_entry_rcu(entry, node, &cache->hash[slot], hash) {
+		if (READ_ONCE(entry->block) != block ||
+				!squashfs_cache_entry_get(entry))
+			continue;
+
+		if (READ_ONCE(entry->block) != block) {
+			squashfs_cache_put(entry);
+			goto begin;
+		}
 
-	spin_lock(&cache->lock);
+		rcu_read_unlock();
+		return entry;
+	}
+	if (get_nulls_value(node) != slot)
+		goto begin;
+	rcu_read_unlock();
 
-	while (1) {
-		for (i = cache->curr_blk, n = 0; n < cache->entries; n++) {
-			if (cache->entry[i].block == block) {
-				cache->curr_blk = i;
-				break;
-			}
-			i = (i + 1) % cache->entries;
+	return NULL;
+}
+
+
+/*
+ * Choose an unused entry to be evicted from the cache, called with the
+ * cache lock held.  Eviction is LRU approximated by a clock: hits only mark
+ * the entry as referenced, and an entry which is referenced is given a
+ * second chance and moved back to the head of the LRU list.
+ */
+static struct squashfs_cache_entry *squashfs_cache_evict(
+	struct squashfs_cache *cache)
+{
+	struct squashfs_cache_entry *entry;
+	int n;
+
+	for (n = 0; n < 2 * cache->entries; n++) {
+		entry = list_last_entry(&cache->lru, struct squashfs_cache_entry,
+			lru);
+		list_move(&entry->lru, &cache->lru);
+
+		if (atomic_read(&entry->refcount))
+			continue;
+
+		if (READ_ONCE(entry->referenced)) {
+			WRITE_ONCE(entry->referenced, false);
+			continue;
 		}
 
-		if (n == cache->entries) {
-			/*
-			 * Block not in cache, if all cache entries are used
-			 * go to sleep waiting for one to become available.
-			 */
-			if (cache->unused == 0) {
-				cache->num_waiters++;
-				spin_unlock(&cache->lock);
-				wait_event(cache->wait_queue, cache->unused);
-				spin_lock(&cache->lock);
-				cache->num_waiters--;
-				continue;
-			}
+		if (atomic_cmpxchg(&entry->refcount, 0, -1) == 0)
+			return entry;
+	}
 
-			/*
-			 * At least one unused cache entry.  A simple
-			 * round-robin strategy is used to choose the entry to
-			 * be evicted from the cache.
-			 */
-			i = cache->next_blk;
-			for (n = 0; n < cache->entries; n++) {
-				if (cache->entry[i].refcount == 0)
-					break;
-				i = (i + 1) % cache->entries;
-			}
+	return NULL;
+}
 
-			cache->next_blk = (i + 1) % cache->entries;
-			entry = &cache->entry[i];
 
-			/*
-			 * Initialise chosen cache entry, and fill it in from
-			 * disk.
-			 */
-			cache->unused--;
-			entry->block = block;
-			entry->refcount = 1;
-			entry->pending = 1;
-			entry->num_waiters = 0;
-			entry->error = 0;
-			spin_unlock(&cache->lock);
+static bool squashfs_cache_unused(struct squashfs_cache *cache)
+{
+	int i;
 
-			entry->length = squashfs_read_data(sb, block, length,
-				&entry->next_index, entry->actor);
+	for (i = 0; i < cache->entries; i++)
+		if (atomic_read(&cache->entry[i].refcount) == 0)
+			return true;
 
-			spin_lock(&cache->lock);
+	return false;
+}
 
-			if (entry->length < 0)
-				entry->error = entry->length;
 
-			entry->pending = 0;
+/*
+ * Look-up block in cache, and increment usage count.  If not in cache, read
+ * and decompress it from disk, or from the read already started in req if
+ * there is one.  Req is always finished before returning.
+ */
+static struct squashfs_cache_entry *squashfs_cache_lookup(
+	struct super_block *sb, struct squashfs_cache *cache, u64 block,
+	int length, struct squashfs_read_request *req)
+{
+	struct squashfs_cache_entry *entry;
 
+	entry = squashfs_cache_find(cache, block);
+	if (entry)
+		goto found;
+
+	spin_lock(&cache->lock);
+
+	while (1) {
+		/*
+		 * Check again under the lock, the block may have been added
+		 * by another process which missed at the same time.
+		 */
+		entry = squashfs_cache_find(cache, block);
+		if (entry) {
+			spin_unlock(&cache->lock);
+			goto found;
+		}
+
+		entry = squashfs_cache_evict(cache);
+		if (entry == NULL) {
 			/*
-			 * While filling this entry one or more other processes
-			 * have looked it up in the cache, and have slept
-			 * waiting for it to become available.
+			 * All cache entries are used, go to sleep waiting for
+			 * one to become available.
 			 */
-			if (entry->num_waiters) {
-				spin_unlock(&cache->lock);
-				wake_up_all(&entry->wait_queue);
-			} else
-				spin_unlock(&cache->lock);
-
-			goto out;
+			spin_unlock(&cache->lock);
+			wait_event(cache->wait_queue,
+				squashfs_cache_unused(cache));
+			spin_lock(&cache->lock);
+			continue;
 		}
 
 		/*
-		 * Block already in cache.  Increment refcount so it doesn't
-		 * get reused until we're finished with it, if it was
-		 * previously unused there's one less cache entry available
-		 * for reuse.
+		 * Initialise chosen cache entry, rehash it under the new
+		 * block, and fill it in from disk.
 		 */
-		entry = &cache->entry[i];
-		if (entry->refcount == 0)
-			cache->unused--;
-		entry->refcount++;
+		hlist_nulls_del_init_rcu(&entry->hash);
+		WRITE_ONCE(entry->block, block);
+		entry->pending = 1;
+		entry->error = 0;
+		hlist_nulls_add_head_rcu(&entry->hash,
+			&cache->hash[hash_64(block, cache->hash_bits)]);
+		atomic_set_release(&entry->refcount, 1);
+		spin_unlock(&cache->lock);
+
+		if (req) {
+			entry->length = squashfs_read_data_complete(sb, req,
+				&entry->next_index, entry->actor);
+			req = NULL;
+		} else
+			entry->length = squashfs_read_data(sb, block, length,
+				&entry->next_index, entry->actor);
+
+		if (entry->length < 0)
+			entry->error = entry->length;
 
 		/*
-		 * If the entry is currently being filled in by another process
-		 * go to sleep waiting for it to become available.
+		 * While filling this entry one or more other processes
+		 * may have looked it up in the cache, and have slept
+		 * waiting for it to become available.
 		 */
-		if (entry->pending) {
-			entry->num_waiters++;
-			spin_unlock(&cache->lock);
-			wait_event(entry->wait_queue, !entry->pending);
-		} else
-			spin_unlock(&cache->lock);
+		smp_store_release(&entry->pending, 0);
+		wake_up_all(&entry->wait_queue);
 
 		goto out;
 	}
 
+found:
+	/*
+	 * Block already in cache.  Mark it referenced for the LRU clock, and
+	 * if it is currently being filled in by another process go to sleep
+	 * waiting for it to become available.
+	 */
+	if (!READ_ONCE(entry->referenced))
+		WRITE_ONCE(entry->referenced, true);
+
+	wait_event(entry->wait_queue, !smp_load_acquire(&entry->pending));
+
 out:
+	if (req)
+		squashfs_read_data_cancel(req);
+
 	TRACE("Got %s %d, start block %lld, refcount %d, error %d\n",
-		cache->name, i, entry->block, entry->refcount, entry->error);
+		cache->name, (int) (entry - cache->entry), entry->block,
+		atomic_read(&entry->refcount), entry->error);
 
 	if (entry->error)
 		ERROR("Unable to read %s cache entry [%llx]\n", cache->name,
@@ -167,6 +240,13 @@ struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
 }
 
 
+struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
+	struct squashfs_cache *cache, u64 block, int length)
+{
+	return squashfs_cache_lookup(sb, cache, block, length, NULL);
+}
+
+
 /*
  * Release cache entry, once usage count is zero it can be reused.
  */
@@ -174,21 +254,13 @@ void squashfs_cache_put(struct squashfs_cache_entry *entry)
 {
 	struct squashfs_cache *cache = entry->cache;
 
-	spin_lock(&cache->lock);
-	entry->refcount--;
-	if (entry->refcount == 0) {
-		cache->unused++;
-		/*
-		 * If there's any processes waiting for a block to become
-		 * available, wake one up.
-		 */
-		if (cache->num_waiters) {
-			spin_unlock(&cache->lock);
-			wake_up(&cache->wait_queue);
-			return;
-		}
-	}
-	spin_unlock(&cache->lock);
+	/*
+	 * If there's any processes waiting for a block to become
+	 * available, wake one up.
+	 */
+	if (atomic_dec_and_test(&entry->refcount) &&
+			wq_has_sleeper(&cache->wait_queue))
+		wake_up(&cache->wait_queue);
 }
 
 /*
@@ -210,6 +282,7 @@ void squashfs_cache_delete(struct squashfs_cache *cache)
 		kfree(cache->entry[i].actor);
 	}
 
+	kfree(cache->hash);
 	kfree(cache->entry);
 	kfree(cache);
 }
@@ -237,17 +310,26 @@ struct squashfs_cache *squashfs_cache_init(char *name, int entries,
 		goto cleanup;
 	}
 
-	cache->curr_blk = 0;
-	cache->next_blk = 0;
-	cache->unused = entries;
+	/* Two hash chains per entry, rounded up to a power of two */
+	cache->hash_bits = ilog2(roundup_pow_of_two(entries)) + 1;
+	cache->hash = kcalloc(1 << cache->hash_bits, sizeof(*(cache->hash)),
+		GFP_KERNEL);
+	if (cache->hash == NULL) {
+		ERROR("Failed to allocate %s cache\n", name);
+		goto cleanup;
+	}
+
+	for (i = 0; i < 1 << cache->hash_bits; i++)
+		INIT_HLIST_NULLS_HEAD(&cache->hash[i], i);
+
 	cache->entries = entries;
 	cache->block_size = block_size;
 	cache->pages = block_size >> PAGE_SHIFT;
 	cache->pages = cache->pages ? cache->pages : 1;
 	cache->name = name;
-	cache->num_waiters = 0;
 	spin_lock_init(&cache->lock);
 	init_waitqueue_head(&cache->wait_queue);
+	INIT_LIST_HEAD(&cache->lru);
 
 	for (i = 0; i < entries; i++) {
 		struct squashfs_cache_entry *entry = &cache->entry[i];
@@ -255,6 +337,8 @@ struct squashfs_cache *squashfs_cache_init(char *name, int entries,
 		init_waitqueue_head(&cache->entry[i].wait_queue);
 		entry->cache = cache;
 		entry->block = SQUASHFS_INVALID_BLK;
+		atomic_set(&entry->refcount, 0);
+		list_add_tail(&entry->lru, &cache->lru);
 		entry->data = kcalloc(cache->pages, sizeof(void *), GFP_KERNEL);
 		if (entry->data == NULL) {
 			ERROR("Failed to allocate %s cache entry\n", name);
@@ -400,6 +484,20 @@ struct squashfs_cache_entry *squashfs_get_datablock(struct super_block *sb,
 }
 
 
+/*
+ * As squashfs_get_datablock(), but for a datablock whose read has already
+ * been started with squashfs_read_data_submit().
+ */
+struct squashfs_cache_entry *squashfs_get_datablock_req(struct super_block *sb,
+				struct squashfs_read_request *req)
+{
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+
+	return squashfs_cache_lookup(sb, msblk->read_page, req->index,
+		req->length, req);
+}
+
+
 /*
  * Read a filesystem table (uncompressed sequence of bytes) from disk
  */
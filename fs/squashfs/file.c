@@ -27,6 +27,7 @@
  * 16 KiB.
  */
 
+#include <linux/blkdev.h>
 #include <linux/fs.h>
 #include <linux/vfs.h>
 #include <linux/kernel.h>
@@ -34,6 +35,7 @@
 #include <linux/string.h>
 #include <linux/pagemap.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -320,20 +322,23 @@ static int fill_meta_index(struct inode *inode, int index,
 
 
 /*
- * Get the on-disk location and compressed size of the datablock
- * specified by index.  Fill_meta_index() does most of the work.
+ * Get the on-disk location and compressed size of the count datablocks
+ * starting at index.  Fill_meta_index() does most of the work, the
+ * following blocks are contiguous on disk and their sizes follow in
+ * the block list.
  */
-static int read_blocklist(struct inode *inode, int index, u64 *block)
+static int read_blocklist_range(struct inode *inode, int index, int count,
+	u64 *block, int *bsize)
 {
 	u64 start;
 	long long blks;
-	int offset;
+	int i, offset;
 	__le32 size;
 	int res = fill_meta_index(inode, index, &start, &offset, block);
 
-	TRACE("read_blocklist: res %d, index %d, start 0x%llx, offset"
-		       " 0x%x, block 0x%llx\n", res, index, start, offset,
-			*block);
+	TRACE("read_blocklist: res %d, index %d, count %d, start 0x%llx, "
+		       "offset 0x%x, block 0x%llx\n", res, index, count, start,
+			offset, *block);
 
 	if (res < 0)
 		return res;
@@ -352,13 +357,35 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 	}
 
 	/*
-	 * Read length of block specified by index.
+	 * Read lengths of the blocks specified by index and count.
 	 */
-	res = squashfs_read_metadata(inode->i_sb, &size, &start, &offset,
-			sizeof(size));
-	if (res < 0)
-		return res;
-	return squashfs_block_size(size);
+	for (i = 0; i < count; i++) {
+		res = squashfs_read_metadata(inode->i_sb, &size, &start,
+				&offset, sizeof(size));
+		if (res < 0)
+			return res;
+
+		bsize[i] = squashfs_block_size(size);
+		if (bsize[i] < 0)
+			return bsize[i];
+
+		if (i + 1 < count)
+			block[i + 1] = block[i] +
+				SQUASHFS_COMPRESSED_SIZE_BLOCK(bsize[i]);
+	}
+
+	return 0;
+}
+
+/*
+ * Get the on-disk location and compressed size of the datablock
+ * specified by index.
+ */
+static int read_blocklist(struct inode *inode, int index, u64 *block)
+{
+	int bsize, res = read_blocklist_range(inode, index, 1, block, &bsize);
+
+	return res < 0 ? res : bsize;
 }
 
 void squashfs_fill_page(struct page *page, struct squashfs_cache_entry *buffer, int offset, int avail)
@@ -378,6 +405,24 @@ void squashfs_fill_page(struct page *page, struct squashfs_cache_entry *buffer,
 		SetPageError(page);
 }
 
+/*
+ * Copy datablock into an array of pages covering it, as used by
+ * readahead.  Pages which are NULL have been skipped by the caller.
+ */
+void squashfs_fill_pages(struct page **page, int pages,
+	struct squashfs_cache_entry *buffer, int bytes)
+{
+	int i, offset = 0;
+
+	for (i = 0; i < pages && bytes > 0; i++,
+			bytes -= PAGE_SIZE, offset += PAGE_SIZE) {
+		int avail = buffer ? min_t(int, bytes, PAGE_SIZE) : 0;
+
+		if (page[i])
+			squashfs_fill_page(page[i], buffer, offset, avail);
+	}
+}
+
 /* Copy data into page cache  */
 void squashfs_copy_cache(struct page *page, struct squashfs_cache_entry *buffer,
 	int bytes, int offset)
@@ -495,6 +540,165 @@ static int squashfs_readpage(struct file *file, struct page *page)
 }
 
 
+/* A datablock of the readahead window, and the pages grabbed for it */
+struct squashfs_readahead_work {
+	struct work_struct		work;
+	struct inode			*inode;
+	struct page			**page;
+	struct squashfs_read_request	*req;
+	int				pages;
+	int				expected;
+	int				index;
+};
+
+static void squashfs_readahead_finish(struct squashfs_readahead_work *ra)
+{
+	int i, res = 0;
+
+	if (ra->req == NULL)
+		squashfs_fill_pages(ra->page, ra->pages, NULL, ra->expected);
+	else
+		res = squashfs_readahead_block(ra->inode, ra->page, ra->pages,
+						ra->req, ra->expected);
+
+	if (res)
+		TRACE("readahead of block %d failed %d\n", ra->index, res);
+
+	for (i = 0; i < ra->pages; i++) {
+		if (ra->page[i] == NULL)
+			continue;
+		unlock_page(ra->page[i]);
+		put_page(ra->page[i]);
+	}
+}
+
+static void squashfs_readahead_worker(struct work_struct *work)
+{
+	squashfs_readahead_finish(container_of(work,
+				struct squashfs_readahead_work, work));
+}
+
+/*
+ * Readahead maps the window onto whole datablocks.  The block list for
+ * the window is looked up in one go and the reads of all the blocks are
+ * started up front.  The pages of every block are then grabbed, including
+ * those of the block that fall outside the window, and each block is
+ * decompressed into all of its pages at once.  If the decompressor can run
+ * several streams in parallel, all blocks but the first are handed to the
+ * per-superblock workqueue, so that a large window is decompressed on as
+ * many CPUs as there are streams, while the caller decompresses the first
+ * block itself.  A tail end packed in a fragment, and anything that fails,
+ * is left to squashfs_readpage().
+ */
+static void squashfs_readahead(struct readahead_control *ractl)
+{
+	struct inode *inode = ractl->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int shift = msblk->block_log - PAGE_SHIFT;
+	loff_t i_size = i_size_read(inode);
+	int file_end = i_size >> msblk->block_log;
+	pgoff_t last_page = (i_size - 1) >> PAGE_SHIFT;
+	pgoff_t next = readahead_index(ractl);
+	struct squashfs_readahead_work *ra = NULL, *local = NULL;
+	struct squashfs_read_request *req = NULL;
+	int first, last, count, n;
+	struct page **page = NULL;
+	struct blk_plug plug;
+	int *bsize = NULL;
+	u64 *block = NULL;
+
+	if (i_size == 0 || next > last_page)
+		return;
+
+	first = next >> shift;
+	last = min_t(pgoff_t, next + readahead_count(ractl) - 1,
+			last_page) >> shift;
+	if (last == file_end && squashfs_i(inode)->fragment_block !=
+					SQUASHFS_INVALID_BLK)
+		last--;
+	if (last < first)
+		return;
+
+	count = last - first + 1;
+	page = kmalloc_array(count << shift, sizeof(*page), GFP_KERNEL);
+	block = kmalloc_array(count, sizeof(*block), GFP_KERNEL);
+	bsize = kmalloc_array(count, sizeof(*bsize), GFP_KERNEL);
+	req = kmalloc_array(count, sizeof(*req), GFP_KERNEL);
+	ra = kmalloc_array(count, sizeof(*ra), GFP_KERNEL);
+	if (page == NULL || block == NULL || bsize == NULL || req == NULL ||
+			ra == NULL)
+		goto out;
+
+	if (read_blocklist_range(inode, first, count, block, bsize) < 0)
+		goto out;
+
+	blk_start_plug(&plug);
+	for (n = 0; n < count; n++)
+		if (bsize[n])
+			squashfs_read_data_submit(inode->i_sb, block[n],
+						  bsize[n], &req[n]);
+	blk_finish_plug(&plug);
+
+	for (n = 0; n < count; n++) {
+		int index = first + n;
+		pgoff_t start = (pgoff_t) index << shift;
+		struct page **block_page = page + (n << shift);
+		int pages = min_t(pgoff_t, last_page - start,
+					(1 << shift) - 1) + 1;
+		int i, nr, skip = next - start;
+
+		nr = __readahead_batch(ractl, block_page + skip, pages - skip);
+		next += nr;
+
+		/* Grab the pages of the block outside the window */
+		for (i = 0; i < pages; i++) {
+			if (i >= skip && i < skip + nr)
+				continue;
+
+			block_page[i] = grab_cache_page_nowait(ractl->mapping,
+								start + i);
+			if (block_page[i] && PageUptodate(block_page[i])) {
+				unlock_page(block_page[i]);
+				put_page(block_page[i]);
+				block_page[i] = NULL;
+			}
+		}
+
+		INIT_WORK(&ra[n].work, squashfs_readahead_worker);
+		ra[n].inode = inode;
+		ra[n].page = block_page;
+		ra[n].req = bsize[n] ? &req[n] : NULL;
+		ra[n].pages = pages;
+		ra[n].expected = index == file_end ?
+			(i_size & (msblk->block_size - 1)) :
+			 msblk->block_size;
+		ra[n].index = index;
+
+		/* Sparse blocks are only zeroed, not worth handing off */
+		if (ra[n].req == NULL || msblk->read_wq == NULL)
+			squashfs_readahead_finish(&ra[n]);
+		else if (local == NULL)
+			local = &ra[n];
+		else
+			queue_work(msblk->read_wq, &ra[n].work);
+	}
+
+	if (local)
+		squashfs_readahead_finish(local);
+
+	/* Wait for the workers before freeing what they use */
+	for (n = 0; n < count; n++)
+		flush_work(&ra[n].work);
+
+out:
+	kfree(ra);
+	kfree(req);
+	kfree(bsize);
+	kfree(block);
+	kfree(page);
+}
+
 const struct address_space_operations squashfs_aops = {
-	.readpage = squashfs_readpage
+	.readpage = squashfs_readpage,
+	.readahead = squashfs_readahead
 };
@@ -34,3 +34,24 @@ int squashfs_readpage_block(struct page *page, u64 block, int bsize, int expecte
 	squashfs_cache_put(buffer);
 	return res;
 }
+
+/*
+ * Finish reading separately compressed datablock for readahead, and
+ * memcopy into the pages
+ */
+int squashfs_readahead_block(struct inode *inode, struct page **page,
+	int pages, struct squashfs_read_request *req, int expected)
+{
+	struct squashfs_cache_entry *buffer =
+		squashfs_get_datablock_req(inode->i_sb, req);
+	int res = buffer->error;
+
+	if (res)
+		ERROR("Unable to read page, block %llx, size %x\n", req->index,
+			req->length);
+	else
+		squashfs_fill_pages(page, pages, buffer, expected);
+
+	squashfs_cache_put(buffer);
+	return res;
+}
@@ -172,3 +172,62 @@ static int squashfs_read_cache(struct page *target_page, u64 block, int bsize,
 	squashfs_cache_put(buffer);
 	return res;
 }
+
+
+/*
+ * Finish reading separately compressed datablock for readahead.  The
+ * caller has grabbed the pages covered by the block, if any is missing fall
+ * back to using an intermediate buffer.  Pages are left locked.
+ */
+int squashfs_readahead_block(struct inode *inode, struct page **page,
+	int pages, struct squashfs_read_request *req, int expected)
+{
+	struct squashfs_cache_entry *buffer;
+	struct squashfs_page_actor *actor;
+	int i, bytes, res;
+	void *pageaddr;
+
+	for (i = 0; i < pages; i++)
+		if (page[i] == NULL)
+			goto read_cache;
+
+	actor = squashfs_page_actor_init_special(page, pages, 0);
+	if (actor == NULL)
+		goto read_cache;
+
+	/* Decompress directly into the page cache buffers */
+	res = squashfs_read_data_complete(inode->i_sb, req, NULL, actor);
+	kfree(actor);
+	if (res < 0)
+		return res;
+
+	if (res != expected)
+		return -EIO;
+
+	/* Last page may have trailing bytes not filled */
+	bytes = res % PAGE_SIZE;
+	if (bytes) {
+		pageaddr = kmap_atomic(page[pages - 1]);
+		memset(pageaddr + bytes, 0, PAGE_SIZE - bytes);
+		kunmap_atomic(pageaddr);
+	}
+
+	for (i = 0; i < pages; i++) {
+		flush_dcache_page(page[i]);
+		SetPageUptodate(page[i]);
+	}
+
+	return 0;
+
+read_cache:
+	buffer = squashfs_get_datablock_req(inode->i_sb, req);
+	res = buffer->error;
+	if (res)
+		ERROR("Unable to read page, block %llx, size %x\n", req->index,
+			req->length);
+	else
+		squashfs_fill_pages(page, pages, buffer, expected);
+
+	squashfs_cache_put(buffer);
+	return res;
+}
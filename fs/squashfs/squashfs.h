@@ -17,6 +17,12 @@
 /* block.c */
 extern int squashfs_read_data(struct super_block *, u64, int, u64 *,
 				struct squashfs_page_actor *);
+extern void squashfs_read_data_submit(struct super_block *, u64, int,
+				struct squashfs_read_request *);
+extern int squashfs_read_data_complete(struct super_block *,
+				struct squashfs_read_request *, u64 *,
+				struct squashfs_page_actor *);
+extern void squashfs_read_data_cancel(struct squashfs_read_request *);
 
 /* cache.c */
 extern struct squashfs_cache *squashfs_cache_init(char *, int, int);
@@ -31,6 +37,9 @@ extern struct squashfs_cache_entry *squashfs_get_fragment(struct super_block *,
 				u64, int);
 extern struct squashfs_cache_entry *squashfs_get_datablock(struct super_block *,
 				u64, int);
+extern struct squashfs_cache_entry *squashfs_get_datablock_req(
+				struct super_block *,
+				struct squashfs_read_request *);
 extern void *squashfs_read_table(struct super_block *, u64, int);
 
 /* decompressor.c */
@@ -55,11 +64,15 @@ extern __le64 *squashfs_read_fragment_index_table(struct super_block *,
 
 /* file.c */
 void squashfs_fill_page(struct page *, struct squashfs_cache_entry *, int, int);
+void squashfs_fill_pages(struct page **, int, struct squashfs_cache_entry *,
+				int);
 void squashfs_copy_cache(struct page *, struct squashfs_cache_entry *, int,
 				int);
 
 /* file_xxx.c */
 extern int squashfs_readpage_block(struct page *, u64, int, int);
+extern int squashfs_readahead_block(struct inode *, struct page **, int,
+				struct squashfs_read_request *, int);
 
 /* id.c */
 extern int squashfs_get_id(struct super_block *, unsigned int, unsigned int *);
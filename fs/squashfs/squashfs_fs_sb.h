@@ -10,36 +10,49 @@
  * squashfs_fs_sb.h
  */
 
+#include <linux/list_nulls.h>
+
 #include "squashfs_fs.h"
 
 struct squashfs_cache {
 	char			*name;
 	int			entries;
-	int			curr_blk;
-	int			next_blk;
-	int			num_waiters;
-	int			unused;
 	int			block_size;
 	int			pages;
+	unsigned int		hash_bits;
 	spinlock_t		lock;
 	wait_queue_head_t	wait_queue;
+	struct list_head	lru;
+	struct hlist_nulls_head	*hash;
 	struct squashfs_cache_entry *entry;
 };
 
 struct squashfs_cache_entry {
 	u64			block;
 	int			length;
-	int			refcount;
+	atomic_t		refcount;
 	u64			next_index;
 	int			pending;
 	int			error;
-	int			num_waiters;
+	bool			referenced;
 	wait_queue_head_t	wait_queue;
 	struct squashfs_cache	*cache;
+	struct hlist_nulls_node	hash;
+	struct list_head	lru;
 	void			**data;
 	struct squashfs_page_actor	*actor;
 };
 
+/* Datablock read in flight, see squashfs_read_data_submit() */
+struct squashfs_read_request {
+	struct bio		*bio;
+	struct completion	done;
+	u64			index;
+	int			length;
+	int			offset;
+	int			error;
+};
+
 struct squashfs_sb_info {
 	const struct squashfs_decompressor	*decompressor;
 	int					devblksize;
@@ -54,6 +67,7 @@ struct squashfs_sb_info {
 	struct mutex				meta_index_mutex;
 	struct meta_index			*meta_index;
 	struct squashfs_stream			*stream;
+	struct workqueue_struct			*read_wq;
 	__le64					*inode_lookup_table;
 	u64					inode_table;
 	u64					directory_table;
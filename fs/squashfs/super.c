@@ -18,6 +18,8 @@
 
 #include <linux/fs.h>
 #include <linux/fs_context.h>
+#include <linux/fs_parser.h>
+#include <linux/seq_file.h>
 #include <linux/vfs.h>
 #include <linux/slab.h>
 #include <linux/mutex.h>
@@ -26,6 +28,7 @@
 #include <linux/module.h>
 #include <linux/magic.h>
 #include <linux/xattr.h>
+#include <linux/workqueue.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -37,6 +40,54 @@
 static struct file_system_type squashfs_fs_type;
 static const struct super_operations squashfs_super_ops;
 
+/* Upper bound on the number of entries of the metadata and fragment caches */
+#define SQUASHFS_CACHE_MAX	1024
+
+struct squashfs_mount_opts {
+	unsigned int metadata_cache;
+	unsigned int fragment_cache;
+};
+
+enum {
+	Opt_metadata_cache,
+	Opt_fragment_cache,
+};
+
+static const struct fs_parameter_spec squashfs_fs_parameters[] = {
+	fsparam_u32("metadata_cache", Opt_metadata_cache),
+	fsparam_u32("fragment_cache", Opt_fragment_cache),
+	{}
+};
+
+static int squashfs_parse_param(struct fs_context *fc,
+	struct fs_parameter *param)
+{
+	struct squashfs_mount_opts *opts = fc->fs_private;
+	struct fs_parse_result result;
+	int opt;
+
+	opt = fs_parse(fc, squashfs_fs_parameters, param, &result);
+	if (opt < 0)
+		return opt;
+
+	if (result.uint_32 == 0 || result.uint_32 > SQUASHFS_CACHE_MAX)
+		return invalfc(fc, "%s must be between 1 and %d", param->key,
+			       SQUASHFS_CACHE_MAX);
+
+	switch (opt) {
+	case Opt_metadata_cache:
+		opts->metadata_cache = result.uint_32;
+		break;
+	case Opt_fragment_cache:
+		opts->fragment_cache = result.uint_32;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 static const struct squashfs_decompressor *supported_squashfs_filesystem(
 	struct fs_context *fc,
 	short major, short minor, short id)
@@ -67,6 +118,7 @@ static const struct squashfs_decompressor *supported_squashfs_filesystem(
 
 static int squashfs_fill_super(struct super_block *sb, struct fs_context *fc)
 {
+	struct squashfs_mount_opts *opts = fc->fs_private;
 	struct squashfs_sb_info *msblk;
 	struct squashfs_super_block *sblk = NULL;
 	struct inode *root;
@@ -195,7 +247,8 @@ static int squashfs_fill_super(struct super_block *sb, struct fs_context *fc)
 	err = -ENOMEM;
 
 	msblk->block_cache = squashfs_cache_init("metadata",
-			SQUASHFS_CACHED_BLKS, SQUASHFS_METADATA_SIZE);
+			opts->metadata_cache ? : SQUASHFS_CACHED_BLKS,
+			SQUASHFS_METADATA_SIZE);
 	if (msblk->block_cache == NULL)
 		goto failed_mount;
 
@@ -214,6 +267,20 @@ static int squashfs_fill_super(struct super_block *sb, struct fs_context *fc)
 		goto insanity;
 	}
 
+	/*
+	 * Readahead decompresses the datablocks of a window in parallel when
+	 * there is more than one decompressor, with as many workers as there
+	 * are decompressors.
+	 */
+	if (squashfs_max_decompressors() > 1) {
+		msblk->read_wq = alloc_workqueue("squashfs-%s",
+			WQ_UNBOUND | WQ_HIGHPRI | WQ_MEM_RECLAIM,
+			min_t(int, squashfs_max_decompressors(),
+			      num_online_cpus()), sb->s_id);
+		if (msblk->read_wq == NULL)
+			goto failed_mount;
+	}
+
 	/* Handle xattrs */
 	sb->s_xattr = squashfs_xattr_handlers;
 	xattr_id_table_start = le64_to_cpu(sblk->xattr_id_table_start);
@@ -270,7 +337,8 @@ static int squashfs_fill_super(struct super_block *sb, struct fs_context *fc)
 		goto check_directory_table;
 
 	msblk->fragment_cache = squashfs_cache_init("fragment",
-		SQUASHFS_CACHED_FRAGMENTS, msblk->block_size);
+		opts->fragment_cache ? : SQUASHFS_CACHED_FRAGMENTS,
+		msblk->block_size);
 	if (msblk->fragment_cache == NULL) {
 		err = -ENOMEM;
 		goto failed_mount;
@@ -333,6 +401,8 @@ static int squashfs_fill_super(struct super_block *sb, struct fs_context *fc)
 	squashfs_cache_delete(msblk->fragment_cache);
 	squashfs_cache_delete(msblk->read_page);
 	squashfs_decompressor_destroy(msblk);
+	if (msblk->read_wq)
+		destroy_workqueue(msblk->read_wq);
 	kfree(msblk->inode_lookup_table);
 	kfree(msblk->fragment_index);
 	kfree(msblk->id_table);
@@ -350,22 +420,62 @@ static int squashfs_get_tree(struct fs_context *fc)
 
 static int squashfs_reconfigure(struct fs_context *fc)
 {
+	struct squashfs_sb_info *msblk = fc->root->d_sb->s_fs_info;
+	struct squashfs_mount_opts *opts = fc->fs_private;
+
 	sync_filesystem(fc->root->d_sb);
 	fc->sb_flags |= SB_RDONLY;
+
+	/* The caches are sized at mount time */
+	if ((opts->metadata_cache &&
+	     opts->metadata_cache != msblk->block_cache->entries) ||
+	    (opts->fragment_cache && msblk->fragment_cache &&
+	     opts->fragment_cache != msblk->fragment_cache->entries))
+		warnf(fc, "Cache sizes cannot be changed on remount");
+
 	return 0;
 }
 
+static void squashfs_free_fs_context(struct fs_context *fc)
+{
+	kfree(fc->fs_private);
+}
+
 static const struct fs_context_operations squashfs_context_ops = {
 	.get_tree	= squashfs_get_tree,
+	.free		= squashfs_free_fs_context,
+	.parse_param	= squashfs_parse_param,
 	.reconfigure	= squashfs_reconfigure,
 };
 
 static int squashfs_init_fs_context(struct fs_context *fc)
 {
+	struct squashfs_mount_opts *opts;
+
+	opts = kzalloc(sizeof(*opts), GFP_KERNEL);
+	if (!opts)
+		return -ENOMEM;
+
+	fc->fs_private = opts;
 	fc->ops = &squashfs_context_ops;
 	return 0;
 }
 
+static int squashfs_show_options(struct seq_file *s, struct dentry *root)
+{
+	struct squashfs_sb_info *msblk = root->d_sb->s_fs_info;
+
+	if (msblk->block_cache->entries != SQUASHFS_CACHED_BLKS)
+		seq_printf(s, ",metadata_cache=%d",
+			   msblk->block_cache->entries);
+	if (msblk->fragment_cache &&
+	    msblk->fragment_cache->entries != SQUASHFS_CACHED_FRAGMENTS)
+		seq_printf(s, ",fragment_cache=%d",
+			   msblk->fragment_cache->entries);
+
+	return 0;
+}
+
 static int squashfs_statfs(struct dentry *dentry, struct kstatfs *buf)
 {
 	struct squashfs_sb_info *msblk = dentry->d_sb->s_fs_info;
@@ -394,6 +504,8 @@ static void squashfs_put_super(struct super_block *sb)
 		squashfs_cache_delete(sbi->fragment_cache);
 		squashfs_cache_delete(sbi->read_page);
 		squashfs_decompressor_destroy(sbi);
+		if (sbi->read_wq)
+			destroy_workqueue(sbi->read_wq);
 		kfree(sbi->id_table);
 		kfree(sbi->fragment_index);
 		kfree(sbi->meta_index);
@@ -481,6 +593,7 @@ static struct file_system_type squashfs_fs_type = {
 	.owner = THIS_MODULE,
 	.name = "squashfs",
 	.init_fs_context = squashfs_init_fs_context,
+	.parameters = squashfs_fs_parameters,
 	.kill_sb = kill_block_super,
 	.fs_flags = FS_REQUIRES_DEV
 };
@@ -491,6 +604,7 @@ static const struct super_operations squashfs_super_ops = {
 	.free_inode = squashfs_free_inode,
 	.statfs = squashfs_statfs,
 	.put_super = squashfs_put_super,
+	.show_options = squashfs_show_options,
 };
 
 module_init(init_squashfs_fs);
@@ -61,6 +61,14 @@ struct merkle_tree_params {
 	u64 level_start[FS_VERITY_MAX_LEVELS];
 };
 
+/* Number of verified Merkle tree block hashes cached per file, see verify.c */
+#define FS_VERITY_HASH_CACHE_SIZE	8
+
+struct fsverity_hash_cache_entry {
+	u64 hindex;	/* hash block index + 1, or 0 if unused */
+	u8 hash[FS_VERITY_MAX_DIGEST_SIZE];
+};
+
 /*
  * fsverity_info - cached verity metadata for an inode
  *
@@ -68,13 +76,16 @@ struct merkle_tree_params {
  * and stored in ->i_verity_info; it remains until the inode is evicted.  It
  * caches information about the Merkle tree that's needed to efficiently verify
  * data read from the file.  It also caches the file measurement.  The Merkle
- * tree pages themselves are not cached here, but the filesystem may cache them.
+ * tree pages themselves are not cached here, but the filesystem may cache them;
+ * only the hashes of a few verified upper-level tree blocks are.
  */
 struct fsverity_info {
 	struct merkle_tree_params tree_params;
 	u8 root_hash[FS_VERITY_MAX_DIGEST_SIZE];
 	u8 measurement[FS_VERITY_MAX_DIGEST_SIZE];
 	const struct inode *inode;
+	spinlock_t hash_cache_lock;
+	struct fsverity_hash_cache_entry hash_cache[FS_VERITY_HASH_CACHE_SIZE];
 };
 
 /*
@@ -185,6 +185,7 @@ struct fsverity_info *fsverity_create_info(const struct inode *inode,
 	if (!vi)
 		return ERR_PTR(-ENOMEM);
 	vi->inode = inode;
+	spin_lock_init(&vi->hash_cache_lock);
 
 	err = fsverity_init_merkle_tree_params(&vi->tree_params, inode,
 					       desc->hash_algorithm,
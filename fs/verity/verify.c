@@ -67,12 +67,50 @@ static inline int cmp_hashes(const struct fsverity_info *vi,
 }
 
 /*
- * Verify a single data page against the file's Merkle tree.
+ * Small cache of the hashes of Merkle tree blocks that have been verified, for
+ * the levels above level 0.  These are the blocks on the path of every data
+ * page, so if their pages were dropped from the page cache and read again, the
+ * cached hash lets them be verified without ascending the rest of the tree.
+ *
+ * Entries are indexed by hash block index; ->hindex is stored plus one so that
+ * a zeroed entry is empty.
+ */
+static bool lookup_verified_hash(struct fsverity_info *vi, pgoff_t hindex,
+				 u8 *out)
+{
+	struct fsverity_hash_cache_entry *ent =
+		&vi->hash_cache[hindex % FS_VERITY_HASH_CACHE_SIZE];
+	bool found;
+
+	spin_lock(&vi->hash_cache_lock);
+	found = ent->hindex == (u64)hindex + 1;
+	if (found)
+		memcpy(out, ent->hash, vi->tree_params.digest_size);
+	spin_unlock(&vi->hash_cache_lock);
+	return found;
+}
+
+static void cache_verified_hash(struct fsverity_info *vi, pgoff_t hindex,
+				const u8 *hash)
+{
+	struct fsverity_hash_cache_entry *ent =
+		&vi->hash_cache[hindex % FS_VERITY_HASH_CACHE_SIZE];
+
+	spin_lock(&vi->hash_cache_lock);
+	ent->hindex = (u64)hindex + 1;
+	memcpy(ent->hash, hash, vi->tree_params.digest_size);
+	spin_unlock(&vi->hash_cache_lock);
+}
+
+/*
+ * Get the level 0 hash page which holds the hash of data page @index, verified
+ * against the file's Merkle tree.
  *
  * In principle, we need to verify the entire path to the root node.  However,
  * for efficiency the filesystem may cache the hash pages.  Therefore we need
  * only ascend the tree until an already-verified page is seen, as indicated by
- * the PageChecked bit being set; then verify the path to that page.
+ * the PageChecked bit being set, or a page whose hash is in the cache of
+ * verified hashes; then verify the path to that page.
  *
  * This code currently only supports the case where the verity block size is
  * equal to PAGE_SIZE.  Doing otherwise would be possible but tricky, since we
@@ -81,28 +119,26 @@ static inline int cmp_hashes(const struct fsverity_info *vi,
  * Note that multiple processes may race to verify a hash page and mark it
  * Checked, but it doesn't matter; the result will be the same either way.
  *
- * Return: true if the page is valid, else false.
+ * Return: the hash page with a reference held, NULL if the tree has no levels
+ * (the file is a single block, whose hash is the root hash), or an ERR_PTR().
  */
-static bool verify_page(struct inode *inode, const struct fsverity_info *vi,
-			struct ahash_request *req, struct page *data_page,
-			unsigned long level0_ra_pages)
+static struct page *get_verified_hash_page(struct inode *inode,
+					   struct fsverity_info *vi,
+					   struct ahash_request *req,
+					   pgoff_t index,
+					   unsigned long level0_ra_pages)
 {
 	const struct merkle_tree_params *params = &vi->tree_params;
 	const unsigned int hsize = params->digest_size;
-	const pgoff_t index = data_page->index;
 	int level;
 	u8 _want_hash[FS_VERITY_MAX_DIGEST_SIZE];
 	const u8 *want_hash;
 	u8 real_hash[FS_VERITY_MAX_DIGEST_SIZE];
 	struct page *hpages[FS_VERITY_MAX_LEVELS];
 	unsigned int hoffsets[FS_VERITY_MAX_LEVELS];
+	pgoff_t hindexes[FS_VERITY_MAX_LEVELS];
 	int err;
 
-	if (WARN_ON_ONCE(!PageLocked(data_page) || PageUptodate(data_page)))
-		return false;
-
-	pr_debug_ratelimited("Verifying data page %lu...\n", index);
-
 	/*
 	 * Starting at the leaf level, ascend the tree saving hash pages along
 	 * the way until we find a verified hash page, indicated by PageChecked;
@@ -129,6 +165,8 @@ static bool verify_page(struct inode *inode, const struct fsverity_info *vi,
 		}
 
 		if (PageChecked(hpage)) {
+			if (level == 0)
+				return hpage;
 			extract_hash(hpage, hoffset, hsize, _want_hash);
 			want_hash = _want_hash;
 			put_page(hpage);
@@ -140,6 +178,16 @@ static bool verify_page(struct inode *inode, const struct fsverity_info *vi,
 		pr_debug_ratelimited("Hash page not yet checked\n");
 		hpages[level] = hpage;
 		hoffsets[level] = hoffset;
+		hindexes[level] = hindex;
+
+		if (level > 0 && lookup_verified_hash(vi, hindex, _want_hash)) {
+			want_hash = _want_hash;
+			level++;
+			pr_debug_ratelimited("Hash of hash page cached, want %s:%*phN\n",
+					     params->hash_alg->name,
+					     hsize, want_hash);
+			goto descend;
+		}
 	}
 
 	want_hash = vi->root_hash;
@@ -158,6 +206,10 @@ static bool verify_page(struct inode *inode, const struct fsverity_info *vi,
 		if (err)
 			goto out;
 		SetPageChecked(hpage);
+		if (level - 1 > 0)
+			cache_verified_hash(vi, hindexes[level - 1], real_hash);
+		if (level == 1)
+			return hpage;
 		extract_hash(hpage, hoffset, hsize, _want_hash);
 		want_hash = _want_hash;
 		put_page(hpage);
@@ -165,16 +217,74 @@ static bool verify_page(struct inode *inode, const struct fsverity_info *vi,
 			 level - 1, params->hash_alg->name, hsize, want_hash);
 	}
 
-	/* Finally, verify the data page */
-	err = fsverity_hash_page(params, inode, req, data_page, real_hash);
-	if (err)
-		goto out;
-	err = cmp_hashes(vi, want_hash, real_hash, index, -1);
+	/* No tree levels: the root hash is the hash of the only data block */
+	return NULL;
 out:
 	for (; level > 0; level--)
 		put_page(hpages[level - 1]);
 
-	return err == 0;
+	return ERR_PTR(err);
+}
+
+/*
+ * Verify a data page against its level 0 hash page, as returned by
+ * get_verified_hash_page().
+ *
+ * Return: true if the page is valid, else false.
+ */
+static bool verify_data_page(struct inode *inode, struct fsverity_info *vi,
+			     struct ahash_request *req, struct page *data_page,
+			     struct page *hpage)
+{
+	const struct merkle_tree_params *params = &vi->tree_params;
+	const unsigned int hsize = params->digest_size;
+	const pgoff_t index = data_page->index;
+	u8 _want_hash[FS_VERITY_MAX_DIGEST_SIZE];
+	const u8 *want_hash = vi->root_hash;
+	u8 real_hash[FS_VERITY_MAX_DIGEST_SIZE];
+	int err;
+
+	if (WARN_ON_ONCE(!PageLocked(data_page) || PageUptodate(data_page)))
+		return false;
+
+	pr_debug_ratelimited("Verifying data page %lu...\n", index);
+
+	if (hpage) {
+		pgoff_t hindex;
+		unsigned int hoffset;
+
+		hash_at_level(params, index, 0, &hindex, &hoffset);
+		extract_hash(hpage, hoffset, hsize, _want_hash);
+		want_hash = _want_hash;
+	}
+
+	err = fsverity_hash_page(params, inode, req, data_page, real_hash);
+	if (err)
+		return false;
+	return cmp_hashes(vi, want_hash, real_hash, index, -1) == 0;
+}
+
+/*
+ * Verify a single data page against the file's Merkle tree.
+ *
+ * Return: true if the page is valid, else false.
+ */
+static bool verify_page(struct inode *inode, struct fsverity_info *vi,
+			struct ahash_request *req, struct page *data_page,
+			unsigned long level0_ra_pages)
+{
+	struct page *hpage;
+	bool valid;
+
+	hpage = get_verified_hash_page(inode, vi, req, data_page->index,
+				       level0_ra_pages);
+	if (IS_ERR(hpage))
+		return false;
+
+	valid = verify_data_page(inode, vi, req, data_page, hpage);
+	if (hpage)
+		put_page(hpage);
+	return valid;
 }
 
 /**
@@ -189,7 +299,7 @@ static bool verify_page(struct inode *inode, const struct fsverity_info *vi,
 bool fsverity_verify_page(struct page *page)
 {
 	struct inode *inode = page->mapping->host;
-	const struct fsverity_info *vi = inode->i_verity_info;
+	struct fsverity_info *vi = inode->i_verity_info;
 	struct ahash_request *req;
 	bool valid;
 
@@ -214,6 +324,10 @@ EXPORT_SYMBOL_GPL(fsverity_verify_page);
  * that fail verification are set to the Error state.  Verification is skipped
  * for pages already in the Error state, e.g. due to fscrypt decryption failure.
  *
+ * Consecutive pages whose hashes are in the same level 0 hash page, i.e. up to
+ * 'hashes_per_block' of them, are verified as a batch: the path from that hash
+ * page to the root is only looked up and checked once for all of them.
+ *
  * This is a helper function for use by the ->readpages() method of filesystems
  * that issue bios to read data directly into the page cache.  Filesystems that
  * populate the page cache without issuing bios (e.g. non block-based
@@ -223,12 +337,14 @@ EXPORT_SYMBOL_GPL(fsverity_verify_page);
 void fsverity_verify_bio(struct bio *bio)
 {
 	struct inode *inode = bio_first_page_all(bio)->mapping->host;
-	const struct fsverity_info *vi = inode->i_verity_info;
+	struct fsverity_info *vi = inode->i_verity_info;
 	const struct merkle_tree_params *params = &vi->tree_params;
 	struct ahash_request *req;
 	struct bio_vec *bv;
 	struct bvec_iter_all iter_all;
 	unsigned long max_ra_pages = 0;
+	unsigned long cur_level0_index = ULONG_MAX;
+	struct page *hpage = NULL;
 
 	/* This allocation never fails, since it's mempool-backed. */
 	req = fsverity_alloc_hash_request(params->hash_alg, GFP_NOFS);
@@ -254,11 +370,26 @@ void fsverity_verify_bio(struct bio *bio)
 		unsigned long level0_ra_pages =
 			min(max_ra_pages, params->level0_blocks - level0_index);
 
-		if (!PageError(page) &&
-		    !verify_page(inode, vi, req, page, level0_ra_pages))
+		if (PageError(page))
+			continue;
+
+		if (level0_index != cur_level0_index) {
+			if (!IS_ERR_OR_NULL(hpage))
+				put_page(hpage);
+			hpage = get_verified_hash_page(inode, vi, req,
+						       page->index,
+						       level0_ra_pages);
+			cur_level0_index = level0_index;
+		}
+
+		if (IS_ERR(hpage) ||
+		    !verify_data_page(inode, vi, req, page, hpage))
 			SetPageError(page);
 	}
 
+	if (!IS_ERR_OR_NULL(hpage))
+		put_page(hpage);
+
 	fsverity_free_hash_request(params->hash_alg, req);
 }
 EXPORT_SYMBOL_GPL(fsverity_verify_bio);
@@ -30,11 +30,20 @@ struct vring ring;
  * (which skips ring updates and reads and writes len in descriptor).
  */
 /* #ifdef INORDER */
+/* enabling the below activates VIRTIO_F_IN_ORDER batching as in the spec
+ * (descriptors are used in ring order, and host writes a single used entry
+ * for a batch of buffers, naming the last one).
+ */
+/* #ifdef INORDER_BATCH */
 
 #if defined(RING_POLL) && defined(INORDER)
 #error "RING_POLL and INORDER are mutually exclusive"
 #endif
 
+#if defined(INORDER_BATCH) && (defined(RING_POLL) || defined(INORDER))
+#error "INORDER_BATCH excludes RING_POLL and INORDER"
+#endif
+
 /* how much padding is needed to avoid false cache sharing */
 #define HOST_GUEST_PADDING 0x80
 
@@ -43,12 +52,20 @@ struct guest {
 	unsigned short last_used_idx;
 	unsigned short num_free;
 	unsigned short kicked_avail_idx;
-#ifndef INORDER
+#if !defined(INORDER) && !defined(INORDER_BATCH)
 	unsigned short free_head;
 #else
 	unsigned short reserved_free_head;
 #endif
+#ifdef INORDER_BATCH
+	/* Last used entry read, or ~0 as id if no batch is pending. */
+	unsigned short reserved_pad;
+	unsigned batch_last_id;
+	unsigned batch_last_len;
+	unsigned char reserved[HOST_GUEST_PADDING - 20];
+#else
 	unsigned char reserved[HOST_GUEST_PADDING - 10];
+#endif
 } guest;
 
 struct host {
@@ -57,7 +74,13 @@ struct host {
 	 */
 	unsigned short used_idx;
 	unsigned short called_used_idx;
+#ifdef INORDER_BATCH
+	/* used_idx lags avail_idx until a batch is complete. */
+	unsigned short avail_idx;
+	unsigned char reserved[HOST_GUEST_PADDING - 6];
+#else
 	unsigned char reserved[HOST_GUEST_PADDING - 4];
+#endif
 } host;
 
 /* implemented by ring */
@@ -78,7 +101,10 @@ void alloc_ring(void)
 	guest.avail_idx = 0;
 	guest.kicked_avail_idx = -1;
 	guest.last_used_idx = 0;
-#ifndef INORDER
+#ifdef INORDER_BATCH
+	guest.batch_last_id = ~0u;
+#endif
+#if !defined(INORDER) && !defined(INORDER_BATCH)
 	/* Put everything in free lists. */
 	guest.free_head = 0;
 #endif
@@ -86,6 +112,9 @@ void alloc_ring(void)
 		ring.desc[i].next = i + 1;
 	host.used_idx = 0;
 	host.called_used_idx = -1;
+#ifdef INORDER_BATCH
+	host.avail_idx = 0;
+#endif
 	guest.num_free = ring_size;
 	data = malloc(ring_size * sizeof *data);
 	if (!data) {
@@ -109,6 +138,8 @@ int add_inbuf(unsigned len, void *buf, void *datap)
 
 #ifdef INORDER
 	head = (ring_size - 1) & (guest.avail_idx++);
+#elif defined(INORDER_BATCH)
+	head = (ring_size - 1) & guest.avail_idx;
 #else
 	head = guest.free_head;
 #endif
@@ -123,7 +154,7 @@ int add_inbuf(unsigned len, void *buf, void *datap)
 	 * descriptors.
 	 */
 	desc[head].flags &= ~VRING_DESC_F_NEXT;
-#ifndef INORDER
+#if !defined(INORDER) && !defined(INORDER_BATCH)
 	guest.free_head = desc[head].next;
 #endif
 
@@ -171,6 +202,17 @@ void *get_buf(unsigned *lenp, void **bufp)
 #ifdef INORDER
 	head = (ring_size - 1) & guest.last_used_idx;
 	index = head;
+#elif defined(INORDER_BATCH)
+	/* A batch has a single used entry at its first used index, naming
+	 * its last buffer: read it when no batch is pending, and return the
+	 * buffers up to the one it names in ring order.
+	 */
+	if (guest.batch_last_id == ~0u) {
+		head = (ring_size - 1) & guest.last_used_idx;
+		guest.batch_last_id = ring.used->ring[head].id;
+		guest.batch_last_len = ring.used->ring[head].len;
+	}
+	index = (ring_size - 1) & (guest.avail_idx + guest.num_free);
 #else
 	head = (ring_size - 1) & guest.last_used_idx;
 	index = ring.used->ring[head].id;
@@ -179,13 +221,21 @@ void *get_buf(unsigned *lenp, void **bufp)
 #endif
 #ifdef INORDER
 	*lenp = ring.desc[index].len;
+#elif defined(INORDER_BATCH)
+	if (index == guest.batch_last_id) {
+		guest.batch_last_id = ~0u;
+		*lenp = guest.batch_last_len;
+	} else {
+		*lenp = ring.desc[index].len;
+	}
 #else
 	*lenp = ring.used->ring[head].len;
 #endif
 	datap = data[index].data;
+	assert(datap);
 	*bufp = (void*)(unsigned long)ring.desc[index].addr;
 	data[index].data = NULL;
-#ifndef INORDER
+#if !defined(INORDER) && !defined(INORDER_BATCH)
 	ring.desc[index].next = guest.free_head;
 	guest.free_head = index;
 #endif
@@ -249,7 +299,11 @@ void disable_kick()
 
 bool enable_kick()
 {
+#ifdef INORDER_BATCH
+	vring_avail_event(&ring) = host.avail_idx;
+#else
 	vring_avail_event(&ring) = host.used_idx;
+#endif
 	/* Barrier C (for pairing) */
 	smp_mb();
 	return avail_empty();
@@ -257,7 +311,11 @@ bool enable_kick()
 
 bool avail_empty()
 {
+#ifdef INORDER_BATCH
+	unsigned head = host.avail_idx;
+#else
 	unsigned head = host.used_idx;
+#endif
 #ifdef RING_POLL
 	unsigned index = ring.avail->ring[head & (ring_size - 1)];
 
@@ -267,6 +325,47 @@ bool avail_empty()
 #endif
 }
 
+#ifdef INORDER_BATCH
+bool use_buf(unsigned *lenp, void **bufp)
+{
+	unsigned avail_idx = host.avail_idx;
+	unsigned used_idx = host.used_idx & (ring_size - 1);
+	struct vring_desc *desc;
+	unsigned head;
+
+	if (avail_idx == ring.avail->idx)
+		return false;
+
+	/* Barrier A (for pairing) */
+	smp_acquire();
+
+	head = ring.avail->ring[avail_idx & (ring_size - 1)];
+	desc = &ring.desc[head];
+
+	*lenp = desc->len;
+	*bufp = (void *)(unsigned long)desc->addr;
+
+	/* Buffers are used in order, so their used index is their avail
+	 * index.  Once the batch is complete, after param buffers if set or
+	 * when we run out of available ones, write a single used entry at
+	 * the batch's first used index, naming its last buffer, and move
+	 * used->idx past the whole batch.
+	 */
+	host.avail_idx++;
+
+	if ((unsigned short)(host.avail_idx - host.used_idx) == param ||
+	    host.avail_idx == ring.avail->idx) {
+		ring.used->ring[used_idx].id = head;
+		ring.used->ring[used_idx].len = desc->len - 1;
+		/* Barrier B (for pairing) */
+		smp_release();
+		host.used_idx = host.avail_idx;
+		ring.used->idx = host.used_idx;
+	}
+
+	return true;
+}
+#else
 bool use_buf(unsigned *lenp, void **bufp)
 {
 	unsigned used_idx = host.used_idx;
@@ -315,6 +414,7 @@ bool use_buf(unsigned *lenp, void **bufp)
 	
 	return true;
 }
+#endif
 
 void call_used(void)
 {
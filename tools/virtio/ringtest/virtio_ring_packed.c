@@ -0,0 +1,399 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Partial implementation of the virtio 1.1 packed ring. Flags are used for
+ * signalling, unconditionally. Design roughly follows linux kernel
+ * implementation in order to be able to judge its performance.
+ *
+ * Buffers take one to three descriptors in turn, so that buffer ids and
+ * descriptor counts differ, as they do for chained buffers in the kernel.
+ */
+#define _GNU_SOURCE
+#include "main.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <linux/virtio_ring.h>
+
+/* enabling the below activates VIRTIO_F_IN_ORDER batching as in the spec
+ * (buffers are used in ring order, and host writes a single used element
+ * for a batch of buffers, naming the last one).
+ */
+/* #ifdef INORDER_BATCH */
+
+#define MAX_DESCS_PER_BUF 3
+
+struct desc_state {
+	void *data;
+	void *buf;
+	unsigned short num;	/* descriptors used by the buffer */
+	unsigned short last;	/* last id of the buffer */
+	unsigned short next;	/* next id in the free list */
+} *state;
+
+struct vring_packed_desc *desc;
+struct vring_packed_desc_event *driver, *device;
+
+/* how much padding is needed to avoid false cache sharing */
+#define HOST_GUEST_PADDING 0x80
+
+struct guest {
+	unsigned short next_avail_idx;
+	unsigned short avail_used_flags;
+	unsigned short last_used_idx;
+	unsigned short num_free;
+	unsigned short free_head;
+	unsigned short num_added;
+	unsigned short next_inorder_id;
+	unsigned short batch_skipped;
+	unsigned char avail_wrap_counter;
+	unsigned char used_wrap_counter;
+	unsigned char reserved[HOST_GUEST_PADDING - 18];
+} guest;
+
+struct host {
+	unsigned short avail_idx;
+	unsigned short used_idx;
+	unsigned short used_count;
+	unsigned short called_used_count;
+	unsigned char avail_wrap_counter;
+	unsigned char used_wrap_counter;
+#ifdef INORDER_BATCH
+	/* Buffers and descriptors used since the last used element. */
+	unsigned short batch_bufs;
+	unsigned short batch_descs;
+	unsigned char reserved[HOST_GUEST_PADDING - 14];
+#else
+	unsigned char reserved[HOST_GUEST_PADDING - 10];
+#endif
+} host;
+
+/* implemented by ring */
+void alloc_ring(void)
+{
+	size_t size = ring_size * sizeof *desc + 2 * sizeof *driver;
+	int ret;
+	int i;
+	void *p;
+
+	ret = posix_memalign(&p, 0x1000, size);
+	if (ret) {
+		perror("Unable to allocate ring buffer.\n");
+		exit(3);
+	}
+	memset(p, 0, size);
+	desc = p;
+	driver = (void *)(desc + ring_size);
+	device = driver + 1;
+
+	guest.next_avail_idx = 0;
+	guest.avail_wrap_counter = 1;
+	guest.avail_used_flags = 1 << VRING_PACKED_DESC_F_AVAIL;
+	guest.last_used_idx = 0;
+	guest.used_wrap_counter = 1;
+	guest.num_free = ring_size;
+	guest.num_added = 0;
+	guest.next_inorder_id = 0;
+	guest.batch_skipped = 0;
+	host.avail_idx = 0;
+	host.avail_wrap_counter = 1;
+	host.used_idx = 0;
+	host.used_wrap_counter = 1;
+	host.used_count = 0;
+	host.called_used_count = 0;
+#ifdef INORDER_BATCH
+	host.batch_bufs = 0;
+	host.batch_descs = 0;
+#endif
+
+	state = malloc(ring_size * sizeof *state);
+	if (!state) {
+		perror("Unable to allocate state buffer.\n");
+		exit(3);
+	}
+	memset(state, 0, ring_size * sizeof *state);
+
+	/* Put everything in free lists. */
+	guest.free_head = 0;
+	for (i = 0; i < ring_size - 1; i++)
+		state[i].next = i + 1;
+#ifdef INORDER_BATCH
+	/* In order, ids are handed out in ring order, wrapping. */
+	state[i].next = 0;
+#endif
+}
+
+/* guest side */
+int add_inbuf(unsigned len, void *buf, void *datap)
+{
+	static unsigned nbufs;
+	unsigned num = 1 + nbufs % MAX_DESCS_PER_BUF;
+	unsigned short head, id, prev = 0, curr, head_flags = 0;
+	unsigned i, c;
+
+	if (guest.num_free < num)
+		return -1;
+	nbufs++;
+
+	head = guest.next_avail_idx;
+	id = guest.free_head;
+	curr = id;
+	i = head;
+	for (c = 0; c < num; c++) {
+		unsigned short flags = guest.avail_used_flags |
+			(c + 1 == num ? 0 : VRING_DESC_F_NEXT);
+
+		desc[i].addr = (unsigned long)buf;
+		desc[i].len = len;
+		desc[i].id = id;
+		if (i == head)
+			head_flags = flags;
+		else
+			desc[i].flags = flags;
+
+		prev = curr;
+		curr = state[curr].next;
+		if (++i >= ring_size) {
+			i = 0;
+			guest.avail_wrap_counter ^= 1;
+			guest.avail_used_flags ^=
+				1 << VRING_PACKED_DESC_F_AVAIL |
+				1 << VRING_PACKED_DESC_F_USED;
+		}
+	}
+
+	guest.num_free -= num;
+	guest.next_avail_idx = i;
+	guest.free_head = curr;
+	guest.num_added += num;
+
+	state[id].data = datap;
+	state[id].buf = buf;
+	state[id].num = num;
+	state[id].last = prev;
+
+	/* Barrier A (for pairing) */
+	smp_release();
+	desc[head].flags = head_flags;
+	return 0;
+}
+
+static bool is_used_desc(unsigned short idx, bool wrap_counter)
+{
+	unsigned short flags = READ_ONCE(desc[idx].flags);
+	bool avail = !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL));
+	bool used = !!(flags & (1 << VRING_PACKED_DESC_F_USED));
+
+	return avail == used && used == wrap_counter;
+}
+
+static void detach_buf(unsigned short id)
+{
+	struct desc_state *s = &state[id];
+
+	s->data = NULL;
+#ifdef INORDER_BATCH
+	guest.next_inorder_id = state[s->last].next;
+#else
+	state[s->last].next = guest.free_head;
+	guest.free_head = id;
+#endif
+	guest.num_free += s->num;
+}
+
+void *get_buf(unsigned *lenp, void **bufp)
+{
+	unsigned short last_used = guest.last_used_idx;
+	unsigned short id;
+	void *datap;
+
+	if (!is_used_desc(last_used, guest.used_wrap_counter))
+		return NULL;
+	/* Barrier B (for pairing) */
+	smp_acquire();
+
+	id = desc[last_used].id;
+	assert(id < ring_size);
+	assert(state[id].data);
+	*lenp = desc[last_used].len;
+
+#ifdef INORDER_BATCH
+	/* A batch has a single used element at its first descriptor, naming
+	 * its last buffer: return the buffers up to the one it names in the
+	 * order they were added, counting their descriptors. These stay off
+	 * the free count until the batch is done, so that add_inbuf doesn't
+	 * overwrite the used element.
+	 */
+	if (guest.next_inorder_id != id) {
+		id = guest.next_inorder_id;
+		datap = state[id].data;
+		assert(datap);
+		*bufp = state[id].buf;
+		guest.batch_skipped += state[id].num;
+		detach_buf(id);
+		guest.num_free -= state[id].num;
+		return datap;
+	}
+#endif
+
+	datap = state[id].data;
+	*bufp = state[id].buf;
+	detach_buf(id);
+
+	last_used += state[id].num + guest.batch_skipped;
+	guest.num_free += guest.batch_skipped;
+	guest.batch_skipped = 0;
+	if (last_used >= ring_size) {
+		last_used -= ring_size;
+		guest.used_wrap_counter ^= 1;
+	}
+	guest.last_used_idx = last_used;
+	return datap;
+}
+
+bool used_empty()
+{
+	return !is_used_desc(guest.last_used_idx, guest.used_wrap_counter);
+}
+
+void disable_call()
+{
+	driver->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+}
+
+bool enable_call()
+{
+	driver->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+	/* Flush call flags write */
+	/* Barrier D (for pairing) */
+	smp_mb();
+	return used_empty();
+}
+
+void kick_available(void)
+{
+	/* Flush in previous flags write */
+	/* Barrier C (for pairing) */
+	smp_mb();
+	if (!guest.num_added ||
+	    READ_ONCE(device->flags) == VRING_PACKED_EVENT_FLAG_DISABLE)
+		return;
+
+	guest.num_added = 0;
+	kick();
+}
+
+/* host side */
+void disable_kick()
+{
+	device->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+}
+
+bool enable_kick()
+{
+	device->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+	/* Barrier C (for pairing) */
+	smp_mb();
+	return avail_empty();
+}
+
+static bool is_avail_desc(unsigned short idx, bool wrap_counter)
+{
+	unsigned short flags = READ_ONCE(desc[idx].flags);
+	bool avail = !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL));
+	bool used = !!(flags & (1 << VRING_PACKED_DESC_F_USED));
+
+	return avail == wrap_counter && used != wrap_counter;
+}
+
+bool avail_empty()
+{
+	return !is_avail_desc(host.avail_idx, host.avail_wrap_counter);
+}
+
+/* Write a used element for buffer @id at the next used index, and move the
+ * used index past @num descriptors.
+ */
+static void put_used(unsigned short id, unsigned len, unsigned short num)
+{
+	unsigned short used_idx = host.used_idx;
+	unsigned short flags = 0;
+
+	if (host.used_wrap_counter)
+		flags = 1 << VRING_PACKED_DESC_F_AVAIL |
+			1 << VRING_PACKED_DESC_F_USED;
+
+	desc[used_idx].id = id;
+	desc[used_idx].len = len;
+	/* Barrier B (for pairing) */
+	smp_release();
+	desc[used_idx].flags = flags;
+
+	used_idx += num;
+	if (used_idx >= ring_size) {
+		used_idx -= ring_size;
+		host.used_wrap_counter ^= 1;
+	}
+	host.used_idx = used_idx;
+	host.used_count++;
+}
+
+bool use_buf(unsigned *lenp, void **bufp)
+{
+	unsigned short idx = host.avail_idx;
+	unsigned short id, flags, num = 0;
+
+	if (!is_avail_desc(idx, host.avail_wrap_counter))
+		return false;
+
+	/* Barrier A (for pairing) */
+	smp_acquire();
+
+	id = desc[idx].id;
+	*lenp = desc[idx].len;
+	*bufp = (void *)(unsigned long)desc[idx].addr;
+
+	do {
+		flags = desc[idx].flags;
+		assert(desc[idx].id == id);
+		num++;
+		if (++idx >= ring_size) {
+			idx = 0;
+			host.avail_wrap_counter ^= 1;
+		}
+	} while (flags & VRING_DESC_F_NEXT);
+	assert(num <= MAX_DESCS_PER_BUF);
+	host.avail_idx = idx;
+
+#ifdef INORDER_BATCH
+	/* Once the batch is complete, after param buffers if set or when we
+	 * run out of available ones, write a single used element at the
+	 * batch's first descriptor, naming its last buffer, and move the
+	 * used index past the whole batch.
+	 */
+	host.batch_bufs++;
+	host.batch_descs += num;
+	if (host.batch_bufs == param || avail_empty()) {
+		put_used(id, *lenp - 1, host.batch_descs);
+		host.batch_bufs = 0;
+		host.batch_descs = 0;
+	}
+#else
+	put_used(id, *lenp - 1, num);
+#endif
+
+	return true;
+}
+
+void call_used(void)
+{
+	/* Flush in previous flags write */
+	/* Barrier D (for pairing) */
+	smp_mb();
+	if (host.called_used_count == host.used_count ||
+	    READ_ONCE(driver->flags) == VRING_PACKED_EVENT_FLAG_DISABLE)
+		return;
+
+	host.called_used_count = host.used_count;
+	call();
+}